@@ -34,12 +34,27 @@
 #define GLOBAL_OPTS_CORE   "afhjmv"
 
 /* options reserved for global use - modes cannot use these */
-#define GLOBAL_OPTS        "DF:HP:hi:qr:vw"
+#define GLOBAL_OPTS        "DF:HP:Vhi:j:qr:vw"
 #define GLOBAL_OPTS_OUTPUT "O:a:d:o:z:"
 
 /* set this environment variable to enable debugging.  can also use -D, but this enables it earlier */
 #define SHNTOOL_DEBUG_ENV "ST_DEBUG"
 
+/* set this environment variable to the number of buffers to run decoder/encoder pipes through a reader/writer thread */
+#define SHNTOOL_PIPELINE_ENV "ST_PIPELINE"
+
+/* set this environment variable to the capacity in bytes of pipes to and from helper programs (0 = system default) */
+#define SHNTOOL_PIPE_SIZE_ENV "ST_PIPE_SIZE"
+
+/* set this environment variable to a directory in which to cache WAVE header information between runs */
+#define SHNTOOL_CACHE_ENV "ST_CACHE"
+
+/* set this environment variable to the number of encoders that modes slicing one stream into several files may run at once */
+#define SHNTOOL_ENCODERS_ENV "ST_ENCODERS"
+
+/* set this environment variable to the number of megabytes those encoders may have buffered between them */
+#define SHNTOOL_ENCODER_BUFFER_ENV "ST_ENCODER_BUFFER"
+
 /* various buffer sizes */
 #define PROGNAME_SIZE 256
 #define MAX_FILENAMES 32768
@@ -119,8 +134,10 @@ typedef struct _private_opts {
   int    clobber_action;
   int    reorder_type;
   int    progress_type;
+  int    jobs;
   bool   is_aliased;
   bool   show_hmmss;
+  bool   verify_metadata;
   bool   suppress_warnings;
   bool   suppress_stderr;
   bool   screen_dirty;
@@ -32,6 +32,9 @@ int write_padding(FILE *,int,progress_info *);
 /* reads n bytes from a file into a buffer */
 int read_n_bytes(FILE *,unsigned char *,int,progress_info *);
 
+/* reads n bytes from a file into a buffer, leaving them in the file to be read again */
+int peek_n_bytes(FILE *,unsigned char *,int);
+
 /* writes n bytes from a buffer into a file */
 int write_n_bytes(FILE *,unsigned char *,int,progress_info *);
 
@@ -40,6 +43,34 @@ unsigned long transfer_n_bytes_internal(FILE *,FILE *,FILE *,unsigned long,progr
 #define transfer_n_bytes(a,b,c,d)       transfer_n_bytes_internal(a,b,NULL,c,d)
 #define transfer_n_bytes2(a,b,c,d,e)    transfer_n_bytes_internal(a,b,c,d,e)
 
+/* transfers n bytes from a file into each of several files */
+unsigned long transfer_n_bytes_multi(FILE *,FILE **,int,unsigned long,progress_info *);
+
+/* reads a decoder pipe without stdio buffering, so that its data can be moved by the kernel, if possible */
+bool direct_input_attach(FILE *);
+
+/* forgets about a decoder pipe that is about to be closed */
+void direct_input_detach(FILE *);
+
+/* starts reading n bytes of a decoder pipe ahead of time in a separate thread, if enabled */
+bool pipeline_read_ahead(FILE *,wlong);
+
+/* hands writes to an encoder pipe off to a separate thread, if enabled */
+bool pipeline_write_behind(FILE *);
+
+/* stops any reader/writer thread attached to a file, returning FALSE if it failed */
+bool pipeline_finish(FILE *);
+
+/* hands writes to an encoder pipe off to a separate thread buffering them in memory shared by all such pipes */
+bool pipeline_queue_behind(FILE *);
+
+/* lets the thread of a queued encoder pipe close it when done, and later waits for that */
+int pipeline_close_behind(FILE *);
+bool pipeline_join(int);
+
+/* opens a read-only stream over a buffer in memory */
+FILE *open_memory_stream(unsigned char *,int);
+
 /* reads an unsigned long in big- and/or little-endian format from a file descriptor */
 bool read_value_long(FILE * file,unsigned long *,unsigned long *,unsigned char *);
 #define read_tag(f,t)     read_value_long(f,NULL,NULL,t)
@@ -64,6 +64,11 @@ typedef struct _format_module {
   void  (*extra_info)(char *);               /* routine to display extra information in info mode */
   void  (*create_output_filename)(char *);   /* routine to create a custom output filename */
   bool  (*input_header_kluge)(unsigned char *,struct _wave_info *);  /* routine to determine correct header info for when decoders are unable to do so themselves */
+  unsigned char *(*native_header)(struct _wave_info *,int *);       /* routine to build the WAVE header the decoder would produce from the file's own metadata, without running the decoder */
+  bool  (*embedded_md5)(struct _wave_info *,unsigned char *);       /* routine to read the MD5 signature of the audio data stored in the file, where it equals that of the decoder's WAVE data */
+
+  /* optional decoder arguments - set to NULL if not applicable (also cleared at run time when the user picks another decoder) */
+  char   *decoder_range_args;                /* decoder arguments to decode only part of the file: like decoder_args, plus %b = first sample, %e = sample after the last one, %n = number of samples */
 
   /* internal argument lists (do not assign these in format modules) */
   child_args input_args_template;           /* input argument template (filled out by shntool, based on default_decoder_args) */
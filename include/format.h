@@ -27,6 +27,9 @@
 #include "module.h"
 
 #define FILENAME_PLACEHOLDER "%f"
+#define FIRST_SAMPLE_PLACEHOLDER "%b"
+#define END_SAMPLE_PLACEHOLDER   "%e"
+#define NUM_SAMPLES_PLACEHOLDER  "%n"
 
 /* copies an arbitrary-length tag, without the NULL byte */
 void tagcpy(unsigned char *,unsigned char *);
@@ -42,9 +45,18 @@ format_module *find_format(char *);
 
 /* launch encoders/decoders */
 FILE *launch_input(format_module *,char *,proc_info *);
+
+/* launch a decoder on part of a file, from the first sample given up to (but not including) the second one */
+FILE *launch_input_range(format_module *,char *,proc_info *,wlong,wlong);
 FILE *launch_output(format_module *,char *,proc_info *);
 
 /* generic check for "magic" strings at known offsets */
 bool check_for_magic(char *,char *,int);
 
+/* format detection probe - lets format modules share one buffered stream while examining a file */
+bool probe_begin(char *);
+void probe_end();
+FILE *probe_open(char *);
+void probe_close(FILE *);
+
 #endif
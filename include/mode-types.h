@@ -31,16 +31,22 @@ typedef struct _mode_module {
   char  *const description;       /* one line description of this mode */
   char  *const cvsid;             /* CVS revision (used to prevent it from being stripped) */
   bool  const creates_files;      /* does this mode create output files? */
+  bool  const runs_jobs;          /* can this mode process several input files at once (-j)? */
   bool (*run_main)(int,char **);  /* main() function for this mode */
   void (*run_help)(void);         /* help() function for this mode */
 } mode_module;
 
+/* maximum number of distinct output formats that can be given with -o */
+#define MAX_OUTPUT_FORMATS 16
+
 /* mode-accessible global options */
 typedef struct _global_opts {
   char *output_directory;
   char *output_prefix;
   char *output_postfix;
   format_module *output_format;
+  format_module *output_formats[MAX_OUTPUT_FORMATS];
+  int num_output_formats;
 } global_opts;
 
 /* mode progress status output */
@@ -49,6 +49,9 @@ extern global_opts st_ops;
 /* function to open an input stream and skip past the ID3v2 tag, if one exists */
 bool open_input_stream(wave_info *);
 
+/* function to open an input stream positioned within the WAVE data, decoding as little as possible to get there */
+bool open_input_stream_range(wave_info *,wlong,wlong);
+
 /* function to handle command-line option parsing with global (i.e. non-mode-specific) options */
 int st_getopt(int,char **,char *);
 
@@ -68,14 +71,22 @@ int close_and_wait(FILE *,proc_info *,int,format_module *);
 #define close_input_stream(a)  close_and_wait(a->input,&a->input_proc,CHILD_INPUT,a->input_format)
 #define close_output_stream(a) close_and_wait(a->output,&a->output_proc,CHILD_OUTPUT,NULL)
 
+/* functions to let several encoders run at once, for modes that write one output file after another */
+int output_encoders();
+bool queue_output_stream(FILE *,proc_info *);
+int close_output_behind(FILE *,proc_info *);
+int reap_outputs_behind(int);
+
 /* function to discard the WAVE header, leaving the file pointer at the beginning of the audio data */
 void discard_header(wave_info *);
 
 /* wrapper function to name output filename based on input filename and extension */
 void create_output_filename(char *,char *,char *);
+void create_output_filename_fmt(format_module *,char *,char *,char *);
 
 /* wrapper function to open an output stream */
 FILE *open_output_stream(char *,proc_info *);
+FILE *open_output_stream_fmt(format_module *,char *,proc_info *);
 
 /* function to determine if two filenames point to the same file */
 int files_are_identical(char *,char *);
@@ -105,6 +116,12 @@ void prog_update(progress_info *);
 void prog_success(progress_info *);
 void prog_error(progress_info *);
 
+/* functions for processing the remaining input files, possibly several at once */
+bool process_input_files(bool (*)(char *),void (*)(void *,int));
+void job_report(void *,int);
+int job_count();
+int job_threads();
+
 /* functions for managing the input file source */
 void input_init(int,int,char **);
 char *input_get_filename();
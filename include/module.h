@@ -24,7 +24,9 @@
 #define __MODULE_H__
 
 #include <stdio.h>
+#include "convert.h"
 #include "fileio.h"
+#include "vector.h"
 #include "output.h"
 #include "wave.h"
 #include "module-types.h"
@@ -75,6 +77,9 @@ char *scan_env(char *);
 /* function to determine whether the data on the given file pointer contains an ID3v2 tag */
 unsigned long check_for_id3v2_tag(FILE *);
 
+/* function to determine whether the given header belongs to an ID3v2 tag, returning the tag size if so */
+unsigned long id3v2_tag_size(unsigned char *);
+
 /* function to trim carriage returns and newlines from the end of strings */
 void trim(char *);
 
@@ -0,0 +1,59 @@
+/*  vector.h - vectorised buffer scanning functions
+ *  Copyright (C) 2000-2009  Jason Jordan <shnutils@freeshell.org>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * $Id$
+ */
+
+#ifndef __VECTOR_H__
+#define __VECTOR_H__
+
+/* returns the offset of the first byte that differs between two buffers, or -1 if they are identical */
+int vec_first_mismatch(unsigned char *,unsigned char *,int);
+
+/* counts the bytes that differ between two buffers, stopping early once more than a given limit have been
+ * seen.  the offset of the first difference, or -1, is stored in the last argument.
+ */
+int vec_count_mismatches(unsigned char *,unsigned char *,int,int,int *);
+
+/* stores the offsets of up to a given number of differing bytes between two buffers, returning how many were stored */
+int vec_list_mismatches(unsigned char *,unsigned char *,int,int *,int);
+
+/* return the offset of the first or last non-zero byte in a buffer, or -1 if it is all zeroes */
+int vec_first_nonzero(unsigned char *,int);
+int vec_last_nonzero(unsigned char *,int);
+
+/* return the offset of the first 16-bit little-endian sample in a buffer whose magnitude is above, or
+ * at most, a given level, or -1 if there is none
+ */
+int vec_first_loud16(unsigned char *,int,int);
+int vec_first_quiet16(unsigned char *,int,int);
+
+/* most streams hashed at once by vec_md5_blocks() and vec_sha1_blocks() */
+#define MAX_HASH_LANES 16
+
+/* returns how many streams vec_md5_blocks() and vec_sha1_blocks() hash at once on this CPU */
+int vec_hash_lanes();
+
+/* run the same number of 64-byte blocks from each of several streams through the MD5 or SHA1 compression
+ * function.  state holds the chaining values of each stream in turn: 4 words per stream for MD5, 5 for SHA1.
+ */
+void vec_md5_blocks(unsigned int *,const unsigned char **,int,int);
+void vec_sha1_blocks(unsigned int *,const unsigned char **,int,int);
+
+#endif
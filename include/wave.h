@@ -139,6 +139,15 @@ typedef struct _wave_info {
   wlong id3v2_tag_size;        /* size of the ID3v2 tag this file contains, if any    */
 } wave_info;
 
+typedef struct _wave_cache_key {
+  bool valid;                  /* was the file's status read successfully?           */
+  unsigned long dev,           /* device and inode identify the file                  */
+                ino,
+                size,          /* size, mtime and ctime tell whether it has changed   */
+                mtime,
+                ctime;
+} wave_cache_key;
+
 /* returns a wave_info struct, filled out with the values of the WAVE data contained in the filename given. */
 /* If called with NULL as the argument, then a wave_info struct is returned with all fields zero'd out.     */
 wave_info *new_wave_info(char *);
@@ -146,6 +155,9 @@ wave_info *new_wave_info(char *);
 /* constructs a canonical WAVE header from the values in the wave_info struct */
 void make_canonical_header(unsigned char *buf,wave_info *info);
 
+/* allocates a canonical PCM WAVE header for the given stream parameters, as produced by most decoders */
+unsigned char *new_canonical_header(wave_info *,wshort,wlong,wshort,wlong,wlong,int *);
+
 /* returns a string corresponding to the WAVE format code given */
 char *format_to_str(wshort);
 
@@ -163,4 +175,10 @@ bool do_header_kluges(unsigned char *,wave_info *);
 bool verify_wav_header_internal(wave_info *,bool);
 #define verify_wav_header(a) verify_wav_header_internal(a,FALSE)
 
+/* fills out a wave_info struct from the persistent cache, if it holds a current entry for the file */
+bool cache_lookup(wave_info *,wave_cache_key *);
+
+/* saves the values in a wave_info struct to the persistent cache */
+void cache_store(wave_info *,wave_cache_key *);
+
 #endif
@@ -0,0 +1,223 @@
+/*  core_cache.c - persistent cache of WAVE header information
+ *  Copyright (C) 2000-2009  Jason Jordan <shnutils@freeshell.org>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "shntool.h"
+
+CVSID("$Id$")
+
+/*
+ * Each cached file gets its own entry in the cache directory, named after the device
+ * and inode of the file.  An entry is a single line of text holding the key it was
+ * made for, followed by the fields that new_wave_info() computed.  Entries are written
+ * to a temporary file and renamed into place, so readers only ever see whole entries,
+ * and the last of several concurrent writers wins.  An entry whose key no longer
+ * matches the file is ignored, and replaced the next time the file is examined.
+ */
+
+#define CACHE_MAGIC   "shntool-cache"
+#define CACHE_VERSION 1
+
+#define CACHE_ENTRY_SIZE 512
+
+/* files changed this recently are not cached, since a further change within the
+ * same second would leave their size, mtime and ctime unchanged
+ */
+#define CACHE_MIN_AGE 2
+
+static char *cache_dir()
+/* returns the cache directory chosen by the user, or NULL if caching is disabled */
+{
+  char *p;
+
+  p = scan_env(SHNTOOL_CACHE_ENV);
+
+  if (NULL == p || 0 == *p)
+    return NULL;
+
+  return p;
+}
+
+static bool get_cache_key(char *filename,wave_cache_key *key)
+/* fills out key from the current status of filename */
+{
+  struct stat sz;
+
+  key->valid = FALSE;
+
+  if (stat(filename,&sz))
+    return FALSE;
+
+  key->dev = (unsigned long)sz.st_dev;
+  key->ino = (unsigned long)sz.st_ino;
+  key->size = (unsigned long)sz.st_size;
+  key->mtime = (unsigned long)sz.st_mtime;
+  key->ctime = (unsigned long)sz.st_ctime;
+  key->valid = TRUE;
+
+  return TRUE;
+}
+
+static void cache_entry_name(char *dir,wave_cache_key *key,char *name)
+/* builds the path to the entry for key */
+{
+  st_snprintf(name,FILENAME_SIZE,"%s%c%lx-%lx",dir,PATHSEPCHAR,key->dev,key->ino);
+}
+
+bool cache_lookup(wave_info *info,wave_cache_key *key)
+/* fills out info from the cache, if it holds a current entry for info->filename.
+ * key is always filled out, so that cache_store() can later check the file did
+ * not change while it was being examined.
+ */
+{
+  FILE *f;
+  char *dir,name[FILENAME_SIZE],line[CACHE_ENTRY_SIZE],fmt[CACHE_ENTRY_SIZE],magic[CACHE_ENTRY_SIZE];
+  int version,file_id3,stream_id3;
+  unsigned long size,mtime,ctime,header_size,channels,block_align,bits_per_sample,wave_format;
+  long extra_riff_size;
+  format_module *fm;
+
+  key->valid = FALSE;
+
+  if (NULL == (dir = cache_dir()))
+    return FALSE;
+
+  if (!get_cache_key(info->filename,key))
+    return FALSE;
+
+  /* the user wants the decoder output checked, so don't short-circuit it */
+  if (st_priv.verify_metadata)
+    return FALSE;
+
+  cache_entry_name(dir,key,name);
+
+  if (NULL == (f = fopen(name,"r")))
+    return FALSE;
+
+  if (NULL == fgets(line,CACHE_ENTRY_SIZE,f)) {
+    fclose(f);
+    return FALSE;
+  }
+
+  fclose(f);
+
+  if (24 != sscanf(line,"%s %d %lu %lu %lu %s %lu %ld %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %d %d %lu",
+                   magic,&version,&size,&mtime,&ctime,fmt,
+                   &header_size,&extra_riff_size,&channels,&block_align,&bits_per_sample,&wave_format,
+                   &info->samples_per_sec,&info->avg_bytes_per_sec,&info->rate,&info->length,
+                   &info->data_size,&info->padded_data_size,&info->total_size,&info->chunk_size,
+                   &info->problems,&file_id3,&stream_id3,&info->id3v2_tag_size) ||
+      strcmp(magic,CACHE_MAGIC) || CACHE_VERSION != version)
+  {
+    st_debug2("ignoring unreadable cache entry [%s] for file: [%s]",name,info->filename);
+    return FALSE;
+  }
+
+  if (size != key->size || mtime != key->mtime || ctime != key->ctime) {
+    st_debug2("ignoring stale cache entry [%s] for file: [%s]",name,info->filename);
+    return FALSE;
+  }
+
+  if (NULL == (fm = find_format(fmt)) || !fm->supports_input) {
+    st_debug2("ignoring cache entry [%s] with unknown format [%s] for file: [%s]",name,fmt,info->filename);
+    return FALSE;
+  }
+
+  info->input_format = fm;
+  info->header_size = (wint)header_size;
+  info->extra_riff_size = extra_riff_size;
+  info->channels = (wshort)channels;
+  info->block_align = (wshort)block_align;
+  info->bits_per_sample = (wshort)bits_per_sample;
+  info->wave_format = (wshort)wave_format;
+  info->file_has_id3v2_tag = file_id3 ? TRUE : FALSE;
+  info->stream_has_id3v2_tag = stream_id3 ? TRUE : FALSE;
+  info->exact_length = (double)info->data_size / (double)info->rate;
+
+  length_to_str(info);
+
+  st_debug1("using cached [%s] WAVE header information for file: [%s]",fm->name,info->filename);
+
+  return TRUE;
+}
+
+void cache_store(wave_info *info,wave_cache_key *key)
+/* records the information in info for later runs, if the file did not change while it was examined */
+{
+  FILE *f;
+  char *dir,name[FILENAME_SIZE],tmp[FILENAME_SIZE];
+  wave_cache_key now;
+  time_t t;
+  int fd,ok;
+
+  if (!key->valid || NULL == (dir = cache_dir()))
+    return;
+
+  if (!get_cache_key(info->filename,&now) || now.dev != key->dev || now.ino != key->ino ||
+      now.size != key->size || now.mtime != key->mtime || now.ctime != key->ctime)
+  {
+    st_debug2("not caching file that changed while being examined: [%s]",info->filename);
+    return;
+  }
+
+  t = time(NULL);
+  if ((unsigned long)t < key->mtime + CACHE_MIN_AGE || (unsigned long)t < key->ctime + CACHE_MIN_AGE) {
+    st_debug2("not caching recently modified file: [%s]",info->filename);
+    return;
+  }
+
+  cache_entry_name(dir,key,name);
+  st_snprintf(tmp,FILENAME_SIZE,"%s.%ld",name,(long)getpid());
+
+  if (-1 == (fd = open(tmp,O_WRONLY|O_CREAT|O_EXCL,0666))) {
+    st_debug2("could not create cache entry [%s]: %s",tmp,strerror(errno));
+    return;
+  }
+
+  if (NULL == (f = fdopen(fd,"w"))) {
+    close(fd);
+    unlink(tmp);
+    return;
+  }
+
+  ok = (0 < fprintf(f,"%s %d %lu %lu %lu %s %lu %ld %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %d %d %lu\n",
+                    CACHE_MAGIC,CACHE_VERSION,key->size,key->mtime,key->ctime,info->input_format->name,
+                    (unsigned long)info->header_size,info->extra_riff_size,(unsigned long)info->channels,
+                    (unsigned long)info->block_align,(unsigned long)info->bits_per_sample,(unsigned long)info->wave_format,
+                    info->samples_per_sec,info->avg_bytes_per_sec,info->rate,info->length,
+                    info->data_size,info->padded_data_size,info->total_size,info->chunk_size,
+                    info->problems,info->file_has_id3v2_tag ? 1 : 0,info->stream_has_id3v2_tag ? 1 : 0,info->id3v2_tag_size));
+
+  if (fclose(f))
+    ok = FALSE;
+
+  if (!ok || rename(tmp,name)) {
+    st_debug2("could not write cache entry [%s] for file: [%s]",name,info->filename);
+    unlink(tmp);
+    return;
+  }
+
+  st_debug2("cached WAVE header information for file: [%s]",info->filename);
+}
@@ -16,17 +16,632 @@
  *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+/* splice() and copy_file_range() are GNU extensions -- keep the GNU version
+ * of basename() that comes along with them from colliding with our own
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#define basename gnu_basename
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#undef basename
 #include "shntool.h"
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+#if !defined(WIN32) && defined(HAVE_PTHREAD_CREATE) && defined(HAVE_SEM_INIT)
+#include <pthread.h>
+#include <semaphore.h>
+#endif
 
 CVSID("$Id: core_fileio.c,v 1.44 2009/03/11 17:18:01 jason Exp $")
 
+/* use the kernel to move data between descriptors when it knows how */
+#if !defined(WIN32) && (defined(HAVE_SPLICE) || defined(HAVE_COPY_FILE_RANGE) || defined(HAVE_SENDFILE))
+#define KERNEL_TRANSFER
+#endif
+
+/* read decoder pipes without stdio buffering, so that the kernel can splice their data straight to the output.
+ * tee() came along with splice(), in the same kernel and C library releases, so it needs no check of its own.
+ */
+#if defined(KERNEL_TRANSFER) && defined(HAVE_SPLICE)
+#define DIRECT_INPUT
+#endif
+
+/* overlap decoder/encoder pipe I/O with our own work using reader/writer threads */
+#if !defined(WIN32) && defined(HAVE_PTHREAD_CREATE) && defined(HAVE_SEM_INIT)
+#define PIPELINED_IO
+#endif
+
+#if defined(KERNEL_TRANSFER) || defined(PIPELINED_IO)
+
+/* descriptor types, as far as the kernel transfer engine and I/O pipelines are concerned */
+typedef enum {
+  FD_TYPE_OTHER,
+  FD_TYPE_FILE,
+  FD_TYPE_PIPE
+} fd_types;
+
+static int get_fd_type(FILE *f)
+{
+  struct stat sz;
+
+  if (fstat(fileno(f),&sz))
+    return FD_TYPE_OTHER;
+
+  if (S_ISREG(sz.st_mode))
+    return FD_TYPE_FILE;
+
+  if (S_ISFIFO(sz.st_mode))
+    return FD_TYPE_PIPE;
+
+  return FD_TYPE_OTHER;
+}
+
+#endif
+
+#ifdef PIPELINED_IO
+
+#define MAX_PIPELINES     24
+#define MAX_PIPELINE_BUFS 64
+
+/* limits on the memory shared by queued output streams, in megabytes */
+#define DEFAULT_QUEUE_MB 64
+#define MAX_QUEUE_MB     4096
+
+/* pipeline directions */
+typedef enum {
+  PIPELINE_READ,
+  PIPELINE_WRITE
+} pipeline_directions;
+
+typedef struct _pipeline_slot {
+  unsigned char *buf;
+  int len;
+  bool last;
+} pipeline_slot;
+
+/* single-producer/single-consumer ring of XFER_SIZE buffers.  the two counting
+ * semaphores hand slots back and forth, so head is only touched by the producer
+ * and tail only by the consumer.  worker threads must never call st_*(), since
+ * those functions share static buffers - they just raise the failed flag instead.
+ */
+typedef struct _pipeline {
+  FILE *stream;
+  int direction;
+  pthread_t thread;
+  sem_t filled;
+  sem_t empty;
+  sem_t *free_slots;
+  bool queued;
+  bool detached;
+  pipeline_slot *slots;
+  int num_slots;
+  int head;
+  int tail;
+  int pos;
+  bool have_slot;
+  wlong budget;
+  wlong remaining;
+  volatile int stop;
+  volatile int failed;
+} pipeline;
+
+static pipeline *pipelines[MAX_PIPELINES];
+static int pipeline_bufs = -1;
+
+/* queued output streams don't own their buffers - they draw XFER_SIZE blocks from
+ * this pool as they fill up, and their writer threads give them back once written.
+ * this bounds the memory used by all of them together, however it is spread.
+ */
+static sem_t queue_pool;
+static int queue_blocks = -1;
+
+static int pipeline_buffers()
+/* returns the number of ring buffers requested by the user, or 0 if pipelining is disabled */
+{
+  char *p;
+  int n;
+
+  if (pipeline_bufs < 0) {
+    p = scan_env(SHNTOOL_PIPELINE_ENV);
+    n = p ? atoi(p) : 0;
+    if (1 == n)
+      n = 2;
+    pipeline_bufs = (n > 0) ? min(n,MAX_PIPELINE_BUFS) : 0;
+  }
+
+  return pipeline_bufs;
+}
+
+static int queue_pool_blocks()
+/* returns the number of blocks shared by queued output streams, setting up the pool on first use */
+{
+  char *p;
+  long mb;
+
+  if (queue_blocks < 0) {
+    p = scan_env(SHNTOOL_ENCODER_BUFFER_ENV);
+    mb = p ? atol(p) : DEFAULT_QUEUE_MB;
+    if (mb <= 0)
+      mb = DEFAULT_QUEUE_MB;
+    mb = min(mb,MAX_QUEUE_MB);
+    queue_blocks = (int)max(2,mb * (1048576 / XFER_SIZE));
+    if (sem_init(&queue_pool,0,queue_blocks))
+      queue_blocks = 0;
+  }
+
+  return queue_blocks;
+}
+
+static pipeline *pipeline_find(FILE *f)
+/* returns the pipeline attached to stream f, if any */
+{
+  int i;
+
+  if (NULL == f)
+    return NULL;
+
+  /* a detached pipeline owns its stream, and the address may since have been reused */
+  for (i=0;i<MAX_PIPELINES;i++)
+    if (pipelines[i] && !pipelines[i]->detached && f == pipelines[i]->stream)
+      return pipelines[i];
+
+  return NULL;
+}
+
+static void *pipeline_reader(void *arg)
+/* reader thread - fills slots from the stream until its byte budget runs out */
+{
+  pipeline *p = (pipeline *)arg;
+  pipeline_slot *slot;
+  int want;
+
+  while (p->budget > 0) {
+    sem_wait(&p->empty);
+    if (p->stop)
+      break;
+    slot = &p->slots[p->head];
+    want = (int)min(p->budget,XFER_SIZE);
+    slot->len = fread(slot->buf,1,want,p->stream);
+    p->budget -= slot->len;
+    slot->last = (slot->len != want || 0 == p->budget);
+    p->head = (p->head + 1) % p->num_slots;
+    sem_post(&p->filled);
+    if (slot->last)
+      break;
+  }
+
+  return NULL;
+}
+
+static void *pipeline_writer(void *arg)
+/* writer thread - drains slots into the stream until the last one is seen */
+{
+  pipeline *p = (pipeline *)arg;
+  pipeline_slot *slot;
+  bool last;
+
+  do {
+    sem_wait(&p->filled);
+    slot = &p->slots[p->tail];
+    if (slot->len > 0 && !p->failed && fwrite(slot->buf,1,slot->len,p->stream) != (size_t)slot->len)
+      p->failed = TRUE;
+    last = slot->last;
+    if (p->queued) {
+      free(slot->buf);
+      slot->buf = NULL;
+    }
+    p->tail = (p->tail + 1) % p->num_slots;
+    sem_post(p->free_slots);
+  } while (!last);
+
+  if (!p->failed && fflush(p->stream))
+    p->failed = TRUE;
+
+  /* the main thread has moved on, so closing the stream is up to us - this is what tells the encoder it's done */
+  if (p->detached && fclose(p->stream))
+    p->failed = TRUE;
+
+  return NULL;
+}
+
+static void pipeline_free(pipeline *p)
+/* releases a pipeline's ring */
+{
+  int i;
+
+  for (i=0;i<p->num_slots;i++)
+    st_free(p->slots[i].buf);
+
+  st_free(p->slots);
+  st_free(p);
+}
+
+static bool pipeline_attach(FILE *f,int direction,wlong bytes,bool queued)
+/* starts a reader or writer thread on stream f.  a queued writer takes its buffers from the shared pool. */
+{
+  pipeline *p;
+  int i,slot = -1,bufs;
+
+  bufs = (queued) ? queue_pool_blocks() : pipeline_buffers();
+
+  if (NULL == f || 0 == bufs || pipeline_find(f))
+    return FALSE;
+
+  /* only pipes to and from helper programs are worth a thread */
+  if (FD_TYPE_PIPE != get_fd_type(f))
+    return FALSE;
+
+  if (PIPELINE_READ == direction && (bytes <= 0 || feof(f) || ferror(f)))
+    return FALSE;
+
+  for (i=0;i<MAX_PIPELINES;i++) {
+    if (NULL == pipelines[i]) {
+      slot = i;
+      break;
+    }
+  }
+
+  if (slot < 0)
+    return FALSE;
+
+  if (NULL == (p = calloc(1,sizeof(pipeline))))
+    return FALSE;
+
+  if (NULL == (p->slots = calloc(bufs,sizeof(pipeline_slot)))) {
+    st_free(p);
+    return FALSE;
+  }
+
+  /* the ring can hold the whole pool, since the pool is what limits a queued writer */
+  for (i=0;i<bufs;i++) {
+    if (!queued && NULL == (p->slots[i].buf = malloc(XFER_SIZE))) {
+      pipeline_free(p);
+      return FALSE;
+    }
+    p->num_slots++;
+  }
+
+  p->stream = f;
+  p->direction = direction;
+  p->budget = bytes;
+  p->remaining = bytes;
+  p->queued = queued;
+  p->free_slots = (queued) ? &queue_pool : &p->empty;
+
+  if (sem_init(&p->filled,0,0)) {
+    pipeline_free(p);
+    return FALSE;
+  }
+
+  if (sem_init(&p->empty,0,(queued) ? 0 : p->num_slots)) {
+    sem_destroy(&p->filled);
+    pipeline_free(p);
+    return FALSE;
+  }
+
+  if (pthread_create(&p->thread,NULL,(PIPELINE_READ == direction) ? pipeline_reader : pipeline_writer,p)) {
+    sem_destroy(&p->filled);
+    sem_destroy(&p->empty);
+    pipeline_free(p);
+    return FALSE;
+  }
+
+  pipelines[slot] = p;
+
+  st_debug2("started %d-buffer %s%s pipeline on %s stream",p->num_slots,(queued) ? "queued " : "",
+            (PIPELINE_READ == direction) ? "read-ahead" : "write-behind",(PIPELINE_READ == direction) ? "input" : "output");
+
+  return TRUE;
+}
+
+static bool pipeline_take_slot(pipeline *p,bool need_buf)
+/* waits for a free slot for the main thread to fill, allocating its buffer if it comes from the shared pool */
+{
+  sem_wait(p->free_slots);
+
+  if (p->queued && need_buf && NULL == (p->slots[p->head].buf = malloc(XFER_SIZE))) {
+    sem_post(p->free_slots);
+    return FALSE;
+  }
+
+  p->have_slot = TRUE;
+  p->pos = 0;
+
+  return TRUE;
+}
+
+static bool pipeline_stop(pipeline *p)
+/* joins the worker thread of pipeline p and releases it - returns FALSE if the worker failed */
+{
+  bool success;
+  int i;
+
+  pthread_join(p->thread,NULL);
+
+  success = (p->failed) ? FALSE : TRUE;
+
+  sem_destroy(&p->filled);
+  sem_destroy(&p->empty);
+
+  for (i=0;i<MAX_PIPELINES;i++)
+    if (p == pipelines[i])
+      pipelines[i] = NULL;
+
+  pipeline_free(p);
+
+  return success;
+}
+
+static void pipeline_push(pipeline *p,bool last)
+/* hands the slot currently being filled by the main thread over to the writer */
+{
+  p->slots[p->head].len = p->pos;
+  p->slots[p->head].last = last;
+  p->head = (p->head + 1) % p->num_slots;
+  p->have_slot = FALSE;
+  sem_post(&p->filled);
+}
+
+static int pipeline_read(pipeline *p,unsigned char *buf,int num)
+/* copies up to num bytes out of the read-ahead ring */
+{
+  pipeline_slot *slot;
+  int got = 0,n;
+
+  while (got < num && p->remaining > 0) {
+    if (!p->have_slot) {
+      sem_wait(&p->filled);
+      p->have_slot = TRUE;
+      p->pos = 0;
+    }
+    slot = &p->slots[p->tail];
+    n = min(num - got,slot->len - p->pos);
+    memcpy(buf + got,slot->buf + p->pos,n);
+    got += n;
+    p->pos += n;
+    p->remaining -= n;
+    if (p->pos == slot->len) {
+      /* a short slot means the reader hit the end of the stream */
+      if (slot->last)
+        p->remaining = 0;
+      p->have_slot = FALSE;
+      p->tail = (p->tail + 1) % p->num_slots;
+      sem_post(&p->empty);
+    }
+  }
+
+  return got;
+}
+
+static int pipeline_write(pipeline *p,unsigned char *buf,int num)
+/* copies num bytes into the write-behind ring */
+{
+  int put = 0,n;
+
+  if (p->failed)
+    return 0;
+
+  while (put < num) {
+    if (!p->have_slot && !pipeline_take_slot(p,TRUE))
+      break;
+    n = min(num - put,XFER_SIZE - p->pos);
+    memcpy(p->slots[p->head].buf + p->pos,buf + put,n);
+    put += n;
+    p->pos += n;
+    if (XFER_SIZE == p->pos)
+      pipeline_push(p,FALSE);
+  }
+
+  return put;
+}
+
+#endif
+
+#ifdef DIRECT_INPUT
+
+#define MAX_DIRECT_INPUTS 32
+
+/* an unbuffered decoder pipe.  stdio can then only hold bytes that were pushed back onto it
+ * by peek_n_bytes(), so 'held' counts those - some may since have been read again, but passing
+ * that many bytes through stdio before splicing anything is always enough.
+ */
+typedef struct _direct_input {
+  FILE *stream;
+  unsigned long held;
+} direct_input;
+
+static direct_input direct_inputs[MAX_DIRECT_INPUTS];
+
+static direct_input *direct_input_find(FILE *f)
+/* returns the entry for unbuffered decoder pipe f, if any */
+{
+  int i;
+
+  if (NULL == f)
+    return NULL;
+
+  for (i=0;i<MAX_DIRECT_INPUTS;i++)
+    if (f == direct_inputs[i].stream)
+      return &direct_inputs[i];
+
+  return NULL;
+}
+
+#endif
+
+bool direct_input_attach(FILE *f)
+/* turns off stdio buffering on decoder pipe f, so that the kernel transfer engine may read from it.
+ * must be called before anything is read from f.
+ */
+{
+#ifdef DIRECT_INPUT
+  int i;
+
+#ifdef PIPELINED_IO
+  /* pipelined decoder pipes are read by a thread instead */
+  if (pipeline_buffers() > 0)
+    return FALSE;
+#endif
+
+  if (FD_TYPE_PIPE != get_fd_type(f))
+    return FALSE;
+
+  for (i=0;i<MAX_DIRECT_INPUTS;i++)
+    if (NULL == direct_inputs[i].stream)
+      break;
+
+  /* with no room left, the pipe just stays buffered and is read through stdio */
+  if (i >= MAX_DIRECT_INPUTS || setvbuf(f,NULL,_IONBF,0))
+    return FALSE;
+
+  direct_inputs[i].stream = f;
+  direct_inputs[i].held = 0;
+
+  return TRUE;
+#else
+  return FALSE;
+#endif
+}
+
+void direct_input_detach(FILE *f)
+/* forgets about decoder pipe f, which is about to be closed */
+{
+#ifdef DIRECT_INPUT
+  direct_input *d;
+
+  if ((d = direct_input_find(f)))
+    d->stream = NULL;
+#endif
+}
+
+bool pipeline_read_ahead(FILE *f,wlong bytes)
+/* starts reading up to 'bytes' bytes of stream f ahead of time, if pipelining is enabled */
+{
+#ifdef PIPELINED_IO
+  return pipeline_attach(f,PIPELINE_READ,bytes,FALSE);
+#else
+  return FALSE;
+#endif
+}
+
+bool pipeline_write_behind(FILE *f)
+/* hands writes to stream f off to a writer thread, if pipelining is enabled */
+{
+#ifdef PIPELINED_IO
+  return pipeline_attach(f,PIPELINE_WRITE,0,FALSE);
+#else
+  return FALSE;
+#endif
+}
+
+bool pipeline_queue_behind(FILE *f)
+/* hands writes to stream f off to a writer thread that buffers them in the shared pool, replacing any plain writer */
+{
+#ifdef PIPELINED_IO
+  pipeline *p;
+
+  if ((p = pipeline_find(f)) && (PIPELINE_WRITE != p->direction || p->queued))
+    return (p->queued) ? TRUE : FALSE;
+
+  if (p && !pipeline_finish(f))
+    return FALSE;
+
+  return pipeline_attach(f,PIPELINE_WRITE,0,TRUE);
+#else
+  return FALSE;
+#endif
+}
+
+int pipeline_close_behind(FILE *f)
+/* lets the writer thread of queued stream f close it once the pending writes are done, without waiting for that.
+ * returns a handle for pipeline_join(), or -1 if f is not queued, in which case it must be closed as usual.
+ */
+{
+#ifdef PIPELINED_IO
+  pipeline *p;
+  int i;
+
+  if (NULL == (p = pipeline_find(f)) || !p->queued)
+    return -1;
+
+  for (i=0;i<MAX_PIPELINES;i++)
+    if (p == pipelines[i])
+      break;
+
+  if (!p->have_slot)
+    pipeline_take_slot(p,FALSE);
+
+  p->detached = TRUE;
+  pipeline_push(p,TRUE);
+
+  return i;
+#else
+  return -1;
+#endif
+}
+
+bool pipeline_join(int handle)
+/* waits for a stream handed to pipeline_close_behind() to be written out and closed - returns FALSE if that failed */
+{
+#ifdef PIPELINED_IO
+  if (handle < 0 || handle >= MAX_PIPELINES || NULL == pipelines[handle] || !pipelines[handle]->detached)
+    return TRUE;
+
+  return pipeline_stop(pipelines[handle]);
+#else
+  return TRUE;
+#endif
+}
+
+bool pipeline_finish(FILE *f)
+/* stops the pipeline attached to stream f, flushing any pending writes - returns FALSE if the worker failed */
+{
+#ifdef PIPELINED_IO
+  pipeline *p;
+
+  if (NULL == (p = pipeline_find(f)))
+    return TRUE;
+
+  if (PIPELINE_WRITE == p->direction) {
+    if (!p->have_slot)
+      pipeline_take_slot(p,FALSE);
+    pipeline_push(p,TRUE);
+  }
+  else {
+    p->stop = TRUE;
+    sem_post(&p->empty);
+  }
+
+  return pipeline_stop(p);
+#else
+  return TRUE;
+#endif
+}
+
 int read_n_bytes(FILE *in,unsigned char *buf,int num,progress_info *proginfo)
 /* reads the specified number of bytes from the file descriptor 'in' into buf */
 {
-  int read;
+  int read = 0;
+#ifdef PIPELINED_IO
+  pipeline *p;
+
+  if ((p = pipeline_find(in)) && PIPELINE_READ == p->direction) {
+    read = pipeline_read(p,buf,num);
+    /* once the read-ahead budget is used up, go back to reading the stream directly */
+    if (0 == p->remaining)
+      pipeline_finish(in);
+  }
+#endif
 
-  if ((read = fread(buf,1,num,in)) != num) {
+  if (read < num)
+    read += fread(buf+read,1,num-read,in);
+
+  if (read != num) {
     st_debug1("tried to read %d bytes, but only read %d -- possible truncated/corrupt file",num,read);
   }
 
@@ -38,12 +653,50 @@ int read_n_bytes(FILE *in,unsigned char *buf,int num,progress_info *proginfo)
   return read;
 }
 
+int peek_n_bytes(FILE *in,unsigned char *buf,int num)
+/* reads up to num bytes from 'in' into buf, then pushes them back so that the next read returns them again.
+ * returns the number of bytes peeked, or -1 if they could not all be pushed back, in which case the stream
+ * is no longer usable.  this relies on being able to push back more than one byte, which is fine as long as
+ * the bytes are still in the stream's buffer (i.e. nothing has been read from it yet), or the C library
+ * supports multiple pushback - glibc and the BSDs do both.
+ */
+{
+  int peeked,i;
+#ifdef DIRECT_INPUT
+  direct_input *d;
+#endif
+
+  peeked = (int)fread(buf,1,num,in);
+
+  for (i=peeked-1;i>=0;i--) {
+    if (EOF == ungetc(buf[i],in)) {
+      st_debug1("could not push back %d peeked bytes onto input stream",peeked);
+      return -1;
+    }
+  }
+
+#ifdef DIRECT_INPUT
+  if ((d = direct_input_find(in)))
+    d->held += (unsigned long)peeked;
+#endif
+
+  return peeked;
+}
+
 int write_n_bytes(FILE *out,unsigned char *buf,int num,progress_info *proginfo)
 /* writes the specified number of bytes from buf into the file descriptor 'out' */
 {
   int wrote;
+#ifdef PIPELINED_IO
+  pipeline *p;
 
-  if ((wrote = fwrite(buf,1,num,out)) != num) {
+  if ((p = pipeline_find(out)) && PIPELINE_WRITE == p->direction)
+    wrote = pipeline_write(p,buf,num);
+  else
+#endif
+  wrote = fwrite(buf,1,num,out);
+
+  if (wrote != num) {
     st_debug1("tried to write %d bytes, but only wrote %d -- make sure that:\n"
                "+ there is enough disk space\n"
                "+ the specified output directory exists\n"
@@ -59,8 +712,8 @@ int write_n_bytes(FILE *out,unsigned char *buf,int num,progress_info *proginfo)
   return wrote;
 }
 
-unsigned long transfer_n_bytes_internal(FILE *in,FILE *out1,FILE *out2,unsigned long bytes,progress_info *proginfo)
-/* transfers 'bytes' bytes from file descriptor 'in' to file descriptor 'out' */
+static unsigned long stdio_transfer(FILE *in,FILE *out1,FILE *out2,unsigned long bytes,progress_info *proginfo)
+/* transfers 'bytes' bytes from 'in' to 'out1' (and 'out2', if given) through a user-space buffer */
 {
   unsigned char buf[XFER_SIZE];
   int bytes_to_xfer,
@@ -84,6 +737,322 @@ unsigned long transfer_n_bytes_internal(FILE *in,FILE *out1,FILE *out2,unsigned
   return total_bytes_xfered;
 }
 
+#ifdef KERNEL_TRANSFER
+
+/* kernel transfer results */
+typedef enum {
+  KXFER_OK,
+  KXFER_EOF,
+  KXFER_UNSUPPORTED,
+  KXFER_FAILED
+} kxfer_results;
+
+static long stdio_input_pending(FILE *f)
+/* returns the number of bytes stdio has already read ahead from regular file f, or -1 if this can't be determined.
+ * the descriptor is that far past the stream's own position, which also accounts for bytes pushed back with ungetc().
+ */
+{
+  off_t fd_pos;
+  long pos;
+
+  if ((pos = ftell(f)) < 0 || (fd_pos = lseek(fileno(f),0,SEEK_CUR)) < 0 || fd_pos < (off_t)pos)
+    return -1;
+
+  return (long)(fd_pos - (off_t)pos);
+}
+
+static int kernel_result(ssize_t n)
+/* classifies the return value of a kernel transfer call */
+{
+  if (n > 0)
+    return KXFER_OK;
+
+  if (0 == n)
+    return KXFER_EOF;
+
+  /* the kernel can't handle this descriptor pair - let stdio deal with it */
+  if (EINVAL == errno || ENOSYS == errno || EXDEV == errno || EBADF == errno || EOPNOTSUPP == errno)
+    return KXFER_UNSUPPORTED;
+
+  return KXFER_FAILED;
+}
+
+static int kernel_move(int in,int in_type,int out,int out_type,size_t len,ssize_t *moved)
+/* moves up to len bytes from in to out without copying them through user space */
+{
+  ssize_t n = -1;
+
+  for (;;) {
+    errno = ENOSYS;
+
+    if (FD_TYPE_PIPE == in_type || FD_TYPE_PIPE == out_type) {
+#ifdef HAVE_SPLICE
+      n = splice(in,NULL,out,NULL,len,SPLICE_F_MOVE);
+#endif
+    }
+    else if (FD_TYPE_FILE == out_type) {
+#ifdef HAVE_COPY_FILE_RANGE
+      n = copy_file_range(in,NULL,out,NULL,len,0);
+#endif
+    }
+    else {
+#ifdef HAVE_SENDFILE
+      n = sendfile(out,in,NULL,len);
+#endif
+    }
+
+    if (n >= 0 || EINTR != errno)
+      break;
+  }
+
+  *moved = n;
+
+  return kernel_result(n);
+}
+
+#ifdef DIRECT_INPUT
+
+static int kernel_tee(int in,int out1,int out1_type,int out2,size_t len,ssize_t *moved)
+/* copies up to len bytes from pipe in to pipe out2, then moves the same bytes from in to out1 */
+{
+  ssize_t n,done,m;
+  int retval;
+
+  do {
+    n = tee(in,out2,len,0);
+  } while (n < 0 && EINTR == errno);
+
+  *moved = n;
+
+  if (KXFER_OK != (retval = kernel_result(n)))
+    return retval;
+
+  /* out2 already has these bytes, so there's no going back to stdio from here on */
+  for (done=0;done<n;done+=m) {
+    if (KXFER_OK != kernel_move(in,FD_TYPE_PIPE,out1,out1_type,(size_t)(n - done),&m)) {
+      *moved = done;
+      return KXFER_FAILED;
+    }
+  }
+
+  return KXFER_OK;
+}
+
+#endif
+
+static unsigned long kernel_transfer(FILE *in,FILE *out1,FILE *out2,unsigned long bytes,progress_info *proginfo,bool *finished)
+/* transfers as much of 'bytes' as the kernel can handle directly.  sets 'finished' when the
+ * transfer has ended for good (end of input or an error), so that stdio need not try again.
+ * regular files can be read this way, since for them we can tell how much stdio has already
+ * read ahead - bytes that must go out before anything the kernel moves - and so can decoder
+ * pipes that were made unbuffered by direct_input_attach().  a second output is only possible
+ * when reading such a pipe and one of the outputs is a pipe too, which then gets its copy via tee().
+ */
+{
+  int in_type,out1_type,out2_type,retval;
+  long pending;
+  ssize_t moved;
+  unsigned long total_bytes_to_xfer = bytes,
+                total_bytes_xfered = 0;
+#ifdef DIRECT_INPUT
+  direct_input *d = NULL;
+  FILE *tee_out = NULL,*move_out = out1;
+#endif
+
+  *finished = FALSE;
+
+  if (feof(in) || ferror(in))
+    return 0;
+
+  in_type = get_fd_type(in);
+  out1_type = get_fd_type(out1);
+  out2_type = (out2) ? get_fd_type(out2) : FD_TYPE_OTHER;
+
+  if (FD_TYPE_OTHER == out1_type)
+    return 0;
+
+  if (FD_TYPE_FILE == in_type) {
+    if (out2 || (pending = stdio_input_pending(in)) < 0)
+      return 0;
+  }
+#ifdef DIRECT_INPUT
+  else if (FD_TYPE_PIPE == in_type && (d = direct_input_find(in))) {
+    if (out2) {
+      if (FD_TYPE_PIPE == out2_type) {
+        tee_out = out2;
+      }
+      else if (FD_TYPE_PIPE == out1_type && FD_TYPE_FILE == out2_type) {
+        tee_out = out1;
+        move_out = out2;
+      }
+      else
+        return 0;
+    }
+    pending = (long)d->held;
+  }
+#endif
+  else
+    return 0;
+
+  /* first hand over whatever stdio might still hold */
+  if (pending > 0) {
+    total_bytes_xfered = stdio_transfer(in,out1,out2,min((unsigned long)pending,bytes),proginfo);
+    if (total_bytes_xfered != min((unsigned long)pending,bytes)) {
+      *finished = TRUE;
+      return total_bytes_xfered;
+    }
+    total_bytes_to_xfer -= total_bytes_xfered;
+#ifdef DIRECT_INPUT
+    if (d)
+      d->held -= total_bytes_xfered;
+#endif
+  }
+
+  if (0 == total_bytes_to_xfer)
+    return total_bytes_xfered;
+
+  /* output buffered by stdio must reach the descriptor before anything else does */
+  if (fflush(out1) || (out2 && fflush(out2)))
+    return total_bytes_xfered;
+
+  st_debug3("transferring %lu bytes using kernel transfer engine",total_bytes_to_xfer);
+
+  while (total_bytes_to_xfer > 0) {
+#ifdef DIRECT_INPUT
+    if (tee_out)
+      retval = kernel_tee(fileno(in),fileno(move_out),get_fd_type(move_out),fileno(tee_out),min(total_bytes_to_xfer,XFER_SIZE),&moved);
+    else
+#endif
+    retval = kernel_move(fileno(in),in_type,fileno(out1),out1_type,min(total_bytes_to_xfer,XFER_SIZE),&moved);
+
+    /* a failed tee() may still have moved some bytes to both outputs */
+    if (moved > 0) {
+      total_bytes_xfered += (unsigned long)moved;
+      total_bytes_to_xfer -= (unsigned long)moved;
+
+      if (proginfo) {
+        proginfo->bytes_written += moved;
+        prog_update(proginfo);
+      }
+    }
+
+    if (KXFER_OK != retval) {
+      if (KXFER_EOF == retval)
+        st_debug1("tried to transfer %lu bytes, but only transferred %lu -- possible truncated/corrupt file",bytes,total_bytes_xfered);
+      else if (KXFER_FAILED == retval)
+        st_debug1("kernel transfer failed after %lu bytes: [%s]",total_bytes_xfered,strerror(errno));
+      *finished = (KXFER_UNSUPPORTED != retval);
+      break;
+    }
+  }
+
+  /* the descriptor offsets moved behind stdio's back, so bring the streams back in sync */
+  if (FD_TYPE_FILE == in_type)
+    fseek(in,(long)lseek(fileno(in),0,SEEK_CUR),SEEK_SET);
+
+  if (FD_TYPE_FILE == out1_type)
+    fseek(out1,(long)lseek(fileno(out1),0,SEEK_CUR),SEEK_SET);
+
+  if (out2 && FD_TYPE_FILE == out2_type)
+    fseek(out2,(long)lseek(fileno(out2),0,SEEK_CUR),SEEK_SET);
+
+  return total_bytes_xfered;
+}
+
+#endif
+
+unsigned long transfer_n_bytes_internal(FILE *in,FILE *out1,FILE *out2,unsigned long bytes,progress_info *proginfo)
+/* transfers 'bytes' bytes from file descriptor 'in' to file descriptor 'out' */
+{
+  unsigned long total_bytes_xfered = 0;
+#ifdef KERNEL_TRANSFER
+  bool finished;
+#endif
+#ifdef PIPELINED_IO
+  bool read_ahead;
+
+  /* keep pipelined streams away from the kernel transfer engine - it would bypass the threads */
+  if (pipeline_find(out1) || pipeline_find(out2) || pipeline_find(in) || (pipeline_buffers() > 0 && FD_TYPE_PIPE == get_fd_type(in))) {
+    read_ahead = pipeline_read_ahead(in,(wlong)bytes);
+    total_bytes_xfered = stdio_transfer(in,out1,out2,bytes,proginfo);
+    if (read_ahead)
+      pipeline_finish(in);
+    return total_bytes_xfered;
+  }
+#endif
+#ifdef KERNEL_TRANSFER
+
+  total_bytes_xfered = kernel_transfer(in,out1,out2,bytes,proginfo,&finished);
+
+  if (finished || total_bytes_xfered == bytes)
+    return total_bytes_xfered;
+#endif
+
+  return total_bytes_xfered + stdio_transfer(in,out1,out2,bytes - total_bytes_xfered,proginfo);
+}
+
+unsigned long transfer_n_bytes_multi(FILE *in,FILE **out,int nout,unsigned long bytes,progress_info *proginfo)
+/* transfers 'bytes' bytes from file descriptor 'in' to each of the 'nout' file descriptors in 'out' */
+{
+  unsigned char buf[XFER_SIZE];
+  int i,bytes_to_xfer,actual_bytes_read;
+  unsigned long total_bytes_to_xfer = bytes,
+                total_bytes_xfered = 0;
+#ifdef PIPELINED_IO
+  bool read_ahead;
+#endif
+
+  /* one or two outputs are handled by transfer_n_bytes_internal(), which can use the kernel for both when reading a decoder pipe */
+  if (nout <= 2)
+    return transfer_n_bytes_internal(in,out[0],(2 == nout) ? out[1] : NULL,bytes,proginfo);
+
+#ifdef PIPELINED_IO
+  read_ahead = pipeline_read_ahead(in,(wlong)bytes);
+#endif
+
+  while (total_bytes_to_xfer > 0) {
+    bytes_to_xfer = min(total_bytes_to_xfer,XFER_SIZE);
+    actual_bytes_read = read_n_bytes(in,buf,bytes_to_xfer,NULL);
+    for (i=0;i<nout;i++) {
+      if (write_n_bytes(out[i],buf,actual_bytes_read,(0 == i) ? proginfo : NULL) != actual_bytes_read)
+        break;
+    }
+    if (i < nout)
+      break;
+    total_bytes_xfered += (unsigned long)actual_bytes_read;
+    if (actual_bytes_read != bytes_to_xfer)
+      break;
+    total_bytes_to_xfer -= bytes_to_xfer;
+  }
+
+#ifdef PIPELINED_IO
+  if (read_ahead)
+    pipeline_finish(in);
+#endif
+
+  return total_bytes_xfered;
+}
+
+FILE *open_memory_stream(unsigned char *buf,int len)
+/* returns a read-only stream over len bytes of buf, which must remain valid until the stream is closed */
+{
+#ifdef HAVE_FMEMOPEN
+  return fmemopen(buf,len,"rb");
+#else
+  FILE *f;
+
+  if (NULL == (f = tmpfile()))
+    return NULL;
+
+  if (write_n_bytes(f,buf,len,NULL) != len || fseek(f,0,SEEK_SET)) {
+    fclose(f);
+    return NULL;
+  }
+
+  return f;
+#endif
+}
+
 int write_padding(FILE *out,int bytes,progress_info *proginfo)
 /* writes the specified number of zero bytes to the file descriptor given */
 {
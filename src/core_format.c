@@ -16,12 +16,24 @@
  *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+/* close_range(), F_SETPIPE_SZ and posix_spawn_file_actions_addclosefrom_np() are
+ * GNU extensions -- keep the GNU version of basename() from colliding with our own
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#define basename gnu_basename
 #include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <errno.h>
+#undef basename
 #include "shntool.h"
+#ifdef HAVE_SPAWN_H
+#include <spawn.h>
+#endif
 
 CVSID("$Id: core_format.c,v 1.44 2009/03/11 17:18:01 jason Exp $")
 
@@ -32,6 +44,161 @@ CVSID("$Id: core_format.c,v 1.44 2009/03/11 17:18:01 jason Exp $")
 #define spawn_input_fd(a,b,c,d,e)  spawn(a,b,c,d,CHILD_INPUT,e)
 #define spawn_output_fd(a,b,c,d,e) spawn(a,b,c,d,CHILD_OUTPUT,e)
 
+/* launch helper programs with posix_spawn() when it can also close stray descriptors for us */
+#if !defined(WIN32) && defined(HAVE_SPAWN_H) && defined(HAVE_POSIX_SPAWNP) && defined(HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP)
+#define SPAWN_POSIX
+extern char **environ;
+#endif
+
+/* size of the buffer used to probe the head of a file during format detection */
+#define PROBE_BUF_SIZE 65536
+
+static FILE *probe_stream = NULL;
+static char *probe_filename = NULL;
+static long probe_offset = 0;
+static unsigned char probe_buf[PROBE_BUF_SIZE];
+
+#ifndef WIN32
+
+#define DEFAULT_PIPE_SIZE XFER_SIZE
+
+static long pipe_size = -1;
+
+static void set_pipe_size(int fd)
+/* raises the capacity of the pipe behind fd, so helper programs stall less often */
+{
+#ifdef F_SETPIPE_SZ
+  char *p;
+
+  if (pipe_size < 0) {
+    p = scan_env(SHNTOOL_PIPE_SIZE_ENV);
+    pipe_size = p ? atol(p) : DEFAULT_PIPE_SIZE;
+    if (pipe_size < 0)
+      pipe_size = 0;
+  }
+
+  if (0 == pipe_size)
+    return;
+
+  if (fcntl(fd,F_SETPIPE_SZ,(int)pipe_size) < 0)
+    st_debug2("could not set pipe capacity to %ld bytes: %s",pipe_size,strerror(errno));
+#endif
+}
+
+#ifdef SPAWN_POSIX
+
+static int spawn_posix(child_args *process_args,int *pipe1,int *pipe2,FILE *inputstream)
+/* launches the helper program without copying our address space, returning its pid or NO_CHILD_PID */
+{
+  posix_spawn_file_actions_t actions;
+  pid_t pid;
+  int err;
+
+  if ((err = posix_spawn_file_actions_init(&actions))) {
+    st_debug1("posix_spawn_file_actions_init: %s",strerror(err));
+    return NO_CHILD_PID;
+  }
+
+  /* read from parent on pipe1[0] (or the given input stream), write to parent on pipe2[1],
+   * send stderr to /dev/null, and close everything else
+   */
+  if ((err = posix_spawn_file_actions_adddup2(&actions,(inputstream) ? fileno(inputstream) : pipe1[0],0)) ||
+      (err = posix_spawn_file_actions_adddup2(&actions,pipe2[1],1)) ||
+      (err = posix_spawn_file_actions_addopen(&actions,2,NULLDEVICE,O_WRONLY,0)) ||
+      (err = posix_spawn_file_actions_addclosefrom_np(&actions,3)) ||
+      (err = posix_spawnp(&pid,process_args->args[0],&actions,NULL,process_args->args,environ))) {
+    st_debug1("posix_spawnp: %s",strerror(err));
+    posix_spawn_file_actions_destroy(&actions);
+    return NO_CHILD_PID;
+  }
+
+  posix_spawn_file_actions_destroy(&actions);
+
+  return (int)pid;
+}
+
+#else
+
+static void close_fds_from(int lowfd)
+/* closes all file descriptors numbered lowfd and above */
+{
+  int i,max_fds;
+
+#ifdef HAVE_CLOSE_RANGE
+  if (0 == close_range((unsigned int)lowfd,~0U,0))
+    return;
+#endif
+
+#ifdef HAVE_SYSCONF
+  max_fds = sysconf(_SC_OPEN_MAX);
+#else
+  max_fds = 1024;
+#endif
+
+  for (i=lowfd;i<max_fds;i++)
+    close(i);
+}
+
+static int spawn_fork(child_args *process_args,int *pipe1,int *pipe2,FILE *inputstream)
+/* forks off the helper program, returning its pid */
+{
+  int pid,nullfd;
+
+  switch ((pid = fork())) {
+    case -1:
+      /* fork failed */
+      perror("shntool: fork");
+      st_error("error while forking child process");
+      break;
+    case 0:
+      /* child */
+
+      close(pipe1[1]);
+      close(pipe2[0]);
+
+      /* Read from parent on pipe1[0], write to parent on pipe2[1]. */
+
+      if (inputstream) {
+        dup2(fileno(inputstream),0);
+        close(fileno(inputstream));
+      }
+      else {
+        dup2(pipe1[0],0);
+      }
+
+      dup2(pipe2[1],1);
+
+      close(pipe1[0]);
+      close(pipe2[1]);
+
+      /* make sure stderr is connected to /dev/null, or closed if that fails */
+      close(2);
+      nullfd = open(NULLDEVICE,O_WRONLY);
+      if (nullfd > 0 && 2 != nullfd)
+        dup2(nullfd,2);
+
+      SETBINARY_FD(0);
+      SETBINARY_FD(1);
+      SETBINARY_FD(2);
+
+      /* close all other file descriptors */
+      close_fds_from(3);
+
+      if (execvp(process_args->args[0],process_args->args) < 0) {
+        perror("shntool: execvp");
+        st_error("error while launching helper program: [%s]",process_args->args[0]);
+      }
+
+      break;
+  }
+
+  return pid;
+}
+
+#endif
+
+#endif
+
 static void get_quoted_arg_list(child_args *process_args,char *arg_list)
 {
   int i;
@@ -135,7 +302,6 @@ static void spawn(child_args *process_args,FILE **readpipe,FILE **writepipe,proc
   *writepipe = fdopen(_open_osfhandle((intptr_t)hInputWrite,0),"wb");
 #else
   int pipe1[2], pipe2[2];
-  int i,nullfd,max_fds;
 
   /* create pipes for two-way communication */
   if ((pipe(pipe1) < 0) || (pipe(pipe2) < 0)) {
@@ -143,75 +309,35 @@ static void spawn(child_args *process_args,FILE **readpipe,FILE **writepipe,proc
     st_error("error while creating pipes for two-way communication with child process");
   }
 
-  /* fork child process */
-  switch ((pinfo->pid = fork())) {
-    case -1:
-      /* fork failed */
-      perror("shntool: fork");
-      st_error("error while forking child process");
-      break;
-    case 0:
-      /* child */
-
-      close(pipe1[1]);
-      close(pipe2[0]);
-
-      /* Read from parent on pipe1[0], write to parent on pipe2[1]. */
-
-      if (inputstream) {
-        dup2(fileno(inputstream),0);
-        close(fileno(inputstream));
-      }
-      else {
-        dup2(pipe1[0],0);
-      }
-
-      dup2(pipe2[1],1);
+  set_pipe_size(pipe1[1]);
+  set_pipe_size(pipe2[0]);
 
-      close(pipe1[0]);
-      close(pipe2[1]);
-
-      /* make sure stderr is connected to /dev/null, or closed if that fails */
-      close(2);
-      nullfd = open(NULLDEVICE,O_WRONLY);
-      if (nullfd > 0 && 2 != nullfd)
-        dup2(nullfd,2);
-
-      SETBINARY_FD(0);
-      SETBINARY_FD(1);
-      SETBINARY_FD(2);
-
-#ifdef HAVE_SYSCONF
-      max_fds = sysconf(_SC_OPEN_MAX);
+#ifdef SPAWN_POSIX
+  if (NO_CHILD_PID == (pinfo->pid = spawn_posix(process_args,pipe1,pipe2,inputstream))) {
+    close(pipe1[0]);
+    close(pipe1[1]);
+    close(pipe2[0]);
+    close(pipe2[1]);
+    st_warning("error while launching helper program: [%s]",process_args->args[0]);
+    *readpipe = NULL;
+    *writepipe = NULL;
+    return;
+  }
 #else
-      max_fds = 1024;
+  pinfo->pid = spawn_fork(process_args,pipe1,pipe2,inputstream);
 #endif
 
-      /* close all other file descriptors */
-      for (i=3;i<max_fds;i++)
-        close(i);
-
-      if (execvp(process_args->args[0],process_args->args) < 0) {
-        perror("shntool: execvp");
-        st_error("error while launching helper program: [%s]",process_args->args[0]);
-      }
-
-      break;
-    default:
-      /* parent */
-      close(pipe1[0]);
-      close(pipe2[1]);
+  /* parent */
+  close(pipe1[0]);
+  close(pipe2[1]);
 
-      /* Write to child on pipe1[1], read from child on pipe2[0]. */
-      *readpipe = fdopen(pipe2[0],"rb");
-      *writepipe = fdopen(pipe1[1],"wb");
+  /* Write to child on pipe1[1], read from child on pipe2[0]. */
+  *readpipe = fdopen(pipe2[0],"rb");
+  *writepipe = fdopen(pipe1[1],"wb");
 
-      /* set characteristics of pipes */
-      SETBINARY_IN(*readpipe);
-      SETBINARY_OUT(*writepipe);
-
-      break;
-    }
+  /* set characteristics of pipes */
+  SETBINARY_IN(*readpipe);
+  SETBINARY_OUT(*writepipe);
 
   /* get quoted args */
   get_quoted_arg_list(process_args,quoted_args);
@@ -370,11 +496,66 @@ int tagcmp(unsigned char *got,unsigned char *expected)
   return 0;
 }
 
+bool probe_begin(char *filename)
+/* opens filename for format detection.  the head of the file is read into probe_buf once, and
+ * every probe_open() until probe_end() just rewinds the same stream, so that format modules
+ * can check magic numbers and parse headers without reopening or rereading the file.
+ */
+{
+  unsigned long tag_size;
+
+  probe_end();
+
+  if (NULL == (probe_stream = fopen(filename,"rb")))
+    return FALSE;
+
+  setvbuf(probe_stream,(char *)probe_buf,_IOFBF,PROBE_BUF_SIZE);
+
+  probe_offset = 0;
+
+  if ((tag_size = check_for_id3v2_tag(probe_stream)))
+    probe_offset = (long)(tag_size + sizeof(id3v2_header));
+
+  probe_filename = filename;
+
+  return TRUE;
+}
+
+void probe_end()
+/* closes the format detection stream, if any */
+{
+  if (probe_stream) {
+    fclose(probe_stream);
+    probe_stream = NULL;
+  }
+
+  probe_filename = NULL;
+}
+
+FILE *probe_open(char *filename)
+/* returns a stream positioned just past any ID3v2 tag in filename - shared among format checks while probing */
+{
+  if (probe_stream && probe_filename && !strcmp(filename,probe_filename)) {
+    clearerr(probe_stream);
+    if (0 == fseek(probe_stream,probe_offset,SEEK_SET))
+      return probe_stream;
+  }
+
+  return open_input(filename);
+}
+
+void probe_close(FILE *f)
+/* releases a stream obtained from probe_open() */
+{
+  if (f && f != probe_stream)
+    fclose(f);
+}
+
 bool check_for_magic(char *filename,char *magic,int offset)
 {
   FILE *file;
-  int magiclen, bytes, bytes_to_discard;
-  unsigned char buf[XFER_SIZE];
+  int magiclen;
+  unsigned char buf[BUF_SIZE];
 
   if (NULL == magic || !strcmp(magic,""))
     return FALSE;
@@ -382,30 +563,27 @@ bool check_for_magic(char *filename,char *magic,int offset)
   if (offset < 0)
     return FALSE;
 
-  if (NULL == (file = open_input(filename)))
-    return FALSE;
-
   magiclen = strlen(magic);
 
-  bytes_to_discard = offset;
+  if (magiclen > BUF_SIZE)
+    return FALSE;
+
+  if (NULL == (file = probe_open(filename)))
+    return FALSE;
 
   /* skip to magic header */
-  while (bytes_to_discard > 0) {
-    bytes = min(bytes_to_discard,XFER_SIZE);
-    if (bytes!= fread(buf,1,bytes,file)) {
-      fclose(file);
-      return FALSE;
-    }
-    bytes_to_discard -= bytes;
+  if (offset > 0 && fseek(file,(long)offset,SEEK_CUR)) {
+    probe_close(file);
+    return FALSE;
   }
 
   /* read magic header */
   if (magiclen != fread(buf,1,magiclen,file)) {
-    fclose(file);
+    probe_close(file);
     return FALSE;
   }
 
-  fclose(file);
+  probe_close(file);
 
   if (!tagcmp(buf,(unsigned char *)magic))
     return TRUE;
@@ -441,13 +619,11 @@ format_module *find_format(char *fmtname)
   return op;
 }
 
-FILE *launch_input(format_module *fm,char *filename,proc_info *pinfo)
+static FILE *launch_decoder(format_module *fm,child_args *template,char *filename,proc_info *pinfo)
 {
   FILE *input,*output,*f;
   bool file_has_id3v2_tag;
 
-  verify_format_input(fm);
-
   if (fm->stdin_for_id3v2_kluge) {
     /* check for ID3v2 tag on input */
     f = open_input_internal(filename,&file_has_id3v2_tag,NULL);
@@ -459,7 +635,7 @@ FILE *launch_input(format_module *fm,char *filename,proc_info *pinfo)
       file_has_id3v2_tag = FALSE;
     }
 
-    arg_build(&fm->input_args,&fm->input_args_template,(file_has_id3v2_tag)?fm->stdin_for_id3v2_kluge:filename);
+    arg_build(&fm->input_args,template,(file_has_id3v2_tag)?fm->stdin_for_id3v2_kluge:filename);
 
     if (file_has_id3v2_tag) {
       spawn_input_fd(&fm->input_args,&input,&output,pinfo,f);
@@ -470,7 +646,7 @@ FILE *launch_input(format_module *fm,char *filename,proc_info *pinfo)
     }
   }
   else {
-    arg_build(&fm->input_args,&fm->input_args_template,filename);
+    arg_build(&fm->input_args,template,filename);
 
     spawn_input(&fm->input_args,&input,&output,pinfo);
   }
@@ -478,9 +654,83 @@ FILE *launch_input(format_module *fm,char *filename,proc_info *pinfo)
   if (output)
     fclose(output);
 
+  if (input)
+    direct_input_attach(input);
+
   return input;
 }
 
+static char *range_arg(char *arg,char **out,char *end,wlong first,wlong last)
+/* copies arg to *out, replacing the sample placeholders in it, and returns the copy */
+{
+  char *result = *out,number[32];
+  wlong value;
+  int len;
+
+  while (*arg) {
+    if (!strncmp(arg,FIRST_SAMPLE_PLACEHOLDER,2))
+      value = first;
+    else if (!strncmp(arg,END_SAMPLE_PLACEHOLDER,2))
+      value = last;
+    else if (!strncmp(arg,NUM_SAMPLES_PLACEHOLDER,2))
+      value = last - first;
+    else {
+      if (*out + 1 >= end)
+        st_error("while building argument list: range decoder arguments are too long");
+      *(*out)++ = *arg++;
+      continue;
+    }
+
+    st_snprintf(number,sizeof(number),"%lu",value);
+
+    len = strlen(number);
+    if (*out + len + 1 >= end)
+      st_error("while building argument list: range decoder arguments are too long");
+
+    strcpy(*out,number);
+    *out += len;
+    arg += 2;
+  }
+
+  *(*out)++ = 0;
+
+  return result;
+}
+
+FILE *launch_input(format_module *fm,char *filename,proc_info *pinfo)
+{
+  verify_format_input(fm);
+
+  return launch_decoder(fm,&fm->input_args_template,filename,pinfo);
+}
+
+FILE *launch_input_range(format_module *fm,char *filename,proc_info *pinfo,wlong first,wlong last)
+{
+  static char argstr[BUF_SIZE],args[BUF_SIZE];
+  child_args template;
+  char *token,*out;
+
+  verify_format_input(fm);
+
+  if (NULL == fm->decoder_range_args)
+    st_error("format does not support decoding part of a file: [%s]",fm->name);
+
+  st_debug1("decoding samples %lu to %lu of file: [%s]",first,last,filename);
+
+  strncpy(argstr,fm->decoder_range_args,BUF_SIZE-1);
+  argstr[BUF_SIZE-1] = 0;
+
+  out = args;
+
+  arg_reset(&template);
+  arg_add(&template,fm->decoder);
+
+  for (token=strtok(argstr," \t");token;token=strtok(NULL," \t"))
+    arg_add(&template,range_arg(token,&out,args+BUF_SIZE,first,last));
+
+  return launch_decoder(fm,&template,filename,pinfo);
+}
+
 FILE *launch_output(format_module *fm,char *filename,proc_info *pinfo)
 {
   FILE *input,*output;
@@ -26,6 +26,8 @@
 #include <sys/wait.h>
 #endif
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
 #include "shntool.h"
 
 CVSID("$Id: core_mode.c,v 1.88 2009/03/30 05:55:33 jason Exp $")
@@ -110,6 +112,12 @@ static void parse_args(format_module *fm,char *argstr,bool is_output,int argsrc)
       else {
         /* input format: this is the program name */
         fm->decoder = token;
+
+        /* the built-in range arguments may not suit the user's decoder, so always decode whole files with it */
+        if (fm->decoder_range_args) {
+          st_debug1("not decoding parts of [%s] files with user-specified decoder: [%s]",fm->name,fm->decoder);
+          fm->decoder_range_args = NULL;
+        }
       }
 
       arg_replace(ca,0,token);
@@ -598,6 +606,8 @@ bool open_input_stream(wave_info *info)
 {
   unsigned long bytes_to_read,tag_size;
   unsigned char tmp[BUF_SIZE];
+  id3v2_header id3v2hdr;
+  int peeked;
 
   if (info->file_has_id3v2_tag) {
     if (info->input_format->decoder)
@@ -611,8 +621,16 @@ bool open_input_stream(wave_info *info)
     return FALSE;
   }
 
-  /* check for ID3v2 tag on input stream */
-  if ((tag_size = check_for_id3v2_tag(info->input))) {
+  /* check for ID3v2 tag on input stream, leaving the data in place so the decoder need not be restarted */
+  if ((peeked = peek_n_bytes(info->input,(unsigned char *)&id3v2hdr,sizeof(id3v2_header))) < 0) {
+    close_input_stream(info);
+
+    if (NULL == (info->input = open_input_stream_fmt(info->input_format,info->filename,&info->input_proc))) {
+      st_warning("could not reopen file for streaming input: [%s]",info->filename);
+      return FALSE;
+    }
+  }
+  else if (sizeof(id3v2_header) == peeked && (tag_size = id3v2_tag_size((unsigned char *)&id3v2hdr))) {
     if (!info->stream_has_id3v2_tag) {
       if (info->input_format->decoder)
         st_debug1("discarding ID3v2 tag detected in input stream generated by decoder [%s] from file: [%s]",info->input_format->decoder,info->filename);
@@ -627,6 +645,9 @@ bool open_input_stream(wave_info *info)
     st_debug1("discarding %lu-byte ID3v2 tag in input stream generated by decoder [%s] from file: [%s]",
       info->id3v2_tag_size,info->filename,info->input_format->decoder);
 
+    /* the peeked header is still in the stream, so skip it along with the tag */
+    tag_size += sizeof(id3v2_header);
+
     while (tag_size > 0) {
       bytes_to_read = min(tag_size,BUF_SIZE);
 
@@ -642,13 +663,94 @@ bool open_input_stream(wave_info *info)
       tag_size -= bytes_to_read;
     }
   }
-  else {
-    close_input_stream(info);
 
-    if (NULL == (info->input = open_input_stream_fmt(info->input_format,info->filename,&info->input_proc))) {
-      st_warning("could not reopen file for streaming input: [%s]",info->filename);
+  return TRUE;
+}
+
+static bool discard_input(wave_info *info,wlong bytes)
+/* reads and throws away the given number of bytes from the input stream */
+{
+  unsigned char tmp[BUF_SIZE];
+  wlong bytes_to_read;
+
+  while (bytes > 0) {
+    bytes_to_read = min(bytes,BUF_SIZE);
+
+    if (bytes_to_read != read_n_bytes(info->input,tmp,(int)bytes_to_read,NULL))
+      return FALSE;
+
+    bytes -= bytes_to_read;
+  }
+
+  return TRUE;
+}
+
+static bool discard_decoded_header(wave_info *info)
+/* skips the WAVE header a decoder writes ahead of the samples it was asked for */
+{
+  unsigned char tag[4];
+  unsigned long le_long;
+
+  if (!read_tag(info->input,tag) || tagcmp(tag,(unsigned char *)WAVE_RIFF) ||
+      !read_le_long(info->input,&le_long) ||
+      !read_tag(info->input,tag) || tagcmp(tag,(unsigned char *)WAVE_WAVE))
+    return FALSE;
+
+  for (;;) {
+    if (!read_tag(info->input,tag) || !read_le_long(info->input,&le_long))
+      return FALSE;
+
+    if (!tagcmp(tag,(unsigned char *)WAVE_DATA))
+      return TRUE;
+
+    if (!discard_input(info,le_long))
+      return FALSE;
+  }
+}
+
+bool open_input_stream_range(wave_info *info,wlong start,wlong end)
+/* opens an input stream positioned at byte offset start of the WAVE data.  data beyond end might not be
+ * available, since decoders that can decode part of a file are told to stop there.  when the format is read
+ * directly from disk, this seeks to the start; otherwise everything before it is decoded and thrown away.
+ */
+{
+  format_module *fm = info->input_format;
+  wlong first,last;
+
+  end = min(end,info->data_size);
+  start = min(start,end);
+
+  if (fm->decoder && fm->decoder_range_args && info->block_align > 0) {
+    first = start / info->block_align;
+    last = (end + info->block_align - 1) / info->block_align;
+
+    if (NULL == (info->input = launch_input_range(fm,info->filename,&info->input_proc,first,last))) {
+      st_warning("could not open file for streaming input: [%s]",info->filename);
+      return FALSE;
+    }
+
+    if (!discard_decoded_header(info)) {
+      st_warning("could not find the WAVE data in input stream generated by decoder [%s] from file: [%s]",fm->decoder,info->filename);
+      close_input_stream(info);
       return FALSE;
     }
+
+    start -= first * info->block_align;
+  }
+  else {
+    if (!open_input_stream(info))
+      return FALSE;
+
+    discard_header(info);
+
+    if (NULL == fm->decoder && start > 0 && 0 == fseek(info->input,(long)start,SEEK_CUR))
+      start = 0;
+  }
+
+  if (!discard_input(info,start)) {
+    st_warning("error while skipping %lu bytes of WAVE data from file: [%s]",start,info->filename);
+    close_input_stream(info);
+    return FALSE;
   }
 
   return TRUE;
@@ -826,7 +928,8 @@ void length_to_str(wave_info *info)
     st_snprintf(info->m_ss,16,"%lu:%02lu.%s",m,s,ffnnn);
 }
 
-int close_and_wait(FILE *fd,proc_info *pinfo,int child_type,format_module *fm)
+static int wait_for_child(proc_info *pinfo,int child_type,format_module *fm)
+/* waits for a child process whose stream has been closed, returning CLOSE_SUCCESS or the error it caused */
 {
   int retval;
 #ifdef WIN32
@@ -838,15 +941,6 @@ int close_and_wait(FILE *fd,proc_info *pinfo,int child_type,format_module *fm)
 
   retval = CLOSE_SUCCESS;
 
-  /* never close stdin/stdout/stderr */
-  if ((fd == stdin) || (fd == stdout) || (fd == stderr))
-    return retval;
-
-  if (fd) {
-    fclose(fd);
-    fd = NULL;
-  }
-
   if (NO_CHILD_PID == pinfo->pid)
     return retval;
 
@@ -952,6 +1046,120 @@ int close_and_wait(FILE *fd,proc_info *pinfo,int child_type,format_module *fm)
   return retval;
 }
 
+int close_and_wait(FILE *fd,proc_info *pinfo,int child_type,format_module *fm)
+{
+  int retval,status;
+
+  retval = CLOSE_SUCCESS;
+
+  /* stop any reader/writer thread first, so that pending output reaches the encoder */
+  if (!pipeline_finish(fd) && CHILD_OUTPUT == child_type) {
+    st_warning("could not write all data to child encoder process %d",pinfo->pid);
+    retval = CLOSE_CHILD_ERROR_OUTPUT;
+  }
+
+  /* never close stdin/stdout/stderr */
+  if ((fd == stdin) || (fd == stdout) || (fd == stderr))
+    return retval;
+
+  if (fd) {
+    direct_input_detach(fd);
+    fclose(fd);
+    fd = NULL;
+  }
+
+  if (CLOSE_SUCCESS != (status = wait_for_child(pinfo,child_type,fm)))
+    retval = status;
+
+  return retval;
+}
+
+/*
+ * modes that slice one decoded stream into several output files can let earlier
+ * encoders finish in the background while later files are being fed.  each queued
+ * output gets a writer thread buffering its data from a pool shared by all of them
+ * (see ST_ENCODER_BUFFER), so the stream can move on as soon as a file's data has
+ * been handed over, instead of waiting for a slow encoder to take it all and exit.
+ */
+
+#define MAX_ENCODERS 16
+
+typedef struct _pending_output {
+  int handle;
+  proc_info proc;
+} pending_output;
+
+static pending_output pending_outputs[MAX_ENCODERS];
+static int num_pending_outputs = 0;
+static int num_encoders = -1;
+
+int output_encoders()
+/* returns the number of encoders that may run at once, as requested by the user */
+{
+  char *p;
+  int n;
+
+  if (num_encoders < 0) {
+    p = scan_env(SHNTOOL_ENCODERS_ENV);
+    n = p ? atoi(p) : 1;
+    num_encoders = (n > 1) ? min(n,MAX_ENCODERS) : 1;
+  }
+
+  return num_encoders;
+}
+
+bool queue_output_stream(FILE *output,proc_info *pinfo)
+/* lets output be closed in the background later on, if several encoders may run at once */
+{
+  if (output_encoders() < 2 || NO_CHILD_PID == pinfo->pid)
+    return FALSE;
+
+  return pipeline_queue_behind(output);
+}
+
+int reap_outputs_behind(int keep)
+/* waits for the oldest outputs being closed in the background, until no more than keep are left */
+{
+  int retval,status,i;
+
+  retval = CLOSE_SUCCESS;
+
+  while (num_pending_outputs > max(keep,0)) {
+    if (!pipeline_join(pending_outputs[0].handle)) {
+      st_warning("could not write all data to child encoder process %d",pending_outputs[0].proc.pid);
+      retval = CLOSE_CHILD_ERROR_OUTPUT;
+    }
+
+    if (CLOSE_SUCCESS != (status = wait_for_child(&pending_outputs[0].proc,CHILD_OUTPUT,NULL)))
+      retval = status;
+
+    num_pending_outputs--;
+    for (i=0;i<num_pending_outputs;i++)
+      pending_outputs[i] = pending_outputs[i+1];
+  }
+
+  return retval;
+}
+
+int close_output_behind(FILE *output,proc_info *pinfo)
+/* closes an output stream, leaving its encoder to finish in the background if it was queued */
+{
+  int handle,retval;
+
+  retval = reap_outputs_behind(MAX_ENCODERS - 1);
+
+  if ((handle = pipeline_close_behind(output)) < 0)
+    return close_and_wait(output,pinfo,CHILD_OUTPUT,NULL);
+
+  st_debug2("leaving output process %d to finish in the background",pinfo->pid);
+
+  pending_outputs[num_pending_outputs].handle = handle;
+  pending_outputs[num_pending_outputs].proc = *pinfo;
+  num_pending_outputs++;
+
+  return retval;
+}
+
 char *st_progname()
 {
   return st_priv.fullprogname;
@@ -1154,7 +1362,7 @@ wlong smrt_parse(unsigned char *data,wave_info *info)
 int st_getopt(int argc,char **argv,char *mode_opts)
 {
   char ops[BUF_SIZE],*p,c[2],*global_opts;
-  int opt;
+  int opt,i;
   format_module *input_format = NULL;
 
   global_opts = (st_priv.mode->creates_files) ? GLOBAL_OPTS GLOBAL_OPTS_OUTPUT : GLOBAL_OPTS;
@@ -1193,6 +1401,17 @@ int st_getopt(int argc,char **argv,char *mode_opts)
     case 'H':
       st_priv.show_hmmss = TRUE;
       break;
+    case 'V':
+      st_priv.verify_metadata = TRUE;
+      break;
+    case 'j':
+      if (!st_priv.mode->runs_jobs)
+        st_help("this mode cannot process input files in parallel: [-j]");
+      if (NULL == optarg)
+        st_help("missing number of jobs");
+      if ((st_priv.jobs = atoi(optarg)) < 1)
+        st_help("number of jobs must be at least 1: [%s]",optarg);
+      break;
     case 'P':
       if (NULL == optarg)
         st_help("missing progress indicator type");
@@ -1285,6 +1504,13 @@ int st_getopt(int argc,char **argv,char *mode_opts)
         if (!st_ops.output_format->supports_output)
           st_help("format does not support output: [%s]",st_ops.output_format->name);
         parse_output_args_cmd(st_ops.output_format,optarg);
+        /* remember every distinct format, for modes that can write more than one */
+        for (i=0;i<st_ops.num_output_formats && st_ops.output_formats[i] != st_ops.output_format;i++);
+        if (i == st_ops.num_output_formats) {
+          if (MAX_OUTPUT_FORMATS == i)
+            st_help("too many output formats: [%s]",optarg);
+          st_ops.output_formats[st_ops.num_output_formats++] = st_ops.output_format;
+        }
         break;
       case 'z':
         if (NULL == optarg)
@@ -1311,31 +1537,47 @@ void discard_header(wave_info *info)
 }
 
 void create_output_filename(char *infile,char *inext,char *outfile)
+{
+  create_output_filename_fmt(st_ops.output_format,infile,inext,outfile);
+}
+
+void create_output_filename_fmt(format_module *fm,char *infile,char *inext,char *outfile)
 {
   strcpy(outfile,"");
 
-  if (st_ops.output_format) {
-    if (st_ops.output_format->create_output_filename) {
-      st_ops.output_format->create_output_filename(outfile);
+  if (fm) {
+    if (fm->create_output_filename) {
+      fm->create_output_filename(outfile);
       return;
     }
 
-    rename_by_extension(
-      (st_ops.output_format->encoder) ? &st_ops.output_format->output_args_template : NULL,
-      infile,outfile,inext,st_ops.output_format->extension);
+    rename_by_extension((fm->encoder) ? &fm->output_args_template : NULL,infile,outfile,inext,fm->extension);
   }
 }
 
 FILE *open_output_stream(char *outfile,proc_info *pinfo)
 {
+  return open_output_stream_fmt(st_ops.output_format,outfile,pinfo);
+}
+
+FILE *open_output_stream_fmt(format_module *fm,char *outfile,proc_info *pinfo)
+{
+  FILE *output;
+
   pinfo->pid = NO_CHILD_PID;
 
-  if (st_ops.output_format && st_ops.output_format->supports_output) {
+  if (fm && fm->supports_output) {
     /* if this format defines its own output function, run it */
-    if (st_ops.output_format->output_func)
-      return st_ops.output_format->output_func(outfile,pinfo);
+    if (fm->output_func)
+      output = fm->output_func(outfile,pinfo);
+    else
+      output = launch_output(fm,outfile,pinfo);
+
+    /* let a writer thread feed the encoder while we produce the next block */
+    if (output && NO_CHILD_PID != pinfo->pid)
+      pipeline_write_behind(output);
 
-    return launch_output(st_ops.output_format,outfile,pinfo);
+    return output;
   }
 
   return NULL;
@@ -1352,12 +1594,16 @@ void st_global_usage()
     st_info("  -O val  overwrite existing files?  val is: {[ask], always, never}\n");
   }
   st_info("  -P type progress indicator type.  type is: {[pct], dot, spin, face, none}\n");
+  st_info("  -V      verify native format metadata against the decoder's output, instead of trusting it\n");
   if (st_priv.mode->creates_files) {
     st_info("  -a str  prefix 'str' to base part of output filenames\n");
     st_info("  -d dir  specify output directory\n");
   }
   st_info("  -i fmt  specify input file format decoder and/or arguments.\n");
   st_info("          format is:  \"fmt decoder [arg1 ... argN (%s = filename)]\"\n",FILENAME_PLACEHOLDER);
+  if (st_priv.mode->runs_jobs) {
+    st_info("  -j num  process up to num input files at once\n");
+  }
   if (st_priv.mode->creates_files) {
     st_info("  -o fmt  specify output file format, extension, encoder and/or arguments.\n");
     st_info("          format is:  \"fmt [ext=abc] [encoder [arg1 ... argN (%s = filename)]]\"\n",FILENAME_PLACEHOLDER);
@@ -1733,3 +1979,255 @@ int input_get_file_count()
 {
   return st_input.filemax;
 }
+
+/* parallel job engine
+ *
+ * With -j N, each input file is handed to a forked copy of shntool, up to N at once, so
+ * that per-mode state needs no protection.  A job's stdout, stderr and any results it
+ * reports are written to temporary files, and replayed by the parent strictly in input
+ * order, so output looks exactly as if the files had been processed one at a time.
+ */
+
+#define JOB_EXIT_FAILED 2
+
+typedef struct _job {
+  char *filename;
+  bool running;
+  int status;
+#ifndef WIN32
+  pid_t pid;
+#endif
+  FILE *out,*err,*result;
+} job;
+
+static void (*job_merge)(void *,int) = NULL;
+static FILE *job_result = NULL;
+
+void job_report(void *data,int len)
+/* hands a result for the current file to the mode's merge function - from a job, this is deferred until the parent replays it */
+{
+  if (job_result) {
+    if (1 != fwrite(&len,sizeof(int),1,job_result) || len != fwrite(data,1,len,job_result))
+      st_error("could not save result of job");
+    return;
+  }
+
+  if (job_merge)
+    job_merge(data,len);
+}
+
+#ifndef WIN32
+
+static void replay_stream(FILE *from,FILE *to)
+/* copies everything a job wrote to one of its temporary files */
+{
+  char buf[XFER_SIZE];
+  int bytes;
+
+  rewind(from);
+
+  while ((bytes = fread(buf,1,XFER_SIZE,from)) > 0)
+    fwrite(buf,1,bytes,to);
+
+  fflush(to);
+}
+
+static void replay_results(FILE *f)
+/* passes each result a job reported to the mode's merge function */
+{
+  char *data;
+  int len;
+
+  rewind(f);
+
+  while (1 == fread(&len,sizeof(int),1,f)) {
+    if (NULL == (data = malloc(len)))
+      st_error("could not allocate memory for result of job");
+
+    if (len != fread(data,1,len,f))
+      st_error("could not read result of job");
+
+    if (job_merge)
+      job_merge(data,len);
+
+    st_free(data);
+  }
+}
+
+static void start_job(job *j,bool (*process_file)(char *),char *filename)
+/* forks a copy of shntool to process the given file */
+{
+  int fd;
+  bool success;
+
+  if (NULL == (j->filename = strdup(filename)))
+    st_error("could not allocate memory for job filename");
+
+  if (NULL == (j->out = tmpfile()) || NULL == (j->err = tmpfile()) || NULL == (j->result = tmpfile()))
+    st_error("could not create temporary files for job output");
+
+  fflush(stdout);
+  fflush(stderr);
+
+  if (-1 == (j->pid = fork()))
+    st_error("could not start job for file: [%s]",filename);
+
+  if (0 == j->pid) {
+    dup2(fileno(j->out),STDOUT_FILENO);
+    dup2(fileno(j->err),STDERR_FILENO);
+
+    /* only the parent reads input filenames */
+    if (-1 != (fd = open(NULLDEVICE,O_RDONLY))) {
+      dup2(fd,STDIN_FILENO);
+      close(fd);
+    }
+
+    /* intermediate progress would only be seen after the fact */
+    st_priv.progress_type = PROGRESS_NONE;
+    st_priv.screen_dirty = FALSE;
+
+    job_result = j->result;
+
+    success = process_file(j->filename);
+
+    fflush(stdout);
+    fflush(stderr);
+    fflush(job_result);
+
+    exit(success ? ST_EXIT_SUCCESS : JOB_EXIT_FAILED);
+  }
+
+  st_debug1("started job [%d] for file: [%s]",(int)j->pid,filename);
+
+  j->running = TRUE;
+}
+
+static int finish_job(job *j)
+/* replays a finished job's output, and returns its exit status */
+{
+  int code;
+
+  replay_stream(j->out,stdout);
+  replay_stream(j->err,stderr);
+  replay_results(j->result);
+
+  fclose(j->out);
+  fclose(j->err);
+  fclose(j->result);
+
+  if (WIFEXITED(j->status))
+    code = WEXITSTATUS(j->status);
+  else {
+    st_warning("job for file [%s] was terminated by signal %d",j->filename,WIFSIGNALED(j->status) ? WTERMSIG(j->status) : 0);
+    code = JOB_EXIT_FAILED;
+  }
+
+  st_free(j->filename);
+
+  return code;
+}
+
+#endif
+
+bool process_input_files(bool (*process_file)(char *),void (*merge)(void *,int))
+/* runs process_file on each remaining input file, up to st_priv.jobs at a time.
+ * any results reported with job_report() reach merge in input order.
+ */
+{
+  char *filename;
+  bool success = TRUE;
+#ifndef WIN32
+  job *jobs;
+  int slots,head = 0,tail = 0,running = 0,status,code,fatal = ST_EXIT_SUCCESS,i;
+  bool more = TRUE;
+  pid_t pid;
+#endif
+
+  job_merge = merge;
+
+#ifndef WIN32
+  if (st_priv.jobs > 1) {
+    if (st_priv.mode->creates_files && CLOBBER_ACTION_ASK == st_priv.clobber_action) {
+      st_warning("cannot ask about overwriting files while running jobs in parallel - existing files will be kept");
+      st_priv.clobber_action = CLOBBER_ACTION_NEVER;
+    }
+
+    /* let finished jobs queue up behind a slow one, but not without limit */
+    slots = st_priv.jobs * 2;
+
+    if (NULL == (jobs = calloc(slots,sizeof(job))))
+      st_error("could not allocate memory for jobs");
+
+    for (;;) {
+      while (ST_EXIT_SUCCESS == fatal && more && running < st_priv.jobs && tail - head < slots) {
+        if (NULL == (filename = input_get_filename())) {
+          more = FALSE;
+          break;
+        }
+        start_job(&jobs[tail % slots],process_file,filename);
+        tail++;
+        running++;
+      }
+
+      while (head < tail && !jobs[head % slots].running) {
+        code = finish_job(&jobs[head % slots]);
+        if (JOB_EXIT_FAILED == code)
+          success = FALSE;
+        else if (ST_EXIT_SUCCESS != code && ST_EXIT_SUCCESS == fatal)
+          fatal = code;
+        head++;
+      }
+
+      if (head == tail && (ST_EXIT_SUCCESS != fatal || !more))
+        break;
+
+      if (-1 == (pid = wait(&status))) {
+        if (EINTR == errno)
+          continue;
+        st_error("error while waiting for jobs: %s",strerror(errno));
+      }
+
+      for (i=0;i<slots;i++) {
+        if (jobs[i].running && pid == jobs[i].pid) {
+          jobs[i].running = FALSE;
+          jobs[i].status = status;
+          running--;
+          break;
+        }
+      }
+    }
+
+    st_free(jobs);
+
+    /* a job hit a fatal error, which would have ended a serial run */
+    if (ST_EXIT_SUCCESS != fatal)
+      exit(fatal);
+
+    return success;
+  }
+#endif
+
+  while ((filename = input_get_filename()))
+    success = (process_file(filename) && success);
+
+  return success;
+}
+
+int job_count()
+/* returns how many files process_input_files() works on at once */
+{
+  return st_priv.jobs;
+}
+
+int job_threads()
+/* returns how many threads each job may keep busy, sharing the online processors among all jobs */
+{
+  long cpus = 1;
+
+#if defined(HAVE_SYSCONF) && defined(_SC_NPROCESSORS_ONLN)
+  if ((cpus = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+    cpus = 1;
+#endif
+
+  return (int)max(1,cpus / st_priv.jobs);
+}
@@ -23,29 +23,33 @@ CVSID("$Id: core_module.c,v 1.148 2009/03/11 17:18:01 jason Exp $")
 
 /* public functions */
 
-unsigned long check_for_id3v2_tag(FILE *f)
+unsigned long id3v2_tag_size(unsigned char *buf)
 {
-  id3v2_header id3v2hdr;
-  unsigned long tag_size;
-
-  /* read an ID3v2 header's size worth of data */
-  if (sizeof(id3v2_header) != fread(&id3v2hdr,1,sizeof(id3v2_header),f)) {
-    return 0;
-  }
+  id3v2_header *id3v2hdr = (id3v2_header *)buf;
 
   /* verify this is an ID3v2 header */
-  if (tagcmp((unsigned char *)id3v2hdr.magic,(unsigned char *)ID3V2_MAGIC) ||
-      0xff == id3v2hdr.version[0] || 0xff == id3v2hdr.version[1] ||
-      0x80 <= id3v2hdr.size[0] || 0x80 <= id3v2hdr.size[1] ||
-      0x80 <= id3v2hdr.size[2] || 0x80 <= id3v2hdr.size[3])
+  if (tagcmp((unsigned char *)id3v2hdr->magic,(unsigned char *)ID3V2_MAGIC) ||
+      0xff == id3v2hdr->version[0] || 0xff == id3v2hdr->version[1] ||
+      0x80 <= id3v2hdr->size[0] || 0x80 <= id3v2hdr->size[1] ||
+      0x80 <= id3v2hdr->size[2] || 0x80 <= id3v2hdr->size[3])
   {
     return 0;
   }
 
   /* calculate and return ID3v2 tag size */
-  tag_size = synchsafe_int_to_ulong(id3v2hdr.size);
+  return synchsafe_int_to_ulong(id3v2hdr->size);
+}
+
+unsigned long check_for_id3v2_tag(FILE *f)
+{
+  id3v2_header id3v2hdr;
+
+  /* read an ID3v2 header's size worth of data */
+  if (sizeof(id3v2_header) != fread(&id3v2hdr,1,sizeof(id3v2_header),f)) {
+    return 0;
+  }
 
-  return tag_size;
+  return id3v2_tag_size((unsigned char *)&id3v2hdr);
 }
 
 FILE *open_input_internal(char *filename,bool *file_has_id3v2_tag,wlong *id3v2_tag_size)
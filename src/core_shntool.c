@@ -323,6 +323,7 @@ static void globals_init(char *program)
   st_ops.output_prefix = "";
   st_ops.output_postfix = "";
   st_ops.output_format = NULL;
+  st_ops.num_output_formats = 0;
 
   /* private globals */
   st_priv.progname = ((p = strrchr(program,PATHSEPCHAR))) ? (p + 1) : program;
@@ -333,8 +334,10 @@ static void globals_init(char *program)
   st_priv.clobber_action = CLOBBER_ACTION_ASK;
   st_priv.reorder_type = ORDER_NATURAL;
   st_priv.progress_type = PROGRESS_PERCENT;
+  st_priv.jobs = 1;
   st_priv.is_aliased = FALSE;
   st_priv.show_hmmss = FALSE;
+  st_priv.verify_metadata = FALSE;
   st_priv.suppress_warnings = FALSE;
   st_priv.suppress_stderr = FALSE;
   st_priv.screen_dirty = FALSE;
@@ -0,0 +1,649 @@
+/*  core_vector.c - vectorised buffer scanning functions
+ *  Copyright (C) 2000-2009  Jason Jordan <shnutils@freeshell.org>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <string.h>
+#include "shntool.h"
+#if defined(HAVE_IMMINTRIN_H) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define VECTOR_X86
+#endif
+
+CVSID("$Id$")
+
+/*
+ * each function has a portable version, plus SSE2 and AVX2 versions on x86 compilers that
+ * can build code for instruction sets beyond the ones they were told to target.  the best
+ * version the CPU supports is picked the first time any of them is called.  the vector
+ * versions compare 16 or 32 bytes at a time, turning the result into a bit mask with one
+ * bit per differing (or non-zero) byte, and leave whatever is left over to the portable versions.
+ */
+
+typedef struct _vector_ops {
+  char *name;
+  int (*first_mismatch)(unsigned char *,unsigned char *,int);
+  int (*count_mismatches)(unsigned char *,unsigned char *,int,int,int *);
+  int (*list_mismatches)(unsigned char *,unsigned char *,int,int *,int);
+  int (*first_nonzero)(unsigned char *,int);
+  int (*last_nonzero)(unsigned char *,int);
+  int (*first_loud16)(unsigned char *,int,int);
+  int (*first_quiet16)(unsigned char *,int,int);
+  int hash_lanes;
+  void (*md5_lanes)(unsigned int *,const unsigned char **,int);
+  void (*sha1_lanes)(unsigned int *,const unsigned char **,int);
+} vector_ops;
+
+static int first_mismatch_scalar(unsigned char *buf1,unsigned char *buf2,int len)
+{
+  int i;
+
+  for (i=0;i<len;i++)
+    if (buf1[i] != buf2[i])
+      return i;
+
+  return -1;
+}
+
+static int count_mismatches_scalar(unsigned char *buf1,unsigned char *buf2,int len,int limit,int *first)
+{
+  int i,count = 0;
+
+  *first = -1;
+
+  for (i=0;i<len;i++) {
+    if (buf1[i] != buf2[i]) {
+      if (*first < 0)
+        *first = i;
+      if (++count > limit)
+        break;
+    }
+  }
+
+  return count;
+}
+
+static int list_mismatches_scalar(unsigned char *buf1,unsigned char *buf2,int len,int *offsets,int max)
+{
+  int i,n = 0;
+
+  for (i=0;i<len && n<max;i++)
+    if (buf1[i] != buf2[i])
+      offsets[n++] = i;
+
+  return n;
+}
+
+static int first_nonzero_scalar(unsigned char *buf,int len)
+{
+  int i;
+
+  for (i=0;i<len;i++)
+    if (buf[i])
+      return i;
+
+  return -1;
+}
+
+static int last_nonzero_scalar(unsigned char *buf,int len)
+{
+  int i;
+
+  for (i=len-1;i>=0;i--)
+    if (buf[i])
+      return i;
+
+  return -1;
+}
+
+static int first_level16_scalar(unsigned char *buf,int len,int level,int loud)
+{
+  int i,v;
+
+  for (i=0;i+1<len;i+=2) {
+    v = (int)(short)(buf[i] | (buf[i+1] << 8));
+    if ((v > level || v < -level) == loud)
+      return i;
+  }
+
+  return -1;
+}
+
+static int first_loud16_scalar(unsigned char *buf,int len,int level)
+{
+  return first_level16_scalar(buf,len,level,1);
+}
+
+static int first_quiet16_scalar(unsigned char *buf,int len,int level)
+{
+  return first_level16_scalar(buf,len,level,0);
+}
+
+#ifdef VECTOR_X86
+
+/* defines the three functions for one instruction set, given its name, the number of
+ * bytes it compares at once, and an expression giving the mismatch mask at offset i
+ */
+#define VECTOR_FUNCS(isa,isa_name,width,mask_expr)                                                  \
+                                                                                                    \
+__attribute__((target(isa_name)))                                                                   \
+static int first_mismatch_##isa(unsigned char *buf1,unsigned char *buf2,int len)                   \
+{                                                                                                   \
+  unsigned int mask;                                                                                \
+  int i,tail;                                                                                       \
+                                                                                                    \
+  for (i=0;i+width<=len;i+=width)                                                                   \
+    if ((mask = (mask_expr)))                                                                       \
+      return i + __builtin_ctz(mask);                                                               \
+                                                                                                    \
+  tail = first_mismatch_scalar(buf1+i,buf2+i,len-i);                                                \
+                                                                                                    \
+  return (tail < 0) ? -1 : i + tail;                                                                \
+}                                                                                                   \
+                                                                                                    \
+__attribute__((target(isa_name)))                                                                   \
+static int count_mismatches_##isa(unsigned char *buf1,unsigned char *buf2,int len,int limit,int *first) \
+{                                                                                                   \
+  unsigned int mask;                                                                                \
+  int i,count = 0,tail,tail_first;                                                                  \
+                                                                                                    \
+  *first = -1;                                                                                      \
+                                                                                                    \
+  for (i=0;i+width<=len;i+=width) {                                                                 \
+    if ((mask = (mask_expr))) {                                                                     \
+      if (*first < 0)                                                                               \
+        *first = i + __builtin_ctz(mask);                                                           \
+      if ((count += __builtin_popcount(mask)) > limit)                                              \
+        return count;                                                                               \
+    }                                                                                               \
+  }                                                                                                 \
+                                                                                                    \
+  tail = count_mismatches_scalar(buf1+i,buf2+i,len-i,limit-count,&tail_first);                      \
+  if (*first < 0 && tail_first >= 0)                                                                \
+    *first = i + tail_first;                                                                        \
+                                                                                                    \
+  return count + tail;                                                                              \
+}                                                                                                   \
+                                                                                                    \
+__attribute__((target(isa_name)))                                                                   \
+static int list_mismatches_##isa(unsigned char *buf1,unsigned char *buf2,int len,int *offsets,int max) \
+{                                                                                                   \
+  unsigned int mask;                                                                                \
+  int i,n = 0;                                                                                      \
+                                                                                                    \
+  for (i=0;i+width<=len && n<max;i+=width) {                                                        \
+    for (mask=(mask_expr);mask && n<max;mask&=mask-1)                                               \
+      offsets[n++] = i + __builtin_ctz(mask);                                                       \
+  }                                                                                                 \
+                                                                                                    \
+  if (n < max && i < len) {                                                                         \
+    max = n + list_mismatches_scalar(buf1+i,buf2+i,len-i,offsets+n,max-n);                          \
+    for (;n<max;n++)                                                                                \
+      offsets[n] += i;                                                                              \
+  }                                                                                                 \
+                                                                                                    \
+  return n;                                                                                         \
+}
+
+/* defines the functions that look for non-zero bytes for one instruction set, given its name,
+ * the number of bytes it tests at once, and an expression giving the non-zero mask at offset i
+ */
+#define VECTOR_ZERO_FUNCS(isa,isa_name,width,mask_expr)                                             \
+                                                                                                    \
+__attribute__((target(isa_name)))                                                                   \
+static int first_nonzero_##isa(unsigned char *buf,int len)                                         \
+{                                                                                                   \
+  unsigned int mask;                                                                                \
+  int i,tail;                                                                                       \
+                                                                                                    \
+  for (i=0;i+width<=len;i+=width)                                                                   \
+    if ((mask = (mask_expr)))                                                                       \
+      return i + __builtin_ctz(mask);                                                               \
+                                                                                                    \
+  tail = first_nonzero_scalar(buf+i,len-i);                                                         \
+                                                                                                    \
+  return (tail < 0) ? -1 : i + tail;                                                                \
+}                                                                                                   \
+                                                                                                    \
+__attribute__((target(isa_name)))                                                                   \
+static int last_nonzero_##isa(unsigned char *buf,int len)                                          \
+{                                                                                                   \
+  unsigned int mask;                                                                                \
+  int i;                                                                                            \
+                                                                                                    \
+  for (i=len-width;i>=0;i-=width)                                                                   \
+    if ((mask = (mask_expr)))                                                                       \
+      return i + 31 - __builtin_clz(mask);                                                          \
+                                                                                                    \
+  return last_nonzero_scalar(buf,i+width);                                                          \
+}
+
+/* defines the functions that look for 16-bit little-endian samples above or within a level for one
+ * instruction set, given its name, the number of bytes it tests at once, a mask with one bit per byte
+ * tested, and an expression giving a mask with both bits set for each sample above the level at offset i
+ */
+#define VECTOR_LEVEL_FUNCS(isa,isa_name,width,full_mask,mask_expr)                                 \
+                                                                                                    \
+__attribute__((target(isa_name)))                                                                   \
+static int first_loud16_##isa(unsigned char *buf,int len,int level)                                \
+{                                                                                                   \
+  unsigned int mask;                                                                                \
+  int i,tail;                                                                                       \
+                                                                                                    \
+  for (i=0;i+width<=len;i+=width)                                                                   \
+    if ((mask = (mask_expr)))                                                                       \
+      return i + __builtin_ctz(mask);                                                               \
+                                                                                                    \
+  tail = first_loud16_scalar(buf+i,len-i,level);                                                    \
+                                                                                                    \
+  return (tail < 0) ? -1 : i + tail;                                                                \
+}                                                                                                   \
+                                                                                                    \
+__attribute__((target(isa_name)))                                                                   \
+static int first_quiet16_##isa(unsigned char *buf,int len,int level)                               \
+{                                                                                                   \
+  unsigned int mask;                                                                                \
+  int i,tail;                                                                                       \
+                                                                                                    \
+  for (i=0;i+width<=len;i+=width)                                                                   \
+    if ((mask = (full_mask) & ~(mask_expr)))                                                        \
+      return i + __builtin_ctz(mask);                                                               \
+                                                                                                    \
+  tail = first_quiet16_scalar(buf+i,len-i,level);                                                   \
+                                                                                                    \
+  return (tail < 0) ? -1 : i + tail;                                                                \
+}
+
+VECTOR_FUNCS(sse2,"sse2",16,
+             0xffffU & ~(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((__m128i *)(buf1+i)),
+                                                                         _mm_loadu_si128((__m128i *)(buf2+i)))))
+
+VECTOR_FUNCS(avx2,"avx2",32,
+             ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i *)(buf1+i)),
+                                                                     _mm256_loadu_si256((__m256i *)(buf2+i)))))
+
+VECTOR_ZERO_FUNCS(sse2,"sse2",16,
+                  0xffffU & ~(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((__m128i *)(buf+i)),_mm_setzero_si128())))
+
+VECTOR_ZERO_FUNCS(avx2,"avx2",32,
+                  ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i *)(buf+i)),_mm256_setzero_si256())))
+
+VECTOR_LEVEL_FUNCS(sse2,"sse2",16,0xffffU,
+                   (unsigned int)_mm_movemask_epi8(_mm_or_si128(_mm_cmpgt_epi16(_mm_loadu_si128((__m128i *)(buf+i)),_mm_set1_epi16((short)level)),
+                                                                _mm_cmplt_epi16(_mm_loadu_si128((__m128i *)(buf+i)),_mm_set1_epi16((short)-level)))))
+
+VECTOR_LEVEL_FUNCS(avx2,"avx2",32,0xffffffffU,
+                   (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpgt_epi16(_mm256_loadu_si256((__m256i *)(buf+i)),_mm256_set1_epi16((short)level)),
+                                                                      _mm256_cmpgt_epi16(_mm256_set1_epi16((short)-level),_mm256_loadu_si256((__m256i *)(buf+i))))))
+
+#endif
+
+
+/*
+ * multi-buffer MD5 and SHA1: each lane of a vector register holds the state of a different
+ * stream, so one pass through the rounds hashes a block from every stream at once.  the
+ * functions below are written once in terms of the per-lane operations, which are defined
+ * for each instruction set (and for plain 32-bit integers, as a single lane).
+ */
+
+static const unsigned int md5_k[64] = {
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+  0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+  0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+  0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+  0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+  0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const int md5_r[64] = {
+  7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+  5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+  4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+  6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+/* little- and big-endian 32-bit words, as MD5 and SHA1 read them */
+#define LE32(p) ((unsigned int)(p)[0] | ((unsigned int)(p)[1] << 8) | ((unsigned int)(p)[2] << 16) | ((unsigned int)(p)[3] << 24))
+#define BE32(p) ((unsigned int)(p)[3] | ((unsigned int)(p)[2] << 8) | ((unsigned int)(p)[1] << 16) | ((unsigned int)(p)[0] << 24))
+
+/* the MD5 step, with f already computed */
+#define MD5_STEP(isa,j,g)                                                                           \
+  f = VADD_##isa(VADD_##isa(f,a),VADD_##isa(VSET1_##isa(md5_k[j]),VLOAD_##isa(w[g])));              \
+  a = d; d = c; c = b;                                                                              \
+  b = VADD_##isa(b,VROL_##isa(f,md5_r[j]));
+
+/* the SHA1 step, with f already computed */
+#define SHA1_STEP(isa,j,k)                                                                          \
+  if (j >= 16)                                                                                      \
+    x[j&15] = VROL_##isa(VXOR_##isa(VXOR_##isa(x[(j-3)&15],x[(j-8)&15]),VXOR_##isa(x[(j-14)&15],x[j&15])),1); \
+  f = VADD_##isa(VADD_##isa(VROL_##isa(a,5),f),VADD_##isa(VADD_##isa(e,VSET1_##isa(k)),x[j&15]));  \
+  e = d; d = c; c = VROL_##isa(b,30); b = a; a = f;
+
+/* defines the MD5 and SHA1 functions for one instruction set, given its name, its vector type and
+ * its number of lanes.  each function hashes the same number of blocks from exactly that many streams.
+ */
+#define HASH_LANE_FUNCS(isa,vtype,lanes)                                                            \
+                                                                                                    \
+LANE_TARGET_##isa                                                                                   \
+static void md5_lanes_##isa(unsigned int *state,const unsigned char **data,int blocks)             \
+{                                                                                                   \
+  unsigned int w[16][lanes],v[4][lanes];                                                            \
+  vtype a,b,c,d,aa,bb,cc,dd,f;                                                                      \
+  int i,j,k;                                                                                        \
+                                                                                                    \
+  for (k=0;k<lanes;k++)                                                                             \
+    for (j=0;j<4;j++)                                                                               \
+      v[j][k] = state[4*k+j];                                                                       \
+                                                                                                    \
+  a = VLOAD_##isa(v[0]); b = VLOAD_##isa(v[1]); c = VLOAD_##isa(v[2]); d = VLOAD_##isa(v[3]);       \
+                                                                                                    \
+  for (i=0;i<blocks;i++) {                                                                          \
+    for (k=0;k<lanes;k++)                                                                           \
+      for (j=0;j<16;j++)                                                                            \
+        w[j][k] = LE32(data[k] + 64*i + 4*j);                                                       \
+                                                                                                    \
+    aa = a; bb = b; cc = c; dd = d;                                                                 \
+                                                                                                    \
+    for (j=0;j<16;j++) {                                                                            \
+      f = VOR_##isa(VAND_##isa(b,c),VANDNOT_##isa(b,d));                                            \
+      MD5_STEP(isa,j,j)                                                                             \
+    }                                                                                               \
+    for (j=16;j<32;j++) {                                                                           \
+      f = VOR_##isa(VAND_##isa(d,b),VANDNOT_##isa(d,c));                                            \
+      MD5_STEP(isa,j,(5*j+1)&15)                                                                    \
+    }                                                                                               \
+    for (j=32;j<48;j++) {                                                                           \
+      f = VXOR_##isa(VXOR_##isa(b,c),d);                                                            \
+      MD5_STEP(isa,j,(3*j+5)&15)                                                                    \
+    }                                                                                               \
+    for (j=48;j<64;j++) {                                                                           \
+      f = VXOR_##isa(c,VOR_##isa(b,VANDNOT_##isa(d,VSET1_##isa(0xffffffff))));                      \
+      MD5_STEP(isa,j,(7*j)&15)                                                                      \
+    }                                                                                               \
+                                                                                                    \
+    a = VADD_##isa(a,aa); b = VADD_##isa(b,bb); c = VADD_##isa(c,cc); d = VADD_##isa(d,dd);         \
+  }                                                                                                 \
+                                                                                                    \
+  VSTORE_##isa(v[0],a); VSTORE_##isa(v[1],b); VSTORE_##isa(v[2],c); VSTORE_##isa(v[3],d);           \
+                                                                                                    \
+  for (k=0;k<lanes;k++)                                                                             \
+    for (j=0;j<4;j++)                                                                               \
+      state[4*k+j] = v[j][k];                                                                       \
+}                                                                                                   \
+                                                                                                    \
+LANE_TARGET_##isa                                                                                   \
+static void sha1_lanes_##isa(unsigned int *state,const unsigned char **data,int blocks)            \
+{                                                                                                   \
+  unsigned int w[16][lanes],v[5][lanes];                                                            \
+  vtype a,b,c,d,e,aa,bb,cc,dd,ee,f,x[16];                                                           \
+  int i,j,k;                                                                                        \
+                                                                                                    \
+  for (k=0;k<lanes;k++)                                                                             \
+    for (j=0;j<5;j++)                                                                               \
+      v[j][k] = state[5*k+j];                                                                       \
+                                                                                                    \
+  a = VLOAD_##isa(v[0]); b = VLOAD_##isa(v[1]); c = VLOAD_##isa(v[2]); d = VLOAD_##isa(v[3]);       \
+  e = VLOAD_##isa(v[4]);                                                                            \
+                                                                                                    \
+  for (i=0;i<blocks;i++) {                                                                          \
+    for (k=0;k<lanes;k++)                                                                           \
+      for (j=0;j<16;j++)                                                                            \
+        w[j][k] = BE32(data[k] + 64*i + 4*j);                                                       \
+                                                                                                    \
+    for (j=0;j<16;j++)                                                                              \
+      x[j] = VLOAD_##isa(w[j]);                                                                     \
+                                                                                                    \
+    aa = a; bb = b; cc = c; dd = d; ee = e;                                                         \
+                                                                                                    \
+    for (j=0;j<20;j++) {                                                                            \
+      f = VXOR_##isa(d,VAND_##isa(b,VXOR_##isa(c,d)));                                              \
+      SHA1_STEP(isa,j,0x5a827999)                                                                   \
+    }                                                                                               \
+    for (j=20;j<40;j++) {                                                                           \
+      f = VXOR_##isa(VXOR_##isa(b,c),d);                                                            \
+      SHA1_STEP(isa,j,0x6ed9eba1)                                                                   \
+    }                                                                                               \
+    for (j=40;j<60;j++) {                                                                           \
+      f = VOR_##isa(VAND_##isa(b,c),VAND_##isa(d,VOR_##isa(b,c)));                                  \
+      SHA1_STEP(isa,j,0x8f1bbcdc)                                                                   \
+    }                                                                                               \
+    for (j=60;j<80;j++) {                                                                           \
+      f = VXOR_##isa(VXOR_##isa(b,c),d);                                                            \
+      SHA1_STEP(isa,j,0xca62c1d6)                                                                   \
+    }                                                                                               \
+                                                                                                    \
+    a = VADD_##isa(a,aa); b = VADD_##isa(b,bb); c = VADD_##isa(c,cc); d = VADD_##isa(d,dd);         \
+    e = VADD_##isa(e,ee);                                                                           \
+  }                                                                                                 \
+                                                                                                    \
+  VSTORE_##isa(v[0],a); VSTORE_##isa(v[1],b); VSTORE_##isa(v[2],c); VSTORE_##isa(v[3],d);           \
+  VSTORE_##isa(v[4],e);                                                                             \
+                                                                                                    \
+  for (k=0;k<lanes;k++)                                                                             \
+    for (j=0;j<5;j++)                                                                               \
+      state[5*k+j] = v[j][k];                                                                       \
+}
+
+/* a single lane in a plain 32-bit integer */
+#define LANE_TARGET_scalar
+#define VSET1_scalar(x) ((unsigned int)(x))
+#define VLOAD_scalar(p) (*(p))
+#define VSTORE_scalar(p,v) (*(p) = (v))
+#define VADD_scalar(a,b) ((a) + (b))
+#define VXOR_scalar(a,b) ((a) ^ (b))
+#define VAND_scalar(a,b) ((a) & (b))
+#define VOR_scalar(a,b) ((a) | (b))
+#define VANDNOT_scalar(a,b) (~(a) & (b))
+#define VROL_scalar(a,n) (((a) << (n)) | ((a) >> (32 - (n))))
+
+HASH_LANE_FUNCS(scalar,unsigned int,1)
+
+#ifdef VECTOR_X86
+
+#define LANE_TARGET_sse2 __attribute__((target("sse2")))
+#define VSET1_sse2(x) _mm_set1_epi32((int)(x))
+#define VLOAD_sse2(p) _mm_loadu_si128((__m128i *)(p))
+#define VSTORE_sse2(p,v) _mm_storeu_si128((__m128i *)(p),v)
+#define VADD_sse2(a,b) _mm_add_epi32(a,b)
+#define VXOR_sse2(a,b) _mm_xor_si128(a,b)
+#define VAND_sse2(a,b) _mm_and_si128(a,b)
+#define VOR_sse2(a,b) _mm_or_si128(a,b)
+#define VANDNOT_sse2(a,b) _mm_andnot_si128(a,b)
+#define VROL_sse2(a,n) _mm_or_si128(_mm_slli_epi32(a,n),_mm_srli_epi32(a,32 - (n)))
+
+#define LANE_TARGET_avx2 __attribute__((target("avx2")))
+#define VSET1_avx2(x) _mm256_set1_epi32((int)(x))
+#define VLOAD_avx2(p) _mm256_loadu_si256((__m256i *)(p))
+#define VSTORE_avx2(p,v) _mm256_storeu_si256((__m256i *)(p),v)
+#define VADD_avx2(a,b) _mm256_add_epi32(a,b)
+#define VXOR_avx2(a,b) _mm256_xor_si256(a,b)
+#define VAND_avx2(a,b) _mm256_and_si256(a,b)
+#define VOR_avx2(a,b) _mm256_or_si256(a,b)
+#define VANDNOT_avx2(a,b) _mm256_andnot_si256(a,b)
+#define VROL_avx2(a,n) _mm256_or_si256(_mm256_slli_epi32(a,n),_mm256_srli_epi32(a,32 - (n)))
+
+#define LANE_TARGET_avx512 __attribute__((target("avx512f")))
+#define VSET1_avx512(x) _mm512_set1_epi32((int)(x))
+#define VLOAD_avx512(p) _mm512_loadu_si512((void *)(p))
+#define VSTORE_avx512(p,v) _mm512_storeu_si512((void *)(p),v)
+#define VADD_avx512(a,b) _mm512_add_epi32(a,b)
+#define VXOR_avx512(a,b) _mm512_xor_si512(a,b)
+#define VAND_avx512(a,b) _mm512_and_si512(a,b)
+#define VOR_avx512(a,b) _mm512_or_si512(a,b)
+#define VANDNOT_avx512(a,b) _mm512_andnot_si512(a,b)
+#define VROL_avx512(a,n) _mm512_rolv_epi32(a,_mm512_set1_epi32(n))
+
+HASH_LANE_FUNCS(sse2,__m128i,4)
+HASH_LANE_FUNCS(avx2,__m256i,8)
+HASH_LANE_FUNCS(avx512,__m512i,16)
+
+#endif
+
+/* the AVX-512 entry only adds wider hash lanes - its buffer scanning functions are the AVX2 ones */
+static vector_ops vector_ops_all[] = {
+#ifdef VECTOR_X86
+  { "avx512", first_mismatch_avx2,   count_mismatches_avx2,   list_mismatches_avx2,   first_nonzero_avx2,   last_nonzero_avx2,
+    first_loud16_avx2,   first_quiet16_avx2,   16, md5_lanes_avx512, sha1_lanes_avx512 },
+  { "avx2",   first_mismatch_avx2,   count_mismatches_avx2,   list_mismatches_avx2,   first_nonzero_avx2,   last_nonzero_avx2,
+    first_loud16_avx2,   first_quiet16_avx2,    8, md5_lanes_avx2,   sha1_lanes_avx2   },
+  { "sse2",   first_mismatch_sse2,   count_mismatches_sse2,   list_mismatches_sse2,   first_nonzero_sse2,   last_nonzero_sse2,
+    first_loud16_sse2,   first_quiet16_sse2,    4, md5_lanes_sse2,   sha1_lanes_sse2   },
+#endif
+  { "scalar", first_mismatch_scalar, count_mismatches_scalar, list_mismatches_scalar, first_nonzero_scalar, last_nonzero_scalar,
+    first_loud16_scalar, first_quiet16_scalar,  1, md5_lanes_scalar, sha1_lanes_scalar }
+};
+
+static vector_ops *vops = NULL;
+
+#define NUM_VECTOR_OPS ((int)(sizeof(vector_ops_all) / sizeof(vector_ops_all[0])))
+
+static bool cpu_supports(vector_ops *ops)
+/* checks whether this CPU can run the given versions of the functions */
+{
+#ifdef VECTOR_X86
+  __builtin_cpu_init();
+  if ((!strcmp(ops->name,"avx512") && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2")) ||
+      (!strcmp(ops->name,"avx2") && __builtin_cpu_supports("avx2")) ||
+      (!strcmp(ops->name,"sse2") && __builtin_cpu_supports("sse2")))
+    return TRUE;
+#endif
+
+  return (!strcmp(ops->name,"scalar")) ? TRUE : FALSE;
+}
+
+static vector_ops *get_vector_ops()
+/* picks the fastest versions of the functions this CPU can run */
+{
+  int i;
+
+  if (vops)
+    return vops;
+
+  for (i=0;!vops;i++)
+    if (cpu_supports(&vector_ops_all[i]))
+      vops = &vector_ops_all[i];
+
+  st_debug2("using %s buffer scanning functions",vops->name);
+
+  return vops;
+}
+
+int vec_first_mismatch(unsigned char *buf1,unsigned char *buf2,int len)
+/* returns the offset of the first byte that differs between two buffers, or -1 if they are identical */
+{
+  return get_vector_ops()->first_mismatch(buf1,buf2,len);
+}
+
+int vec_count_mismatches(unsigned char *buf1,unsigned char *buf2,int len,int limit,int *first)
+/* counts the bytes that differ between two buffers, stopping early once more than limit have been seen */
+{
+  return get_vector_ops()->count_mismatches(buf1,buf2,len,limit,first);
+}
+
+int vec_list_mismatches(unsigned char *buf1,unsigned char *buf2,int len,int *offsets,int max)
+/* stores the offsets of up to max differing bytes between two buffers, returning how many were stored */
+{
+  return get_vector_ops()->list_mismatches(buf1,buf2,len,offsets,max);
+}
+
+int vec_first_nonzero(unsigned char *buf,int len)
+/* returns the offset of the first non-zero byte in a buffer, or -1 if it is all zeroes */
+{
+  return get_vector_ops()->first_nonzero(buf,len);
+}
+
+int vec_last_nonzero(unsigned char *buf,int len)
+/* returns the offset of the last non-zero byte in a buffer, or -1 if it is all zeroes */
+{
+  return get_vector_ops()->last_nonzero(buf,len);
+}
+
+int vec_first_loud16(unsigned char *buf,int len,int level)
+/* returns the offset of the first 16-bit little-endian sample whose magnitude exceeds level, or -1 if there is none */
+{
+  return get_vector_ops()->first_loud16(buf,len,level);
+}
+
+int vec_first_quiet16(unsigned char *buf,int len,int level)
+/* returns the offset of the first 16-bit little-endian sample whose magnitude is at most level, or -1 if there is none */
+{
+  return get_vector_ops()->first_quiet16(buf,len,level);
+}
+
+int vec_hash_lanes()
+/* returns how many streams vec_md5_blocks() and vec_sha1_blocks() hash at once */
+{
+  return get_vector_ops()->hash_lanes;
+}
+
+static vector_ops *get_hash_ops(int streams)
+/* picks the narrowest versions of the hash functions this CPU can run that still cover the given
+ * number of streams, so that few streams don't pay for many idle lanes
+ */
+{
+  vector_ops *ops = get_vector_ops();
+  int i;
+
+  for (i=NUM_VECTOR_OPS-1;i>=0 && &vector_ops_all[i]!=ops;i--)
+    if (vector_ops_all[i].hash_lanes >= streams && cpu_supports(&vector_ops_all[i]))
+      return &vector_ops_all[i];
+
+  return ops;
+}
+
+static void hash_blocks(bool sha1,unsigned int *state,const unsigned char **data,int streams,int blocks)
+/* hashes streams a vector's worth at a time, filling out the last group with copies of its first stream */
+{
+  void (*lanes_func)(unsigned int *,const unsigned char **,int);
+  unsigned int group_state[MAX_HASH_LANES * 5];
+  const unsigned char *group_data[MAX_HASH_LANES];
+  vector_ops *ops;
+  int i,k,lanes,words = (sha1) ? 5 : 4;
+
+  for (i=0;i<streams;i+=lanes) {
+    ops = get_hash_ops(streams - i);
+    lanes = ops->hash_lanes;
+    lanes_func = (sha1) ? ops->sha1_lanes : ops->md5_lanes;
+
+    if (streams - i >= lanes) {
+      lanes_func(state + words * i,data + i,blocks);
+      continue;
+    }
+
+    for (k=0;k<lanes;k++) {
+      group_data[k] = data[(i + k < streams) ? i + k : i];
+      memcpy(group_state + words * k,state + words * ((i + k < streams) ? i + k : i),words * sizeof(unsigned int));
+    }
+
+    lanes_func(group_state,group_data,blocks);
+
+    memcpy(state + words * i,group_state,words * (streams - i) * sizeof(unsigned int));
+  }
+}
+
+void vec_md5_blocks(unsigned int *state,const unsigned char **data,int streams,int blocks)
+/* runs the same number of 64-byte blocks from each stream through MD5, with 4 state words per stream */
+{
+  hash_blocks(FALSE,state,data,streams,blocks);
+}
+
+void vec_sha1_blocks(unsigned int *state,const unsigned char **data,int streams,int blocks)
+/* runs the same number of 64-byte blocks from each stream through SHA1, with 5 state words per stream */
+{
+  hash_blocks(TRUE,state,data,streams,blocks);
+}
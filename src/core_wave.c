@@ -310,6 +310,122 @@ bool verify_wav_header_internal(wave_info *info,bool verbose)
   return TRUE;
 }
 
+unsigned char *new_canonical_header(wave_info *info,wshort channels,wlong samples_per_sec,wshort bits_per_sample,wlong data_size,wlong chunk_size,int *len)
+/* allocates a canonical PCM WAVE header describing the given stream, for use by format modules' native_header functions */
+{
+  unsigned char *header;
+  wave_info tmp;
+
+  if (0 == channels || 0 == samples_per_sec || 0 == bits_per_sample || 0 != (bits_per_sample % 8))
+    return NULL;
+
+  if (NULL == (header = malloc(CANONICAL_HEADER_SIZE * sizeof(unsigned char))))
+    return NULL;
+
+  memset((void *)&tmp,0,sizeof(wave_info));
+
+  tmp.wave_format = WAVE_FORMAT_PCM;
+  tmp.channels = channels;
+  tmp.samples_per_sec = samples_per_sec;
+  tmp.bits_per_sample = bits_per_sample;
+  tmp.block_align = channels * (bits_per_sample / 8);
+  tmp.avg_bytes_per_sec = samples_per_sec * tmp.block_align;
+  tmp.data_size = data_size;
+  tmp.chunk_size = chunk_size;
+
+  make_canonical_header(header,&tmp);
+
+  *len = CANONICAL_HEADER_SIZE;
+
+  st_debug1("built canonical WAVE header from native [%s] metadata in file: [%s]",info->input_format->name,info->filename);
+
+  return header;
+}
+
+static bool read_native_header(wave_info *info)
+/* fills out info from the WAVE header the input format says its decoder would produce, if it can tell */
+{
+  unsigned char *header;
+  int len;
+  bool success;
+
+  if (NULL == info->input_format->native_header)
+    return FALSE;
+
+  if (NULL == (header = info->input_format->native_header(info,&len))) {
+    st_debug1("could not determine WAVE header from native [%s] metadata -- will use decoder for file: [%s]",info->input_format->name,info->filename);
+    return FALSE;
+  }
+
+  if (NULL == (info->input = open_memory_stream(header,len))) {
+    st_free(header);
+    return FALSE;
+  }
+
+  success = verify_wav_header(info);
+
+  fclose(info->input);
+  info->input = NULL;
+
+  st_free(header);
+
+  if (!success)
+    info->problems = 0;
+
+  return success;
+}
+
+static void verify_native_header(wave_info *info)
+/* compares the WAVE header obtained from the decoder with what the format's native metadata claims */
+{
+  wave_info native;
+
+  memcpy((void *)&native,(void *)info,sizeof(wave_info));
+
+  native.input = NULL;
+  native.problems = 0;
+
+  if (!read_native_header(&native))
+    return;
+
+  if (native.header_size != info->header_size || native.data_size != info->data_size || native.chunk_size != info->chunk_size ||
+      native.channels != info->channels || native.samples_per_sec != info->samples_per_sec ||
+      native.bits_per_sample != info->bits_per_sample || native.problems != info->problems)
+  {
+    st_warning("native [%s] metadata does not match decoder output for file: [%s]",info->input_format->name,info->filename);
+    return;
+  }
+
+  st_debug1("native [%s] metadata matches decoder output for file: [%s]",info->input_format->name,info->filename);
+}
+
+static format_module *probe_order(char *filename,int n)
+/* returns the nth format module to try on filename: the formats whose extension matches the
+ * filename's come first, followed by the rest in their usual order
+ */
+{
+  int i,pass,hint;
+  char *ext,*a,*b;
+
+  ext = extname(filename);
+
+  for (pass=0;pass<2;pass++) {
+    for (i=0;st_formats[i];i++) {
+      hint = FALSE;
+      if (ext && st_formats[i]->extension) {
+        for (a=ext,b=st_formats[i]->extension;*a && tolower((unsigned char)*a) == tolower((unsigned char)*b);a++,b++);
+        hint = (0 == *a && 0 == *b);
+      }
+      if ((0 == pass) != hint)
+        continue;
+      if (0 == n--)
+        return st_formats[i];
+    }
+  }
+
+  return NULL;
+}
+
 wave_info *new_wave_info(char *filename)
 /* if filename is NULL, return a fresh wave_info struct with all data zero'd out.
  * Otherwise, check that the file referenced by filename exists, is readable, and
@@ -317,9 +433,11 @@ wave_info *new_wave_info(char *filename)
  * the values in the WAVE header, otherwise return NULL.
  */
 {
-  int i,bytes;
+  int i,n,bytes;
   FILE *f;
+  format_module *fm;
   wave_info *info;
+  wave_cache_key key;
   unsigned char buf[8];
   char msg[BUF_SIZE],tmp[BUF_SIZE];
 
@@ -339,24 +457,33 @@ wave_info *new_wave_info(char *filename)
   if (!is_valid_file(info))
     goto invalid_wave_data;
 
-  /* check which format module (if any) handles this file */
-  for (i=0;st_formats[i];i++) {
-    if (!st_formats[i]->supports_input)
+  /* skip all of the work below if an earlier run already did it */
+  if (cache_lookup(info,&key))
+    return info;
+
+  /* read the head of the file once, and let every format module examine it from memory */
+  probe_begin(info->filename);
+
+  /* check which format module (if any) handles this file, starting with the one its extension suggests */
+  for (n=0;NULL != (fm = probe_order(info->filename,n));n++) {
+    if (!fm->supports_input)
       continue;
 
-    if (st_formats[i]->is_our_file) {
+    if (fm->is_our_file) {
       /* format defines its own checking function - use it */
-      if (!st_formats[i]->is_our_file(info->filename))
+      if (!fm->is_our_file(info->filename))
         continue;
     }
     else {
       /* otherwise, check for format-defined magic string at a predefined offset (if defined) */
-      if (!check_for_magic(info->filename,st_formats[i]->magic,st_formats[i]->magic_offset))
+      if (!check_for_magic(info->filename,fm->magic,fm->magic_offset))
         continue;
     }
 
+    probe_end();
+
     /* found a format that claims to handle this file */
-    info->input_format = st_formats[i];
+    info->input_format = fm;
 
     /* check if file contains an ID3v2 tag, and set flag accordingly */
     if (NULL == (f = open_input_internal(info->filename,&info->file_has_id3v2_tag,&info->id3v2_tag_size))) {
@@ -366,14 +493,20 @@ wave_info *new_wave_info(char *filename)
 
     fclose(f);
 
+    /* if the format can describe its decoded WAVE header on its own, there's no need to run the decoder */
+    if (!st_priv.verify_metadata && read_native_header(info)) {
+      cache_store(info,&key);
+      return info;
+    }
+
     /* make sure the file can be opened by the output format - this skips over any ID3v2 tags in the stream */
     if (!open_input_stream(info)) {
-      st_debug1("input file could not be opened for streaming input by format: [%s]",st_formats[i]->name);
+      st_debug1("input file could not be opened for streaming input by format: [%s]",fm->name);
       goto invalid_wave_data;
     }
 
     /* make sure we can read data from the output format (primarily to ensure the decoder is sending us data) */
-    if (1 != fread(&buf,1,1,info->input)) {
+    if (1 != peek_n_bytes(info->input,buf,1)) {
       st_snprintf(msg,BUF_SIZE,"failed to read data from input file using format: [%s]\n",info->input_format->name);
 
       st_snprintf(tmp,BUF_SIZE,"+ you may not have permission to read file: [%s]\n",info->filename);
@@ -397,13 +530,6 @@ wave_info *new_wave_info(char *filename)
       goto invalid_wave_data;
     }
 
-    close_input_stream(info);
-    info->input = NULL;
-
-    /* reopen as input stream - this skips over any ID3v2 tags in the stream */
-    if (!open_input_stream(info))
-      goto invalid_wave_data;
-
     /* finally, make sure a proper WAVE header is being sent */
     if (!verify_wav_header(info))
       goto invalid_wave_data;
@@ -411,10 +537,17 @@ wave_info *new_wave_info(char *filename)
     close_input_stream(info);
     info->input = NULL;
 
+    if (st_priv.verify_metadata)
+      verify_native_header(info);
+
+    cache_store(info,&key);
+
     /* success */
     return info;
   }
 
+  probe_end();
+
   /* if we got here, no file format modules claimed to handle the file */
 
   st_warning("none of the builtin format modules handle input file: [%s]",info->filename);
@@ -24,6 +24,7 @@ CVSID("$Id: format_aiff.c,v 1.80 2009/03/11 17:18:01 jason Exp $")
 
 static char default_decoder_args[] = "-t aiff " FILENAME_PLACEHOLDER " -t wav -";
 static char default_encoder_args[] = "-t wav - -t aiff " FILENAME_PLACEHOLDER;
+static char range_decoder_args[] = "-t aiff " FILENAME_PLACEHOLDER " -t wav - trim " FIRST_SAMPLE_PLACEHOLDER "s " NUM_SAMPLES_PLACEHOLDER "s";
 
 static bool is_our_file(char *);
 static bool input_header_kluge(unsigned char *,wave_info *);
@@ -51,7 +52,10 @@ format_module format_aiff = {
   NULL,
   NULL,
   NULL,
-  input_header_kluge
+  input_header_kluge,
+  NULL,
+  NULL,
+  range_decoder_args
 };
 
 static bool parse_aiff_header(char *filename,unsigned long *samples,unsigned short *channels,unsigned short *bits_per_sample)
@@ -67,7 +71,7 @@ static bool parse_aiff_header(char *filename,unsigned long *samples,unsigned sho
   *channels = 0;
   *bits_per_sample = 0;
 
-  if (NULL == (f = open_input(filename)))
+  if (NULL == (f = probe_open(filename)))
     return FALSE;
 
   /* look for FORM header */
@@ -118,12 +122,12 @@ static bool parse_aiff_header(char *filename,unsigned long *samples,unsigned sho
     }
   }
 
-  fclose(f);
+  probe_close(f);
   return TRUE;
 
 invalid_aiff_header:
 
-  fclose(f);
+  probe_close(f);
   return FALSE;
 }
 
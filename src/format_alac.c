@@ -16,6 +16,8 @@
  *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <stdlib.h>
+#include <string.h>
 #include "format.h"
 
 CVSID("$Id: format_alac.c,v 1.39 2009/03/11 17:18:01 jason Exp $")
@@ -24,6 +26,9 @@ CVSID("$Id: format_alac.c,v 1.39 2009/03/11 17:18:01 jason Exp $")
 
 #define ALAC_MAGIC "M4A "
 
+/* largest atom we are willing to read into memory (sample description, time-to-sample table) */
+#define ALAC_MAX_ATOM_SIZE (4*1024*1024)
+
 static char default_decoder_args[] = FILENAME_PLACEHOLDER;
 
 /*
@@ -38,6 +43,8 @@ static char default_decoder_args[] = "-i " FILENAME_PLACEHOLDER " -f wav -";
 static char default_encoder_args[] = "-i - -acodec alac " FILENAME_PLACEHOLDER;
 */
 
+static unsigned char *native_header(wave_info *,int *);
+
 format_module format_alac = {
   "alac",
   "Apple Lossless Audio Codec",
@@ -61,5 +68,191 @@ format_module format_alac = {
   NULL,
   NULL,
   NULL,
-  NULL
+  NULL,
+  native_header
 };
+
+static bool find_atom(FILE *f,long end,char *type,long *body,long *body_end)
+/* scans sibling atoms from the current position up to end, leaving the stream at the body of the requested type */
+{
+  unsigned char buf[8];
+  unsigned long size;
+  long start,header_len;
+
+  while (end < 0 || ftell(f) < end) {
+    start = ftell(f);
+
+    if (!read_be_long(f,&size) || !read_tag(f,buf))
+      return FALSE;
+
+    header_len = 8;
+
+    if (1 == size) {
+      /* 64-bit atom size - we only handle atoms smaller than 4GB */
+      if (!read_be_long(f,&size) || 0 != size || !read_be_long(f,&size))
+        return FALSE;
+      header_len = 16;
+    }
+    else if (0 == size) {
+      /* atom extends to the end of the enclosing container */
+      if (end < 0) {
+        if (fseek(f,0,SEEK_END))
+          return FALSE;
+        size = (unsigned long)(ftell(f) - start);
+        if (fseek(f,start + header_len,SEEK_SET))
+          return FALSE;
+      }
+      else
+        size = (unsigned long)(end - start);
+    }
+
+    if (size < (unsigned long)header_len)
+      return FALSE;
+
+    if (!tagcmp(buf,(unsigned char *)type)) {
+      *body = start + header_len;
+      *body_end = start + (long)size;
+      return TRUE;
+    }
+
+    if (fseek(f,start + (long)size,SEEK_SET))
+      return FALSE;
+  }
+
+  return FALSE;
+}
+
+static unsigned char *read_atom_body(FILE *f,long body,long body_end)
+/* reads the body of an atom into newly allocated memory */
+{
+  unsigned char *buf;
+  long len = body_end - body;
+
+  if (len <= 0 || len > ALAC_MAX_ATOM_SIZE || fseek(f,body,SEEK_SET))
+    return NULL;
+
+  if (NULL == (buf = malloc(len)))
+    return NULL;
+
+  if (len != fread(buf,1,len,f)) {
+    free(buf);
+    return NULL;
+  }
+
+  return buf;
+}
+
+static bool read_timescale(FILE *f,long mdia,long mdia_end,wlong *timescale)
+/* gets the timescale of the track's sample times from its mdhd atom, leaving the stream at the body of mdia */
+{
+  unsigned char *mdhd;
+  long body,body_end;
+  bool found = FALSE;
+
+  if (!find_atom(f,mdia_end,"mdhd",&body,&body_end) || NULL == (mdhd = read_atom_body(f,body,body_end)))
+    return FALSE;
+
+  /* version/flags, then creation and modification times of 4 bytes (version 0) or 8 bytes (version 1) */
+  if (0 == mdhd[0] && body_end - body >= 16) {
+    *timescale = uchar_to_ulong_be(mdhd+12);
+    found = TRUE;
+  }
+  else if (1 == mdhd[0] && body_end - body >= 24) {
+    *timescale = uchar_to_ulong_be(mdhd+20);
+    found = TRUE;
+  }
+
+  free(mdhd);
+
+  return (found && 0 == fseek(f,mdia,SEEK_SET));
+}
+
+static unsigned char *native_header(wave_info *info,int *len)
+/* builds the WAVE header that the alac decoder would produce, from the stsd and stts atoms of the audio track */
+{
+  static char *path[] = {"moov","trak","mdia","minf","stbl",NULL};
+  FILE *f;
+  unsigned char *stsd,*stts,*entry,*cookie;
+  long body,body_end,stbl,stbl_end,stsd_len,entry_len,i,entries;
+  wshort channels,bits_per_sample;
+  wlong samples_per_sec,timescale = 0;
+  double samples = 0.0,data_size;
+  int p;
+
+  if (NULL == (f = open_input(info->filename)))
+    return NULL;
+
+  body_end = -1;
+  for (p=0;path[p];p++) {
+    if (!find_atom(f,body_end,path[p],&body,&body_end) || fseek(f,body,SEEK_SET) ||
+        (!strcmp(path[p],"mdia") && !read_timescale(f,body,body_end,&timescale))) {
+      fclose(f);
+      return NULL;
+    }
+  }
+
+  stbl = body;
+  stbl_end = body_end;
+
+  if (!find_atom(f,stbl_end,"stsd",&body,&body_end) || NULL == (stsd = read_atom_body(f,body,body_end))) {
+    fclose(f);
+    return NULL;
+  }
+
+  stsd_len = body_end - body;
+
+  if (fseek(f,stbl,SEEK_SET) || !find_atom(f,stbl_end,"stts",&body,&body_end) || NULL == (stts = read_atom_body(f,body,body_end))) {
+    free(stsd);
+    fclose(f);
+    return NULL;
+  }
+
+  fclose(f);
+
+  /* stsd: version/flags, entry count, then the first sample description.  only a version 0 sound
+   * description is understood, and it must be followed by the alac magic cookie, whose 24-byte
+   * ALACSpecificConfig comes after its own version/flags.
+   */
+  entry = stsd + 8;
+  entry_len = (stsd_len >= 8 + 36) ? (long)uchar_to_ulong_be(entry) : 0;
+
+  if (entry_len < 36 + 36 || entry_len > stsd_len - 8 || tagcmp(entry+4,(unsigned char *)"alac") || 0 != uchar_to_ushort_be(entry+16) ||
+      uchar_to_ulong_be(entry+36) < 36 || (long)uchar_to_ulong_be(entry+36) > entry_len - 36 || tagcmp(entry+40,(unsigned char *)"alac"))
+  {
+    free(stsd);
+    free(stts);
+    return NULL;
+  }
+
+  cookie = entry + 36 + 12;
+
+  bits_per_sample = (wshort)cookie[5];
+  channels = (wshort)cookie[9];
+  samples_per_sec = uchar_to_ulong_be(cookie+20);
+
+  free(stsd);
+
+  /* stts: version/flags, entry count, then (sample count, sample delta) pairs */
+  entries = (body_end - body >= 8) ? (long)uchar_to_ulong_be(stts+4) : 0;
+
+  if (0 == entries || entries > (body_end - body - 8) / 8) {
+    free(stts);
+    return NULL;
+  }
+
+  for (i=0;i<entries;i++)
+    samples += (double)uchar_to_ulong_be(stts+8+i*8) * (double)uchar_to_ulong_be(stts+12+i*8);
+
+  free(stts);
+
+  /* stts counts in units of the timescale, which must be samples for the sum to be a sample count */
+  if (0 == samples_per_sec || timescale != samples_per_sec || 0 == channels || 0 == bits_per_sample || 0 != bits_per_sample % 8)
+    return NULL;
+
+  data_size = samples * (double)channels * (double)(bits_per_sample / 8);
+
+  if (data_size + CANONICAL_HEADER_SIZE > (double)0xffffffffUL)
+    return NULL;
+
+  return new_canonical_header(info,channels,samples_per_sec,bits_per_sample,(wlong)data_size,(wlong)data_size + CANONICAL_HEADER_SIZE - 8,len);
+}
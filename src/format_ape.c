@@ -16,6 +16,7 @@
  *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <stdlib.h>
 #include "format.h"
 
 CVSID("$Id: format_ape.c,v 1.54 2009/03/11 17:18:01 jason Exp $")
@@ -24,10 +25,28 @@ CVSID("$Id: format_ape.c,v 1.54 2009/03/11 17:18:01 jason Exp $")
 
 #define MAC_MAGIC "MAC "
 
+/* header layout changed with this version */
+#define APE_NEW_FORMAT_VERSION 3980
+
+#define APE_DESCRIPTOR_SIZE 52
+#define APE_NEW_HEADER_SIZE 24
+#define APE_OLD_HEADER_SIZE 32
+
+/* old format header flags */
+#define APE_FLAG_8_BIT             1
+#define APE_FLAG_PEAK_LEVEL        4
+#define APE_FLAG_24_BIT            8
+#define APE_FLAG_SEEK_ELEMENTS    16
+#define APE_FLAG_CREATE_WAV_HEADER 32
+
+/* largest stored WAVE header we are willing to read */
+#define APE_MAX_HEADER_SIZE (1024*1024)
+
 static char default_decoder_args[] = FILENAME_PLACEHOLDER " - -d";
 static char default_encoder_args[] = "- " FILENAME_PLACEHOLDER " -c2000";
 
 static bool input_header_kluge(unsigned char *,wave_info *);
+static unsigned char *native_header(wave_info *,int *);
 
 format_module format_ape = {
   "ape",
@@ -52,7 +71,8 @@ format_module format_ape = {
   NULL,
   NULL,
   NULL,
-  input_header_kluge
+  input_header_kluge,
+  native_header
 };
 
 static bool input_header_kluge(unsigned char *header,wave_info *info)
@@ -70,3 +90,121 @@ static bool input_header_kluge(unsigned char *header,wave_info *info)
 
   return TRUE;
 }
+
+static unsigned char *read_stored_header(FILE *f,long offset,unsigned long size,int *len)
+/* reads the original WAVE header that the encoder stored in the file */
+{
+  unsigned char *header;
+
+  if (0 == size || size > APE_MAX_HEADER_SIZE || fseek(f,offset,SEEK_SET))
+    return NULL;
+
+  if (NULL == (header = malloc(size)))
+    return NULL;
+
+  if (size != fread(header,1,size,f)) {
+    free(header);
+    return NULL;
+  }
+
+  *len = (int)size;
+
+  return header;
+}
+
+static unsigned char *native_header(wave_info *info,int *len)
+/* returns the WAVE header that 'mac -d' would produce, either as stored in the file or built from the APE header */
+{
+  FILE *f;
+  unsigned char buf[APE_DESCRIPTOR_SIZE + APE_NEW_HEADER_SIZE];
+  unsigned char *header = NULL;
+  unsigned long descriptor_bytes,header_bytes,seek_table_bytes,header_data_bytes;
+  unsigned long blocks_per_frame,final_frame_blocks,total_frames;
+  wshort version,compression,flags,channels,bits_per_sample;
+  wlong samples_per_sec;
+  long offset;
+  double data_size;
+
+  if (NULL == (f = open_input(info->filename)))
+    return NULL;
+
+  if (APE_OLD_HEADER_SIZE != fread(buf,1,APE_OLD_HEADER_SIZE,f) || tagcmp(buf,(unsigned char *)MAC_MAGIC)) {
+    fclose(f);
+    return NULL;
+  }
+
+  version = uchar_to_ushort_le(buf+4);
+
+  if (version >= APE_NEW_FORMAT_VERSION) {
+    descriptor_bytes = uchar_to_ulong_le(buf+8);
+    header_bytes = uchar_to_ulong_le(buf+12);
+    seek_table_bytes = uchar_to_ulong_le(buf+16);
+    header_data_bytes = uchar_to_ulong_le(buf+20);
+
+    if (descriptor_bytes < APE_OLD_HEADER_SIZE || descriptor_bytes > APE_MAX_HEADER_SIZE || header_bytes < APE_NEW_HEADER_SIZE ||
+        fseek(f,(long)descriptor_bytes,SEEK_SET) || APE_NEW_HEADER_SIZE != fread(buf,1,APE_NEW_HEADER_SIZE,f))
+    {
+      fclose(f);
+      return NULL;
+    }
+
+    compression = uchar_to_ushort_le(buf);
+    flags = uchar_to_ushort_le(buf+2);
+    blocks_per_frame = uchar_to_ulong_le(buf+4);
+    final_frame_blocks = uchar_to_ulong_le(buf+8);
+    total_frames = uchar_to_ulong_le(buf+12);
+    bits_per_sample = uchar_to_ushort_le(buf+16);
+    channels = uchar_to_ushort_le(buf+18);
+    samples_per_sec = uchar_to_ulong_le(buf+20);
+
+    offset = (long)(descriptor_bytes + header_bytes + seek_table_bytes);
+  }
+  else {
+    compression = uchar_to_ushort_le(buf+6);
+    flags = uchar_to_ushort_le(buf+8);
+    channels = uchar_to_ushort_le(buf+10);
+    samples_per_sec = uchar_to_ulong_le(buf+12);
+    header_data_bytes = uchar_to_ulong_le(buf+16);
+    total_frames = uchar_to_ulong_le(buf+24);
+    final_frame_blocks = uchar_to_ulong_le(buf+28);
+
+    if (flags & APE_FLAG_8_BIT)
+      bits_per_sample = 8;
+    else if (flags & APE_FLAG_24_BIT)
+      bits_per_sample = 24;
+    else
+      bits_per_sample = 16;
+
+    if (version >= 3950)
+      blocks_per_frame = 73728 * 4;
+    else if (version >= 3900 || (version >= 3800 && 4000 == compression))
+      blocks_per_frame = 73728;
+    else
+      blocks_per_frame = 9216;
+
+    offset = APE_OLD_HEADER_SIZE;
+    if (flags & APE_FLAG_PEAK_LEVEL)
+      offset += 4;
+    if (flags & APE_FLAG_SEEK_ELEMENTS)
+      offset += 4;
+  }
+
+  if (!(flags & APE_FLAG_CREATE_WAV_HEADER)) {
+    /* the encoder kept the original header - the decoder will emit it verbatim */
+    header = read_stored_header(f,offset,header_data_bytes,len);
+    fclose(f);
+    return header;
+  }
+
+  fclose(f);
+
+  if (0 == total_frames)
+    return NULL;
+
+  data_size = ((double)(total_frames - 1) * (double)blocks_per_frame + (double)final_frame_blocks) * (double)channels * (double)(bits_per_sample / 8);
+
+  if (data_size + CANONICAL_HEADER_SIZE > (double)0xffffffffUL)
+    return NULL;
+
+  return new_canonical_header(info,channels,samples_per_sec,bits_per_sample,(wlong)data_size,(wlong)data_size + CANONICAL_HEADER_SIZE - 8,len);
+}
@@ -16,6 +16,7 @@
  *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <string.h>
 #include "format.h"
 
 CVSID("$Id: format_flac.c,v 1.57 2009/03/11 17:18:01 jason Exp $")
@@ -24,8 +25,18 @@ CVSID("$Id: format_flac.c,v 1.57 2009/03/11 17:18:01 jason Exp $")
 
 #define FLAC_MAGIC "fLaC"
 
+/* metadata block types */
+#define FLAC_BLOCK_STREAMINFO  0
+#define FLAC_BLOCK_APPLICATION 2
+
+#define FLAC_STREAMINFO_SIZE 34
+
 static char default_decoder_args[] = "-c -d -s " FILENAME_PLACEHOLDER;
 static char default_encoder_args[] = "-s -o " FILENAME_PLACEHOLDER " -";
+static char range_decoder_args[] = "-c -d -s --skip=" FIRST_SAMPLE_PLACEHOLDER " --until=" END_SAMPLE_PLACEHOLDER " " FILENAME_PLACEHOLDER;
+
+static unsigned char *native_header(wave_info *,int *);
+static bool embedded_md5(wave_info *,unsigned char *);
 
 format_module format_flac = {
   "flac",
@@ -50,5 +61,145 @@ format_module format_flac = {
   NULL,
   NULL,
   NULL,
-  NULL
+  NULL,
+  native_header,
+  embedded_md5,
+  range_decoder_args
 };
+
+static bool read_streaminfo(char *filename,unsigned char *streaminfo,bool *foreign)
+/* reads the STREAMINFO metadata block, and notes whether an original RIFF/AIFF header is stored in the file */
+{
+  FILE *f;
+  unsigned char buf[4];
+  unsigned long block_len;
+  bool last = FALSE,found = FALSE;
+
+  *foreign = FALSE;
+
+  if (NULL == (f = open_input(filename)))
+    return FALSE;
+
+  if (!read_tag(f,buf) || tagcmp(buf,(unsigned char *)FLAC_MAGIC)) {
+    fclose(f);
+    return FALSE;
+  }
+
+  while (!last) {
+    if (!read_be_long(f,&block_len)) {
+      fclose(f);
+      return FALSE;
+    }
+
+    last = (block_len & 0x80000000) ? TRUE : FALSE;
+
+    switch ((block_len >> 24) & 0x7f) {
+      case FLAC_BLOCK_STREAMINFO:
+        block_len &= 0xffffff;
+        if (block_len < FLAC_STREAMINFO_SIZE || FLAC_STREAMINFO_SIZE != fread(streaminfo,1,FLAC_STREAMINFO_SIZE,f)) {
+          fclose(f);
+          return FALSE;
+        }
+        block_len -= FLAC_STREAMINFO_SIZE;
+        found = TRUE;
+        break;
+      case FLAC_BLOCK_APPLICATION:
+        block_len &= 0xffffff;
+        /* the decoder can be told to restore an original RIFF/AIFF header stored in these */
+        if (block_len >= 4) {
+          if (!read_tag(f,buf)) {
+            fclose(f);
+            return FALSE;
+          }
+          block_len -= 4;
+          if (!tagcmp(buf,(unsigned char *)"riff") || !tagcmp(buf,(unsigned char *)"aiff") || !tagcmp(buf,(unsigned char *)"w64 "))
+            *foreign = TRUE;
+        }
+        break;
+      default:
+        block_len &= 0xffffff;
+        break;
+    }
+
+    if (block_len > 0 && fseek(f,(long)block_len,SEEK_CUR)) {
+      fclose(f);
+      return FALSE;
+    }
+  }
+
+  fclose(f);
+
+  return found;
+}
+
+static unsigned char *native_header(wave_info *info,int *len)
+/* builds the WAVE header that 'flac -d' would produce, from the STREAMINFO metadata block */
+{
+  unsigned char buf[FLAC_STREAMINFO_SIZE];
+  wshort channels,bits_per_sample;
+  wlong samples_per_sec,samples,data_size;
+  bool foreign;
+
+  if (!read_streaminfo(info->filename,buf,&foreign) || foreign)
+    return NULL;
+
+  samples_per_sec = ((wlong)buf[10] << 12) | ((wlong)buf[11] << 4) | ((wlong)buf[12] >> 4);
+  channels = ((buf[12] >> 1) & 0x07) + 1;
+  bits_per_sample = (((buf[12] & 0x01) << 4) | (buf[13] >> 4)) + 1;
+
+  /* we don't handle more than 2^32 samples */
+  if (buf[13] & 0x0f)
+    return NULL;
+
+  samples = uchar_to_ulong_be(buf+14);
+
+  if (0 == samples)
+    return NULL;
+
+  /* anything else gets a WAVE_FORMAT_EXTENSIBLE header from flac */
+  if (channels > 2 || (8 != bits_per_sample && 16 != bits_per_sample))
+    return NULL;
+
+  if ((double)samples * (double)channels * (double)(bits_per_sample / 8) + CANONICAL_HEADER_SIZE > (double)0xffffffffUL)
+    return NULL;
+
+  data_size = samples * channels * (bits_per_sample / 8);
+
+  /* flac accounts for the pad byte of an odd-sized data chunk in the RIFF chunk size */
+  return new_canonical_header(info,channels,samples_per_sec,bits_per_sample,data_size,data_size + (CANONICAL_HEADER_SIZE - 8) + (data_size & 1),len);
+}
+
+static bool embedded_md5(wave_info *info,unsigned char *md5)
+/* returns the MD5 signature of the unencoded audio data, from the STREAMINFO metadata block */
+{
+  unsigned char buf[FLAC_STREAMINFO_SIZE];
+  wshort channels,bits_per_sample;
+  bool foreign;
+  int i;
+
+  if (!read_streaminfo(info->filename,buf,&foreign))
+    return FALSE;
+
+  channels = ((buf[12] >> 1) & 0x07) + 1;
+  bits_per_sample = (((buf[12] & 0x01) << 4) | (buf[13] >> 4)) + 1;
+
+  /* flac hashes 8-bit samples as signed, and pads others to whole bytes without shifting them,
+     so only samples of 16, 24 or 32 bits are hashed just as they appear in the WAVE data */
+  if (bits_per_sample < 16 || 0 != bits_per_sample % 8 || (buf[13] & 0x0f))
+    return FALSE;
+
+  if ((wlong)uchar_to_ulong_be(buf+14) * channels * (bits_per_sample / 8) != info->data_size)
+    return FALSE;
+
+  /* an encoder that doesn't compute the signature leaves it zeroed */
+  for (i=18;i<FLAC_STREAMINFO_SIZE;i++)
+    if (buf[i])
+      break;
+
+  if (FLAC_STREAMINFO_SIZE == i)
+    return FALSE;
+
+  memcpy(md5,buf+18,16);
+
+  return TRUE;
+}
@@ -24,9 +24,15 @@ CVSID("$Id: format_tta.c,v 1.24 2009/03/11 17:18:01 jason Exp $")
 
 #define TTA_MAGIC "TTA1"
 
+/* TTA1 header: magic, format, channels, bits/sample, sample rate, samples, crc32 */
+#define TTA_HEADER_SIZE   22
+#define TTA_FORMAT_SIMPLE 1
+
 static char default_decoder_args[] = "-d -o - " FILENAME_PLACEHOLDER;
 static char default_encoder_args[] = "-e -o " FILENAME_PLACEHOLDER " -";
 
+static unsigned char *native_header(wave_info *,int *);
+
 format_module format_tta = {
   "tta",
   "TTA Lossless Audio Codec",
@@ -50,5 +56,46 @@ format_module format_tta = {
   NULL,
   NULL,
   NULL,
-  NULL
+  NULL,
+  native_header
 };
+
+static unsigned char *native_header(wave_info *info,int *len)
+/* builds the WAVE header that 'ttaenc -d' would produce, from the TTA1 header */
+{
+  FILE *f;
+  unsigned char buf[TTA_HEADER_SIZE];
+  wshort channels,bits_per_sample;
+  wlong samples_per_sec,samples,data_size;
+
+  if (NULL == (f = open_input(info->filename)))
+    return NULL;
+
+  if (TTA_HEADER_SIZE != fread(buf,1,TTA_HEADER_SIZE,f)) {
+    fclose(f);
+    return NULL;
+  }
+
+  fclose(f);
+
+  if (tagcmp(buf,(unsigned char *)TTA_MAGIC) || TTA_FORMAT_SIMPLE != uchar_to_ushort_le(buf+4))
+    return NULL;
+
+  channels = uchar_to_ushort_le(buf+6);
+  bits_per_sample = uchar_to_ushort_le(buf+8);
+  samples_per_sec = uchar_to_ulong_le(buf+10);
+  samples = uchar_to_ulong_le(buf+14);
+
+  /* only claim the cases where the decoder is known to write a plain 44-byte PCM header - what it
+   * writes for more channels or deeper samples is left to the decoder to tell
+   */
+  if (0 == samples_per_sec || channels < 1 || channels > 2 || (8 != bits_per_sample && 16 != bits_per_sample))
+    return NULL;
+
+  if ((double)samples * (double)channels * (double)(bits_per_sample / 8) + CANONICAL_HEADER_SIZE > (double)0xffffffffUL)
+    return NULL;
+
+  data_size = samples * channels * (bits_per_sample / 8);
+
+  return new_canonical_header(info,channels,samples_per_sec,bits_per_sample,data_size,data_size + CANONICAL_HEADER_SIZE - 8,len);
+}
@@ -78,7 +78,7 @@ static bool is_our_file(char *filename)
 
   info->filename = filename;
 
-  if (NULL == (info->input = open_input(filename))) {
+  if (NULL == (info->input = probe_open(filename))) {
     st_free(info);
     return FALSE;
   }
@@ -86,19 +86,19 @@ static bool is_our_file(char *filename)
   info->input_format = &format_wav;
 
   if (!verify_wav_header(info)) {
-    fclose(info->input);
+    probe_close(info->input);
     st_free(info);
     return FALSE;
   }
 
   /* WavPack header might follow RIFF header - make sure this isn't a WavPack file */
   if (4 != fread(buf,1,4,info->input)) {
-    fclose(info->input);
+    probe_close(info->input);
     st_free(info);
     return TRUE;
   }
 
-  fclose(info->input);
+  probe_close(info->input);
   st_free(info);
 
   if (tagcmp(buf,(unsigned char *)WAVPACK_MAGIC))
@@ -32,9 +32,11 @@ CVSID("$Id: format_wv.c,v 1.72 2009/03/11 17:18:01 jason Exp $")
 #ifdef WIN32
 static char default_decoder_args[] = "-q -y " FILENAME_PLACEHOLDER " -";
 static char default_encoder_args[] = "-q -y - " FILENAME_PLACEHOLDER;
+static char range_decoder_args[] = "-q -y --skip=" FIRST_SAMPLE_PLACEHOLDER " --until=" END_SAMPLE_PLACEHOLDER " " FILENAME_PLACEHOLDER " -";
 #else
 static char default_decoder_args[] = "-q -y " FILENAME_PLACEHOLDER " -o -";
 static char default_encoder_args[] = "-q -y - -o " FILENAME_PLACEHOLDER;
+static char range_decoder_args[] = "-q -y --skip=" FIRST_SAMPLE_PLACEHOLDER " --until=" END_SAMPLE_PLACEHOLDER " " FILENAME_PLACEHOLDER " -o -";
 #endif
 
 /* definitions for version 3 and older */
@@ -52,10 +54,21 @@ typedef struct _WavpackHeader3 {
 } WavpackHeader3;
 
 /* definitions for version 4 */
+#define BYTES_STORED         3
 #define HYBRID_FLAG          8
+#define FLOAT_DATA        0x80
 #define ID_WVC_BITSTREAM  0xb  /* these metadata identify .wvc */
 #define ID_SHAPING_WEIGHTS  0x7
+#define ID_RIFF_HEADER     0x21
+#define ID_MD5_CHECKSUM    0x26
+#define ID_UNIQUE          0x3f
+#define ID_ODD_SIZE        0x40
+#define ID_LARGE           0x80
+
+/* largest first block we are willing to read when looking for a stored RIFF header */
+#define WV_MAX_BLOCK_SIZE (1024*1024)
 #define WavpackHeader4Format "4LS2LLLLL"
+#define WV4_HEADER_SIZE      32
 
 typedef struct _WavpackHeader4 {
   char ckID[4];
@@ -66,6 +79,8 @@ typedef struct _WavpackHeader4 {
 } WavpackHeader4;
 
 static bool is_our_file(char *);
+static unsigned char *native_header(wave_info *,int *);
+static bool embedded_md5(wave_info *,unsigned char *);
 
 format_module format_wv = {
   "wv",
@@ -90,7 +105,10 @@ format_module format_wv = {
   NULL,
   NULL,
   NULL,
-  NULL
+  NULL,
+  native_header,
+  embedded_md5,
+  range_decoder_args
 };
 
 static char *filespec_ext(char *filespec)
@@ -210,13 +228,13 @@ static bool is_our_file(char *filename)
 
   info->filename = filename;
 
-  if (NULL == (info->input = open_input(filename))) {
+  if (NULL == (info->input = probe_open(filename))) {
     st_free(info);
     return FALSE;
   }
 
   if (-1 == (header_offset = get_header_offset(info->input))) {
-    fclose(info->input);
+    probe_close(info->input);
     st_free(info);
     return FALSE;
   }
@@ -227,7 +245,7 @@ static bool is_our_file(char *filename)
   memset((void *)wph,0,64);
 
   if (fread(&wph,1,WV_COMMON_HEADER_SIZE,info->input) != WV_COMMON_HEADER_SIZE) {
-    fclose(info->input);
+    probe_close(info->input);
     st_free(info);
     return FALSE;
   }
@@ -237,14 +255,14 @@ static bool is_our_file(char *filename)
 
     remaining_bytes = sizeof(WavpackHeader4) - WV_COMMON_HEADER_SIZE;
     if (fread(wph+WV_COMMON_HEADER_SIZE,1,remaining_bytes,info->input) != remaining_bytes) {
-      fclose(info->input);
+      probe_close(info->input);
       st_free(info);
       return FALSE;
     }
 
     first_id = getc(info->input) & 0x1f;
 
-    fclose(info->input);
+    probe_close(info->input);
     st_free(info);
 
     wph4 = (WavpackHeader4 *)wph;
@@ -283,12 +301,12 @@ static bool is_our_file(char *filename)
 
   remaining_bytes = sizeof(WavpackHeader3) - WV_COMMON_HEADER_SIZE;
   if (fread(wph+WV_COMMON_HEADER_SIZE,1,remaining_bytes,info->input) != remaining_bytes) {
-    fclose(info->input);
+    probe_close(info->input);
     st_free(info);
     return FALSE;
   }
 
-  fclose(info->input);
+  probe_close(info->input);
   st_free(info);
 
   wph3 = (WavpackHeader3 *)wph;
@@ -320,3 +338,181 @@ static bool is_our_file(char *filename)
   /* lossless */
   return TRUE;
 }
+
+static unsigned char *read_block(FILE *f,unsigned long *block_size)
+/* reads the version 4 block starting at the current position of f */
+{
+  unsigned char *block,*p;
+
+  if (NULL == (block = malloc(WV4_HEADER_SIZE)))
+    return NULL;
+
+  if (WV4_HEADER_SIZE != fread(block,1,WV4_HEADER_SIZE,f) || tagcmp(block,(unsigned char *)WAVPACK_MAGIC) || uchar_to_ushort_le(block+8) < 4) {
+    free(block);
+    return NULL;
+  }
+
+  *block_size = uchar_to_ulong_le(block+4) + 8;
+
+  if (*block_size <= WV4_HEADER_SIZE || *block_size > WV_MAX_BLOCK_SIZE || NULL == (p = realloc(block,*block_size))) {
+    free(block);
+    return NULL;
+  }
+
+  block = p;
+
+  if (*block_size - WV4_HEADER_SIZE != fread(block+WV4_HEADER_SIZE,1,*block_size - WV4_HEADER_SIZE,f)) {
+    free(block);
+    return NULL;
+  }
+
+  return block;
+}
+
+static unsigned char *find_metadata(unsigned char *block,unsigned long block_size,unsigned char want,unsigned long *len)
+/* returns the contents of the given metadata sub-block of a version 4 block, or NULL if it has none */
+{
+  unsigned char *p,*end;
+  unsigned long size;
+  unsigned char id;
+
+  p = block + WV4_HEADER_SIZE;
+  end = block + block_size;
+
+  while (p + 2 <= end) {
+    id = *p++;
+
+    if (id & ID_LARGE) {
+      if (p + 3 > end)
+        break;
+      size = ((unsigned long)p[0] | ((unsigned long)p[1] << 8) | ((unsigned long)p[2] << 16)) << 1;
+      p += 3;
+    }
+    else
+      size = (unsigned long)*p++ << 1;
+
+    if (p + size > end)
+      break;
+
+    if (want == (id & ID_UNIQUE)) {
+      if (id & ID_ODD_SIZE)
+        size--;
+
+      *len = size;
+      return p;
+    }
+
+    p += size;
+  }
+
+  return NULL;
+}
+
+static unsigned char *native_header(wave_info *info,int *len)
+/* returns the RIFF header stored in the first block of a version 4 file, which wvunpack restores verbatim */
+{
+  FILE *f;
+  unsigned char *block,*p,*header;
+  unsigned long block_size,size;
+  long header_offset;
+
+  if (NULL == (f = open_input(info->filename)))
+    return NULL;
+
+  if (-1 == (header_offset = get_header_offset(f)) || fseek(f,header_offset,SEEK_SET)) {
+    fclose(f);
+    return NULL;
+  }
+
+  block = read_block(f,&block_size);
+
+  fclose(f);
+
+  if (NULL == block)
+    return NULL;
+
+  if (NULL == (p = find_metadata(block,block_size,ID_RIFF_HEADER,&size)) || 0 == size || NULL == (header = malloc(size))) {
+    free(block);
+    return NULL;
+  }
+
+  memcpy(header,p,size);
+  free(block);
+  *len = (int)size;
+
+  return header;
+}
+
+static bool embedded_md5(wave_info *info,unsigned char *md5)
+/* returns the MD5 signature of the original audio data, which 'wavpack -m' stores in a block at the end of the file */
+{
+  FILE *f;
+  unsigned char *block,*tail,*p;
+  unsigned long block_size,size,flags;
+  long header_offset,file_size,tail_size,i;
+  bool found = FALSE;
+
+  if (NULL == (f = open_input(info->filename)))
+    return FALSE;
+
+  if (-1 == (header_offset = get_header_offset(f)) || fseek(f,header_offset,SEEK_SET) || NULL == (block = read_block(f,&block_size))) {
+    fclose(f);
+    return FALSE;
+  }
+
+  flags = uchar_to_ulong_le(block+24);
+
+  free(block);
+
+  /* the signature covers the lossless data, which is only decoded when the correction file is there */
+  if ((flags & HYBRID_FLAG) && !file_exists_with_alternate_extension(info->filename,".wvc") && !file_exists_with_alternate_extension(info->filename,".WVC")) {
+    fclose(f);
+    return FALSE;
+  }
+
+  /* it is computed over samples as stored in the original file, so they must be laid out the same way in the WAVE data */
+  if ((flags & FLOAT_DATA) || (wint)(flags & BYTES_STORED) + 1 != info->block_align / info->channels) {
+    fclose(f);
+    return FALSE;
+  }
+
+  if (fseek(f,0,SEEK_END) || (file_size = ftell(f)) < header_offset) {
+    fclose(f);
+    return FALSE;
+  }
+
+  tail_size = min(file_size - header_offset,WV_MAX_BLOCK_SIZE);
+
+  if (NULL == (tail = malloc(tail_size))) {
+    fclose(f);
+    return FALSE;
+  }
+
+  if (fseek(f,file_size - tail_size,SEEK_SET) || tail_size != (long)fread(tail,1,tail_size,f)) {
+    free(tail);
+    fclose(f);
+    return FALSE;
+  }
+
+  fclose(f);
+
+  /* look for the last complete block holding the signature */
+  for (i=tail_size-WV4_HEADER_SIZE;i>=0 && !found;i--) {
+    if (tagcmp(tail+i,(unsigned char *)WAVPACK_MAGIC) || uchar_to_ushort_le(tail+i+8) < 4)
+      continue;
+
+    block_size = uchar_to_ulong_le(tail+i+4) + 8;
+
+    if (block_size <= WV4_HEADER_SIZE || block_size > (unsigned long)(tail_size - i))
+      continue;
+
+    if ((p = find_metadata(tail+i,block_size,ID_MD5_CHECKSUM,&size)) && 16 == size) {
+      memcpy(md5,p,16);
+      found = TRUE;
+    }
+  }
+
+  free(tail);
+
+  return found;
+}
@@ -29,6 +29,7 @@ mode_module mode_cat = {
   "Writes PCM WAVE data from one or more files to the terminal",
   CVSIDSTR,
   FALSE,
+  FALSE,
   cat_main,
   cat_help
 };
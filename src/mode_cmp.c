@@ -26,30 +26,44 @@ static void cmp_help(void);
 mode_module mode_cmp = {
   "cmp",
   "shncmp",
-  "Compares PCM WAVE data in two files",
+  "Compares PCM WAVE data in two or more files",
   CVSIDSTR,
   FALSE,
+  FALSE,
   cmp_main,
   cmp_help
 };
 
 #define CMP_MATCH_SIZE 2352  /* arbitrary number of bytes that must match before attempting
                                 to check whether shifted data in the files is identical */
+
+#define CMP_LIST_SIZE   4096  /* number of differing bytes to look for at once when listing them */
+
+#define CMP_BLOCK_SIZE    64  /* approximate size of the blocks hashed to find candidate byte-shifts */
+#define CMP_BLOCK_REPEATS 16  /* blocks occurring more often than this (e.g. silence) are not used */
+#define CMP_HASH_BASE     0x01000193UL
 static bool align = FALSE;
+static bool track = FALSE;
 static bool list = FALSE;
 static int fuzz = 0;
+static int set_size = 0;
+static char *unit = "file";
+static char *unit_title = "File";
 static wlong shift_secs = 3;
 
 static void cmp_help()
 {
-  st_info("Usage: %s [OPTIONS] [file1 file2]\n",st_progname());
+  st_info("Usage: %s [OPTIONS] [file1 file2 ... fileN]\n",st_progname());
   st_info("\n");
   st_info("Mode-specific options:\n");
   st_info("\n");
-  st_info("  -c secs check the first secs seconds of data for byte shift (default is %d)\n",shift_secs);
+  st_info("  -a      keep track of alignment: after differing data, realign the files and report differing regions\n");
+  st_info("  -c secs check the first secs seconds of data for byte shift, or look up to secs seconds\n");
+  st_info("          ahead when realigning with -a (default is %d)\n",shift_secs);
   st_info("  -f fuzz fuzz factor: allow up to fuzz mismatches when detecting a byte-shift\n");
   st_info("  -h      show this help screen\n");
   st_info("  -l      list offsets and values of all differing bytes\n");
+  st_info("  -n num  compare the first num files with the rest, taking each group of files as one stream\n");
   st_info("  -s      check if WAVE data in the files is identical modulo a byte-shift\n");
   st_info("\n");
 }
@@ -58,8 +72,11 @@ static void parse(int argc,char **argv,int *first_arg)
 {
   int c;
 
-  while ((c = st_getopt(argc,argv,"c:f:ls")) != -1) {
+  while ((c = st_getopt(argc,argv,"ac:f:ln:s")) != -1) {
     switch (c) {
+      case 'a':
+        track = TRUE;
+        break;
       case 'c':
         if (NULL == optarg)
           st_help("missing seconds for byte-shift comparison");
@@ -77,6 +94,13 @@ static void parse(int argc,char **argv,int *first_arg)
       case 'l':
         list = TRUE;
         break;
+      case 'n':
+        if (NULL == optarg)
+          st_help("missing number of files in the first set");
+        set_size = atoi(optarg);
+        if (set_size <= 0)
+          st_help("number of files in the first set must be positive");
+        break;
       case 's':
         align = TRUE;
         break;
@@ -86,100 +110,244 @@ static void parse(int argc,char **argv,int *first_arg)
   if (fuzz > 0 && !align)
     st_help("fuzz factor can only be used with byte-shift");
 
-  if (optind != argc && optind != argc - 2)
-    st_help("need exactly two files to process");
+  if (track && list)
+    st_help("alignment tracking reports differing regions, and cannot be combined with listing differing bytes");
+
+  if (optind == argc - 1)
+    st_help("need two or more files to process");
 
   *first_arg = optind;
 }
 
-static void check_headers(wave_info *info1,wave_info *info2,int shift)
+static bool check_headers(wave_info *info1,wave_info *info2,bool fatal)
 {
-  int data_size1,data_size2,real_shift = (shift < 0) ? -shift : shift;
-
-  data_size1 = info1->data_size;
-  data_size2 = info2->data_size;
-
-  if (shift > 0)
-    data_size1 -= real_shift;
-  else if (shift < 0)
-    data_size2 -= real_shift;
+  char *problem = NULL;
 
   if (info1->wave_format != info2->wave_format)
-    st_error("WAVE format differs between these files");
-
-  if (info1->channels != info2->channels)
-    st_error("number of channels differs between these files");
-
-  if (info1->samples_per_sec != info2->samples_per_sec)
-    st_error("samples per second differs between these files");
-
-  if (info1->avg_bytes_per_sec != info2->avg_bytes_per_sec)
-    st_error("average bytes per second differs between these files");
-
-  if (info1->bits_per_sample != info2->bits_per_sample)
-    st_error("bits per sample differs between these files");
+    problem = "WAVE format differs between these files";
+  else if (info1->channels != info2->channels)
+    problem = "number of channels differs between these files";
+  else if (info1->samples_per_sec != info2->samples_per_sec)
+    problem = "samples per second differs between these files";
+  else if (info1->avg_bytes_per_sec != info2->avg_bytes_per_sec)
+    problem = "average bytes per second differs between these files";
+  else if (info1->bits_per_sample != info2->bits_per_sample)
+    problem = "bits per sample differs between these files";
+
+  if (problem) {
+    if (fatal)
+      st_error("%s",problem);
+    st_warning("%s -- skipping file: [%s]",problem,info2->filename);
+    return FALSE;
+  }
 
   if (info1->block_align != info2->block_align)
     st_warning("block align differs between these files");
 
-  if (data_size1 != data_size2)
-    st_warning("WAVE data size differs between these files -- will check up to smaller size");
+  return TRUE;
 }
 
 static int memfuzzycmp(unsigned char *str1,unsigned char *str2,int len,int fuzz)
 {
-  int i,firstbad = -1,badcount = 0;
-
-  for (i=0;i<len;i++) {
-    if (str1[i] != str2[i]) {
-      if (0 == fuzz)
-        return i;
-      if (firstbad < 0)
-        firstbad = i;
-      badcount++;
-      if (badcount > fuzz)
-        return firstbad;
-    }
-  }
+  int firstbad;
+
+  if (len <= 0)
+    return -1;
+
+  if (0 == fuzz)
+    return vec_first_mismatch(str1,str2,len);
+
+  if (vec_count_mismatches(str1,str2,len,fuzz,&firstbad) > fuzz)
+    return firstbad;
 
   return -1;
 }
 
+static unsigned long block_hash(unsigned char *buf,int len)
+{
+  unsigned long h = 0;
+  int i;
+
+  for (i=0;i<len;i++)
+    h = h * CMP_HASH_BASE + buf[i];
+
+  return h;
+}
+
 static void open_file(wave_info *info)
 {
   if (!open_input_stream(info))
     st_error("could not reopen input file: [%s]",info->filename);
 }
 
-static bool cmp_files(wave_info *info1,wave_info *info2,int shift)
+/*
+ * with -n, each group of files is compared as one continuous stream of WAVE data, chained
+ * the same way as for composite hashes, so that e.g. split output can be checked against its
+ * source without joining it first.  comparing two files is just comparing two sets of one
+ * file each, and offsets are only broken down by file when a set has more than one file.
+ */
+
+typedef struct _cmp_set {
+  wave_info **files;
+  int numfiles;
+  int current;      /* index of the open file, or -1 */
+  wlong left;       /* bytes of data not read yet from the open file */
+  wlong data_size;  /* data size of all files together */
+  char desc[FILENAME_SIZE];
+} cmp_set;
+
+static void set_init(cmp_set *set,wave_info **files,int numfiles)
+{
+  int i;
+
+  set->files = files;
+  set->numfiles = numfiles;
+  set->current = -1;
+  set->left = 0;
+  set->data_size = 0;
+
+  for (i=0;i<numfiles;i++) {
+    if (i > 0)
+      check_headers(files[0],files[i],TRUE);
+    set->data_size += files[i]->data_size;
+  }
+
+  if (1 == numfiles)
+    st_snprintf(set->desc,FILENAME_SIZE,"%s",files[0]->filename);
+  else
+    st_snprintf(set->desc,FILENAME_SIZE,"%d files starting with %s",numfiles,files[0]->filename);
+}
+
+static char *set_filename(cmp_set *set)
+{
+  return set->files[min(max(set->current,0),set->numfiles - 1)]->filename;
+}
+
+static bool set_read(cmp_set *set,unsigned char *buf,wlong bytes,progress_info *proginfo)
+{
+  wlong n;
+
+  while (bytes > 0) {
+    if (0 == set->left) {
+      if (set->current >= 0)
+        close_input_stream(set->files[set->current]);
+      if (++set->current >= set->numfiles)
+        return FALSE;
+      open_file(set->files[set->current]);
+      discard_header(set->files[set->current]);
+      set->left = set->files[set->current]->data_size;
+      pipeline_read_ahead(set->files[set->current]->input,set->left);
+      continue;
+    }
+
+    n = min(bytes,set->left);
+
+    if (read_n_bytes(set->files[set->current]->input,buf,(int)n,proginfo) != (int)n)
+      return FALSE;
+
+    buf += n;
+    bytes -= n;
+    set->left -= n;
+  }
+
+  return TRUE;
+}
+
+static void set_close(cmp_set *set)
+{
+  if (set->current >= 0 && set->current < set->numfiles)
+    close_input_stream(set->files[set->current]);
+
+  set->current = -1;
+  set->left = 0;
+}
+
+static char *set_offset(cmp_set *set,wlong pos,char *buf)
+{
+  int i;
+
+  if (1 == set->numfiles) {
+    st_snprintf(buf,32,"%lu",pos + 1);
+    return buf;
+  }
+
+  for (i=0;i<set->numfiles-1 && pos>=set->files[i]->data_size;i++)
+    pos -= set->files[i]->data_size;
+
+  st_snprintf(buf,32,"%d:%lu",i + 1,pos + 1);
+
+  return buf;
+}
+
+static void show_sets(cmp_set *set1,cmp_set *set2)
+{
+  cmp_set *sets[2];
+  int i,j;
+
+  if (1 == set1->numfiles && 1 == set2->numfiles)
+    return;
+
+  sets[0] = set1;
+  sets[1] = set2;
+
+  st_info("Offsets are given as file:offset, with files numbered within each set as follows:\n");
+  st_info("\n");
+
+  for (i=0;i<2;i++)
+    for (j=0;j<sets[i]->numfiles;j++)
+      st_info("  set %d, file %3d:  [%s]\n",i + 1,j + 1,sets[i]->files[j]->filename);
+
+  st_info("\n");
+}
+
+static void check_sets(cmp_set *set1,cmp_set *set2,int shift)
+{
+  wlong data_size1 = set1->data_size,data_size2 = set2->data_size;
+
+  check_headers(set1->files[0],set2->files[0],TRUE);
+
+  if (shift > 0)
+    data_size1 -= shift;
+  else if (shift < 0)
+    data_size2 += shift;
+
+  if (data_size1 != data_size2)
+    st_warning("WAVE data size differs between these %ss -- will check up to smaller size",unit);
+}
+
+static bool cmp_files(cmp_set *set1,cmp_set *set2,int shift)
 {
   unsigned char *buf1,*buf2;
+  char pos1[32],pos2[32];
   wlong bytes_to_check,
         bytes_checked = 0,
         bytes,
-        shifted_data_size1 = info1->data_size,
-        shifted_data_size2 = info2->data_size,
+        shifted_data_size1 = set1->data_size,
+        shifted_data_size2 = set2->data_size,
+        skipped1,
+        skipped2,
         xfer_size;
-  int offset, real_shift, i;
-  bool differed = FALSE, did_l_header = FALSE, success;
+  int offset, real_shift, i, n, k, offsets[CMP_LIST_SIZE];
+  bool differed = FALSE, did_l_header = FALSE, success, sets;
   progress_info proginfo;
 
   success = FALSE;
+  sets = (set1->numfiles > 1 || set2->numfiles > 1) ? TRUE : FALSE;
 
-  check_headers(info1,info2,shift);
+  check_sets(set1,set2,shift);
 
   proginfo.initialized = FALSE;
   proginfo.prefix = "Comparing";
   proginfo.clause = "and";
-  proginfo.filename1 = info1->filename;
-  proginfo.filedesc1 = info1->m_ss;
-  proginfo.filename2 = info2->filename;
-  proginfo.filedesc2 = info2->m_ss;
+  proginfo.filename1 = set1->desc;
+  proginfo.filedesc1 = (sets) ? NULL : set1->files[0]->m_ss;
+  proginfo.filename2 = set2->desc;
+  proginfo.filedesc2 = (sets) ? NULL : set2->files[0]->m_ss;
   proginfo.bytes_total = 1;
 
   prog_update(&proginfo);
 
-  xfer_size = max(XFER_SIZE,(shift_secs * info1->rate));
+  xfer_size = max(XFER_SIZE,(shift_secs * set1->files[0]->rate));
 
   /* kluge to work around free(buf2) dumping core if malloc()'d separately */
   if (NULL == (buf1 = malloc(2 * xfer_size * sizeof(unsigned char)))) {
@@ -190,25 +358,21 @@ static bool cmp_files(wave_info *info1,wave_info *info2,int shift)
   buf2 = buf1 + xfer_size;
 
   real_shift = (shift < 0) ? -shift : shift;
-
-  open_file(info1);
-  open_file(info2);
-
-  discard_header(info1);
-  discard_header(info2);
+  skipped1 = (shift > 0) ? real_shift : 0;
+  skipped2 = (shift < 0) ? real_shift : 0;
 
   if (shift > 0) {
-    if (read_n_bytes(info1->input,buf1,real_shift,NULL) != real_shift) {
+    if (!set_read(set1,buf1,real_shift,NULL)) {
       prog_error(&proginfo);
-      st_error("error while shifting %d bytes from file: [%s]",real_shift,info1->filename);
+      st_error("error while shifting %d bytes from file: [%s]",real_shift,set_filename(set1));
     }
 
     shifted_data_size1 -= real_shift;
   }
   else if (shift < 0) {
-    if (read_n_bytes(info2->input,buf2,real_shift,NULL) != real_shift) {
+    if (!set_read(set2,buf2,real_shift,NULL)) {
       prog_error(&proginfo);
-      st_error("error while shifting %d bytes from file: [%s]",real_shift,info2->filename);
+      st_error("error while shifting %d bytes from file: [%s]",real_shift,set_filename(set2));
     }
 
     shifted_data_size2 -= real_shift;
@@ -216,54 +380,68 @@ static bool cmp_files(wave_info *info1,wave_info *info2,int shift)
 
   bytes_to_check = min(shifted_data_size1,shifted_data_size2);
 
-  proginfo.filedesc1 = info1->m_ss;
-  proginfo.filedesc2 = info2->m_ss;
   proginfo.bytes_total = bytes_to_check;
 
   while (bytes_to_check > 0) {
     bytes = min(bytes_to_check,xfer_size);
-    if (read_n_bytes(info1->input,buf1,(int)bytes,&proginfo) != (int)bytes) {
+    if (!set_read(set1,buf1,bytes,&proginfo)) {
       prog_error(&proginfo);
-      st_error("error while reading %d bytes from file: [%s]",(int)bytes,info1->filename);
+      st_error("error while reading %d bytes from file: [%s]",(int)bytes,set_filename(set1));
     }
 
-    if (read_n_bytes(info2->input,buf2,(int)bytes,NULL) != (int)bytes) {
+    if (!set_read(set2,buf2,bytes,NULL)) {
       prog_error(&proginfo);
-      st_error("error while reading %d bytes from file: [%s]",(int)bytes,info2->filename);
+      st_error("error while reading %d bytes from file: [%s]",(int)bytes,set_filename(set2));
     }
 
     if (-1 != (offset = memfuzzycmp(buf1,buf2,bytes,0))) {
       differed = TRUE;
       if (!list) {
         prog_error(&proginfo);
+        if (sets)
+          st_error("WAVE data differs at offsets: %s and %s",set_offset(set1,skipped1 + bytes_checked + offset,pos1),
+                   set_offset(set2,skipped2 + bytes_checked + offset,pos2));
         st_error("WAVE data differs at byte offset: %lu",bytes_checked+(wlong)offset+1);
       }
-      i = 0;
-      while (offset >= 0) {
-        i += offset + 1;
-        if (!did_l_header) {
-          prog_error(&proginfo);
-          st_info("\n");
+      if (!did_l_header) {
+        prog_error(&proginfo);
+        st_info("\n");
+        if (sets) {
+          st_info("       offset 1       offset 2   1   2\n");
+          st_info("   ------------------------------------\n");
+        }
+        else {
           st_info("    offset   1   2\n");
           st_info("   ----------------\n");
-          did_l_header = TRUE;
         }
-        st_info("%10ld %3d %3d\n",bytes_checked + i,(int)*(buf1 + i - 1),(int)*(buf2 + i - 1));
-        offset = memfuzzycmp(buf1 + i,buf2 + i,bytes - i,0);
+        did_l_header = TRUE;
+      }
+      i = offset;
+      while ((n = vec_list_mismatches(buf1 + i,buf2 + i,(int)bytes - i,offsets,CMP_LIST_SIZE)) > 0) {
+        for (k=0;k<n;k++) {
+          if (sets)
+            st_info("%15s %14s %3d %3d\n",
+                    set_offset(set1,skipped1 + bytes_checked + i + offsets[k],pos1),
+                    set_offset(set2,skipped2 + bytes_checked + i + offsets[k],pos2),
+                    (int)buf1[i + offsets[k]],(int)buf2[i + offsets[k]]);
+          else
+            st_info("%10ld %3d %3d\n",bytes_checked + i + offsets[k] + 1,(int)buf1[i + offsets[k]],(int)buf2[i + offsets[k]]);
+        }
+        i += offsets[n-1] + 1;
       }
     }
     bytes_to_check -= bytes;
     bytes_checked += bytes;
   }
 
-  close_input_stream(info1);
-  close_input_stream(info2);
+  set_close(set1);
+  set_close(set2);
 
   if (!differed) {
     success = TRUE;
     prog_success(&proginfo);
     st_info("\n");
-    st_info("%s of these files are identical",(0 == shift) ? "Contents" : "Aligned contents");
+    st_info("%s of these %ss are identical",(0 == shift) ? "Contents" : "Aligned contents",unit);
     if (shifted_data_size1 != shifted_data_size2)
       st_info(" (up to the first %lu bytes of WAVE data)",min(shifted_data_size1,shifted_data_size2));
     st_info(".\n");
@@ -271,7 +449,7 @@ static bool cmp_files(wave_info *info1,wave_info *info2,int shift)
   else {
     success = FALSE;
     st_info("\n");
-    st_info("%s of these files differed as indicated above.\n",(0 == shift) ? "Contents" : "Aligned contents");
+    st_info("%s of these %ss differed as indicated above.\n",(0 == shift) ? "Contents" : "Aligned contents",unit);
   }
 
   st_free(buf1);
@@ -279,11 +457,353 @@ static bool cmp_files(wave_info *info1,wave_info *info2,int shift)
   return success;
 }
 
-static void open_and_read_beginning(wave_info *info,unsigned char *buf,int bytes)
+/*
+ * alignment tracking reads both files through windows reaching a few seconds past the current
+ * position.  while the data matches, the windows move along together.  at a mismatch, it looks
+ * for the nearest point where the files line up again, i.e. the offsets d1 and d2 past the
+ * mismatch with the smallest d1+d2 at which the next CMP_MATCH_SIZE bytes are identical.
+ * realigning without drift (d1 == d2) is found by scanning ahead directly.  realigning with
+ * drift is found by hashing sample-aligned blocks of the second window, and rolling a hash
+ * over the first window to see where they occur.  the skipped data is reported as one region.
+ */
+
+typedef struct _cmp_window {
+  cmp_set *set;
+  unsigned char *buf;
+  wlong size;       /* capacity of buf */
+  wlong len;        /* number of bytes in buf */
+  wlong pos;        /* offset of buf[0] within the aligned data */
+  wlong skipped;    /* number of bytes skipped at the beginning of the data to align it */
+  wlong remaining;  /* number of bytes of data not read yet */
+} cmp_window;
+
+typedef struct _cmp_regions {
+  int count;
+  wlong changed;
+  wlong only1;
+  wlong only2;
+} cmp_regions;
+
+static void window_fill(cmp_window *w,progress_info *proginfo)
 {
-  open_file(info);
+  wlong bytes = min(w->size - w->len,w->remaining);
+
+  if (0 == bytes)
+    return;
+
+  if (!set_read(w->set,w->buf + w->len,bytes,proginfo)) {
+    if (proginfo)
+      prog_error(proginfo);
+    st_error("error while reading %d bytes from file: [%s]",(int)bytes,set_filename(w->set));
+  }
+
+  w->len += bytes;
+  w->remaining -= bytes;
+}
+
+static void window_advance(cmp_window *w,wlong bytes)
+{
+  memmove(w->buf,w->buf + bytes,w->len - bytes);
+  w->len -= bytes;
+  w->pos += bytes;
+}
+
+static int realignment_length(cmp_window *w1,cmp_window *w2,wlong d1,wlong d2)
+{
+  wlong left1 = w1->len - d1,left2 = w2->len - d2,len;
+
+  /* a shorter match will do only where it runs up to the end of a file */
+  len = min(min(left1,left2),CMP_MATCH_SIZE);
+  if (len < CMP_MATCH_SIZE && !(len == left1 && 0 == w1->remaining) && !(len == left2 && 0 == w2->remaining))
+    return 0;
+
+  return (int)len;
+}
+
+static bool find_realignment(cmp_window *w1,cmp_window *w2,wlong range,int block_align,wlong *d1,wlong *d2)
+{
+  unsigned long h,out_factor,*hashes;
+  int *table,*next,table_size,mask,block_size,num_blocks,len,m,i,j;
+  wlong d,p,first,best,b1,b2,back;
+
+  best = 0;
+
+  /* without drift */
+  for (d=1;d<=range;) {
+    if (0 == (len = realignment_length(w1,w2,d,d)))
+      break;
+    if ((m = vec_first_mismatch(w1->buf + d,w2->buf + d,len)) < 0) {
+      *d1 = *d2 = d;
+      best = 2 * d;
+      break;
+    }
+    d += m + 1;
+  }
+
+  block_size = (block_align > 0) ? block_align * ((CMP_BLOCK_SIZE + block_align - 1) / block_align) : CMP_BLOCK_SIZE;
+
+  /* a realignment this close can't be beaten by a drifting one found through blocks */
+  if (best > 0 && best <= 2 * block_size)
+    return TRUE;
+
+  /* first block of the second window that starts on a sample boundary */
+  first = (block_align > 0) ? (block_align - (w2->pos + w2->skipped) % block_align) % block_align : 0;
+  num_blocks = 0;
+  if (w2->len >= first + block_size)
+    num_blocks = (int)min((w2->len - first - block_size) / block_size + 1,range / block_size + 1);
+
+  if (0 == num_blocks || w1->len < (wlong)block_size)
+    return (best > 0) ? TRUE : FALSE;
+
+  for (table_size=1;table_size<2*num_blocks;table_size<<=1)
+    ;
+  mask = table_size - 1;
+
+  hashes = NULL;
+  table = next = NULL;
+
+  if (NULL == (hashes = malloc(num_blocks * sizeof(unsigned long))) ||
+      NULL == (table = malloc(table_size * sizeof(int))) ||
+      NULL == (next = malloc(num_blocks * sizeof(int))))
+    st_error("could not allocate memory for realignment search");
+
+  for (i=0;i<table_size;i++)
+    table[i] = -1;
+
+  /* only the first occurrence of each block is needed, since later ones can only lead to a farther realignment */
+  for (j=0;j<num_blocks;j++) {
+    hashes[j] = block_hash(w2->buf + first + (wlong)j * block_size,block_size);
+    for (i=table[hashes[j] & mask];i>=0;i=next[i])
+      if (hashes[i] == hashes[j] && !memcmp(w2->buf + first + (wlong)i * block_size,w2->buf + first + (wlong)j * block_size,block_size))
+        break;
+    if (i < 0) {
+      next[j] = table[hashes[j] & mask];
+      table[hashes[j] & mask] = j;
+    }
+  }
+
+  out_factor = 1;
+  for (i=0;i<block_size;i++)
+    out_factor *= CMP_HASH_BASE;
+
+  h = block_hash(w1->buf,block_size);
+  for (p=0;p<=range;p++) {
+    /* backing up can't take more than a block off each offset */
+    if (best > 0 && p > best + 2 * block_size)
+      break;
+
+    for (j=table[h & mask];j>=0;j=next[j]) {
+      if (hashes[j] != h || memcmp(w1->buf + p,w2->buf + first + (wlong)j * block_size,block_size))
+        continue;
+
+      b1 = p;
+      b2 = first + (wlong)j * block_size;
+      if (best > 0 && b1 + b2 >= best + 2 * block_size)
+        continue;
+
+      /* the files may line up again a little before the block */
+      for (back=0;back<block_size && b1>0 && b2>0 && w1->buf[b1-1] == w2->buf[b2-1];back++) {
+        b1--;
+        b2--;
+      }
+
+      if ((0 == best || b1 + b2 < best) && (b1 > 0 || b2 > 0) && (len = realignment_length(w1,w2,b1,b2)) > 0 &&
+          vec_first_mismatch(w1->buf + b1,w2->buf + b2,len) < 0)
+      {
+        *d1 = b1;
+        *d2 = b2;
+        best = b1 + b2;
+      }
+    }
+
+    if (p + block_size >= w1->len)
+      break;
+
+    h = h * CMP_HASH_BASE + w1->buf[p + block_size] - out_factor * w1->buf[p];
+  }
+
+  st_free(hashes);
+  st_free(table);
+  st_free(next);
+
+  return (best > 0) ? TRUE : FALSE;
+}
+
+static void report_region(cmp_window *w1,cmp_window *w2,wlong d1,wlong d2,cmp_regions *regions,progress_info *proginfo)
+{
+  char what[32],pos1[32],pos2[32];
+  wlong drift;
+  int block_align = (int)max(w1->set->files[0]->block_align,1);
+
+  if (0 == regions->count) {
+    prog_error(proginfo);
+    st_info("\n");
+    st_info("    offset 1    offset 2     bytes 1     bytes 2  difference\n");
+    st_info("   -------------------------------------------------------------------\n");
+  }
+
+  if (d1 == d2) {
+    strcpy(what,"changed");
+    regions->changed += d1;
+  }
+  else {
+    if (0 == d2 || 0 == d1)
+      st_snprintf(what,32,"only in %s %d",unit,(0 == d2) ? 1 : 2);
+    else
+      strcpy(what,"replaced");
+    if (d1 > d2)
+      regions->only1 += d1 - d2;
+    else
+      regions->only2 += d2 - d1;
+    regions->changed += min(d1,d2);
+  }
+
+  regions->count++;
+
+  st_info("%12s %11s %11lu %11lu  %s",set_offset(w1->set,w1->pos + w1->skipped,pos1),set_offset(w2->set,w2->pos + w2->skipped,pos2),d1,d2,what);
+  if (d1 != d2) {
+    drift = (d1 > d2) ? d1 - d2 : d2 - d1;
+    st_info(" (%lu%s samples extra in %s %d)",drift / block_align,(drift % block_align) ? "+" : "",unit,(d1 > d2) ? 1 : 2);
+  }
+  st_info("\n");
+}
+
+static bool track_files(cmp_set *set1,cmp_set *set2,int shift)
+{
+  cmp_window w1,w2;
+  cmp_regions regions;
+  char pos1[32],pos2[32];
+  wlong size,range,bytes,d1 = 0,d2 = 0;
+  int offset;
+  bool lost = FALSE,sets;
+  progress_info proginfo;
+
+  sets = (set1->numfiles > 1 || set2->numfiles > 1) ? TRUE : FALSE;
+
+  check_sets(set1,set2,shift);
+
+  proginfo.initialized = FALSE;
+  proginfo.prefix = "Comparing";
+  proginfo.clause = "and";
+  proginfo.filename1 = set1->desc;
+  proginfo.filedesc1 = (sets) ? NULL : set1->files[0]->m_ss;
+  proginfo.filename2 = set2->desc;
+  proginfo.filedesc2 = (sets) ? NULL : set2->files[0]->m_ss;
+  proginfo.bytes_total = 1;
+
+  prog_update(&proginfo);
+
+  range = shift_secs * set1->files[0]->rate;
+  size = max(XFER_SIZE,2 * (range + CMP_MATCH_SIZE));
+
+  if (NULL == (w1.buf = malloc(2 * size * sizeof(unsigned char)))) {
+    prog_error(&proginfo);
+    st_error("could not allocate %d-byte comparison buffer",size);
+  }
+
+  w2.buf = w1.buf + size;
+
+  w1.set = set1;
+  w2.set = set2;
+  w1.size = w2.size = size;
+  w1.len = w2.len = 0;
+  w1.pos = w2.pos = 0;
+  w1.skipped = (shift > 0) ? shift : 0;
+  w2.skipped = (shift < 0) ? -shift : 0;
+  w1.remaining = set1->data_size - w1.skipped;
+  w2.remaining = set2->data_size - w2.skipped;
+
+  regions.count = 0;
+  regions.changed = regions.only1 = regions.only2 = 0;
+
+  if (w1.skipped > 0 && !set_read(set1,w1.buf,w1.skipped,NULL)) {
+    prog_error(&proginfo);
+    st_error("error while shifting %d bytes from file: [%s]",(int)w1.skipped,set_filename(set1));
+  }
+
+  if (w2.skipped > 0 && !set_read(set2,w2.buf,w2.skipped,NULL)) {
+    prog_error(&proginfo);
+    st_error("error while shifting %d bytes from file: [%s]",(int)w2.skipped,set_filename(set2));
+  }
+
+  proginfo.bytes_total = w1.remaining;
+
+  for (;;) {
+    /* the progress indicator is finished once the first region has been reported */
+    window_fill(&w1,(0 == regions.count) ? &proginfo : NULL);
+    window_fill(&w2,NULL);
+
+    if (0 == (bytes = min(w1.len,w2.len)))
+      break;
+
+    if ((offset = vec_first_mismatch(w1.buf,w2.buf,(int)bytes)) < 0) {
+      window_advance(&w1,bytes);
+      window_advance(&w2,bytes);
+      continue;
+    }
+
+    window_advance(&w1,offset);
+    window_advance(&w2,offset);
+    window_fill(&w1,(0 == regions.count) ? &proginfo : NULL);
+    window_fill(&w2,NULL);
+
+    if (!find_realignment(&w1,&w2,range,(int)set1->files[0]->block_align,&d1,&d2)) {
+      if (0 == regions.count)
+        prog_error(&proginfo);
+      st_info("\n");
+      st_info("These %ss could not be realigned within %ld bytes of offsets %s and %s.\n",unit,range,
+              set_offset(set1,w1.pos + w1.skipped,pos1),set_offset(set2,w2.pos + w2.skipped,pos2));
+      lost = TRUE;
+      break;
+    }
 
-  discard_header(info);
+    report_region(&w1,&w2,d1,d2,&regions,&proginfo);
+
+    window_advance(&w1,d1);
+    window_advance(&w2,d2);
+  }
+
+  set_close(set1);
+  set_close(set2);
+
+  st_free(w1.buf);
+
+  if (0 == regions.count && !lost) {
+    prog_success(&proginfo);
+    st_info("\n");
+    st_info("%s of these %ss are identical",(0 == shift) ? "Contents" : "Aligned contents",unit);
+  }
+  else if (0 == regions.count) {
+    st_info("\n");
+    st_info("%s of these %ss differed, and could not be realigned",(0 == shift) ? "Contents" : "Aligned contents",unit);
+  }
+  else {
+    st_info("\n");
+    st_info("%s of these %ss differed in %d region%s: %lu bytes changed, %lu bytes only in %s 1, %lu bytes only in %s 2",
+            (0 == shift) ? "Contents" : "Aligned contents",unit,regions.count,(1 == regions.count) ? "" : "s",
+            regions.changed,regions.only1,unit,regions.only2,unit);
+    if (lost)
+      st_info(", before they could no longer be realigned");
+  }
+
+  if (!lost && w1.len + w1.remaining > 0)
+    st_info(" (%s 1 has %lu more bytes of WAVE data)",unit,w1.len + w1.remaining);
+  else if (!lost && w2.len + w2.remaining > 0)
+    st_info(" (%s 2 has %lu more bytes of WAVE data)",unit,w2.len + w2.remaining);
+  st_info(".\n");
+
+  return (0 == regions.count && !lost) ? TRUE : FALSE;
+}
+
+static bool compare_aligned(cmp_set *set1,cmp_set *set2,int shift)
+{
+  return (track) ? track_files(set1,set2,shift) : cmp_files(set1,set2,shift);
+}
+
+static void open_and_read_beginning(wave_info *info,unsigned char *buf,int bytes)
+{
+  if (!open_input_stream_range(info,0,(wlong)bytes))
+    st_error("could not reopen input file: [%s]",info->filename);
 
   if (read_n_bytes(info->input,buf,(int)bytes,NULL) != (int)bytes)
     st_error("error while reading %d bytes from file: [%s]",(int)bytes,info->filename);
@@ -291,27 +811,202 @@ static void open_and_read_beginning(wave_info *info,unsigned char *buf,int bytes
   close_input_stream(info);
 }
 
-static bool shift_comparison(wave_info *info1,wave_info *info2)
+/*
+ * finding a byte-shift by trying every offset in turn is quadratic in the length of the
+ * data being scanned.  instead, the second buffer is cut into sample-aligned blocks whose
+ * hashes go into a table, and a Rabin-Karp rolling hash over every offset of the first
+ * buffer looks each of its blocks up.  a hit means the block lines up at that shift, which
+ * makes the shift a candidate.  if a shift matches with at most fuzz differing bytes, then
+ * at least one of any fuzz+1 whole blocks in its window is identical, so only candidates
+ * need to be verified with memfuzzycmp() - except for shifts leaving too few usable blocks
+ * in the window, which are verified the old way.  blocks that repeat a lot, as silence
+ * does, are left out of the table so that they can't flood it with hits.
+ */
+
+typedef struct _shift_finder {
+  unsigned char *buf1;
+  unsigned char *buf2;
+  wlong bytes;
+  int block_size;
+  int num_blocks;
+  int *usable;        /* usable[j] = number of blocks before block j that went into the table */
+  unsigned char *candidate;  /* indexed by shift + bytes */
+} shift_finder;
+
+static bool find_candidate_shifts(shift_finder *sf,int block_align)
+{
+  unsigned long *hashes,h,out_factor;
+  int *table,*next,*repeats,table_size,mask,i,j,k;
+  wlong p;
+  bool success = FALSE;
+
+  sf->block_size = (block_align > 0) ? block_align * ((CMP_BLOCK_SIZE + block_align - 1) / block_align) : CMP_BLOCK_SIZE;
+  sf->num_blocks = (int)(sf->bytes / sf->block_size);
+
+  sf->usable = NULL;
+  sf->candidate = NULL;
+  hashes = NULL;
+  table = next = repeats = NULL;
+
+  for (table_size=1;table_size<2*sf->num_blocks;table_size<<=1)
+    ;
+  mask = table_size - 1;
+
+  if (NULL == (sf->usable = malloc((sf->num_blocks + 1) * sizeof(int))) ||
+      NULL == (sf->candidate = calloc(2 * sf->bytes + 1,sizeof(unsigned char))) ||
+      NULL == (hashes = malloc((sf->num_blocks + 1) * sizeof(unsigned long))) ||
+      NULL == (table = malloc(table_size * sizeof(int))) ||
+      NULL == (next = malloc((sf->num_blocks + 1) * sizeof(int))) ||
+      NULL == (repeats = calloc(sf->num_blocks + 1,sizeof(int))))
+    goto cleanup;
+
+  for (i=0;i<table_size;i++)
+    table[i] = -1;
+
+  /* count how often each block of the second buffer occurs */
+  for (j=0;j<sf->num_blocks;j++) {
+    hashes[j] = block_hash(sf->buf2 + (wlong)j * sf->block_size,sf->block_size);
+    for (k=table[hashes[j] & mask];k>=0;k=next[k])
+      if (hashes[k] == hashes[j])
+        break;
+    if (k >= 0) {
+      repeats[k]++;
+      repeats[j] = -1 - k;
+    }
+    else {
+      repeats[j] = 1;
+      next[j] = table[hashes[j] & mask];
+      table[hashes[j] & mask] = j;
+    }
+  }
+
+  /* rebuild the table with only the blocks that don't repeat too often */
+  for (i=0;i<table_size;i++)
+    table[i] = -1;
+
+  sf->usable[0] = 0;
+  for (j=0;j<sf->num_blocks;j++) {
+    k = (repeats[j] < 0) ? -1 - repeats[j] : j;
+    sf->usable[j+1] = sf->usable[j];
+    if (repeats[k] <= CMP_BLOCK_REPEATS) {
+      next[j] = table[hashes[j] & mask];
+      table[hashes[j] & mask] = j;
+      sf->usable[j+1]++;
+    }
+  }
+
+  if (sf->bytes < (wlong)sf->block_size) {
+    success = TRUE;
+    goto cleanup;
+  }
+
+  out_factor = 1;
+  for (i=0;i<sf->block_size;i++)
+    out_factor *= CMP_HASH_BASE;
+
+  /* roll over every offset of the first buffer, marking the shift at which each hit would line up */
+  h = block_hash(sf->buf1,sf->block_size);
+  for (p=0;;p++) {
+    for (j=table[h & mask];j>=0;j=next[j]) {
+      if (hashes[j] == h && !memcmp(sf->buf1 + p,sf->buf2 + (wlong)j * sf->block_size,sf->block_size))
+        sf->candidate[sf->bytes + p - (wlong)j * sf->block_size] = 1;
+    }
+    if (p + sf->block_size >= sf->bytes)
+      break;
+    h = h * CMP_HASH_BASE + sf->buf1[p + sf->block_size] - out_factor * sf->buf1[p];
+  }
+
+  success = TRUE;
+
+cleanup:
+  st_free(hashes);
+  st_free(table);
+  st_free(next);
+  st_free(repeats);
+
+  return success;
+}
+
+static bool shift_is_candidate(shift_finder *sf,int shift)
+{
+  wlong real_shift = (shift < 0) ? -shift : shift;
+  int first,last,usable;
+
+  /* whole blocks of the second buffer within the part it shares with the first one at this shift */
+  first = (shift < 0) ? (int)((real_shift + sf->block_size - 1) / sf->block_size) : 0;
+  last = (int)min((sf->bytes - ((shift > 0) ? real_shift : 0)) / sf->block_size,(wlong)sf->num_blocks);
+  usable = (last > first) ? sf->usable[last] - sf->usable[first] : 0;
+
+  if (usable <= fuzz)
+    return TRUE;
+
+  return (sf->candidate[sf->bytes + shift]) ? TRUE : FALSE;
+}
+
+static bool find_shift(unsigned char *buf1,unsigned char *buf2,wlong bytes,int block_align,int *shift)
+{
+  wlong last;
+  int i;
+  bool found_possible_shift = FALSE;
+  shift_finder sf;
+
+  sf.buf1 = buf1;
+  sf.buf2 = buf2;
+  sf.bytes = bytes;
+
+  if (!find_candidate_shifts(&sf,block_align))
+    st_error("could not allocate memory for byte-shift search");
+
+  last = (bytes >= CMP_MATCH_SIZE) ? bytes - CMP_MATCH_SIZE + 1 : 1;
+
+  for (i=0;(wlong)i<last;i++) {
+    if (shift_is_candidate(&sf,i) && -1 == memfuzzycmp(buf1 + i,buf2,bytes - i,fuzz)) {
+      *shift = i;
+      found_possible_shift = TRUE;
+      break;
+    }
+    if (shift_is_candidate(&sf,-i) && -1 == memfuzzycmp(buf1,buf2 + i,bytes - i,fuzz)) {
+      *shift = -i;
+      found_possible_shift = TRUE;
+      break;
+    }
+  }
+
+  st_free(sf.usable);
+  st_free(sf.candidate);
+
+  return found_possible_shift;
+}
+
+static void read_set_beginning(cmp_set *set,unsigned char *buf,wlong bytes)
+{
+  if (!set_read(set,buf,bytes,NULL))
+    st_error("error while reading %d bytes from file: [%s]",(int)bytes,set_filename(set));
+
+  set_close(set);
+}
+
+static bool shift_comparison(cmp_set *set1,cmp_set *set2)
 {
   unsigned char *buf1,*buf2;
   wlong bytes,cmp_size;
-  int i,shift = 0,real_shift = 0;
+  int shift = 0,real_shift = 0;
   bool found_possible_shift = FALSE;
   progress_info proginfo;
 
   proginfo.initialized = FALSE;
   proginfo.prefix = "Scanning";
   proginfo.clause = "and";
-  proginfo.filename1 = info1->filename;
+  proginfo.filename1 = set1->desc;
   proginfo.filedesc1 = NULL;
-  proginfo.filename2 = info2->filename;
+  proginfo.filename2 = set2->desc;
   proginfo.filedesc2 = NULL;
   proginfo.bytes_total = 1;
 
   prog_update(&proginfo);
 
-  cmp_size = shift_secs * info1->rate;
-  bytes = min(min(info1->data_size,info2->data_size),cmp_size);
+  cmp_size = shift_secs * set1->files[0]->rate;
+  bytes = min(min(set1->data_size,set2->data_size),cmp_size);
 
   if (NULL == (buf1 = malloc(2 * bytes * sizeof(unsigned char)))) {
     prog_error(&proginfo);
@@ -320,29 +1015,17 @@ static bool shift_comparison(wave_info *info1,wave_info *info2)
 
   buf2 = buf1 + bytes;
 
-  open_and_read_beginning(info1,buf1,bytes);
-  open_and_read_beginning(info2,buf2,bytes);
+  read_set_beginning(set1,buf1,bytes);
+  read_set_beginning(set2,buf2,bytes);
 
-  for (i=0;i<bytes-CMP_MATCH_SIZE+1;i++) {
-    if (-1 == memfuzzycmp(buf1 + i,buf2,bytes - i,fuzz)) {
-      shift = i;
-      real_shift = i;
-      found_possible_shift = TRUE;
-      break;
-    }
-    if (-1 == memfuzzycmp(buf1,buf2 + i,bytes - i,fuzz)) {
-      shift = -i;
-      real_shift = i;
-      found_possible_shift = TRUE;
-      break;
-    }
-  }
+  found_possible_shift = find_shift(buf1,buf2,bytes,(int)set1->files[0]->block_align,&shift);
+  real_shift = (shift < 0) ? -shift : shift;
 
   st_free(buf1);
 
   if (!found_possible_shift) {
     prog_error(&proginfo);
-    st_error("these files do not share identical data within the first %ld bytes.",cmp_size);
+    st_error("these %ss do not share identical data within the first %ld bytes.",unit,cmp_size);
   }
 
   prog_success(&proginfo);
@@ -350,17 +1033,17 @@ static bool shift_comparison(wave_info *info1,wave_info *info2)
   st_info("\n");
 
   if (fuzz > 0)
-    st_info("With fuzz factor %d, file",fuzz);
+    st_info("With fuzz factor %d, %s",fuzz,unit);
   else
-    st_info("File");
+    st_info("%s",unit_title);
 
   if (0 == shift) {
     st_info("s are identical so far.\n");
   }
   else {
-    st_info(" the %s file seems to have ",(0 < shift) ? "first" : "second");
+    st_info(" the %s %s seems to have ",(0 < shift) ? "first" : "second",unit);
     st_info("%d extra bytes (%d extra samples",real_shift,(real_shift + 2)/4);
-    if (!PROB_NOT_CD(info1) && !PROB_NOT_CD(info2))
+    if (!PROB_NOT_CD(set1->files[0]) && !PROB_NOT_CD(set2->files[0]))
       st_info(", or %d extra sectors",(real_shift+(CD_BLOCK_SIZE/2))/CD_BLOCK_SIZE);
     st_info(")\n");
     st_info("\n");
@@ -371,32 +1054,242 @@ static bool shift_comparison(wave_info *info1,wave_info *info2)
   st_info("Preparing to do a full comparison...\n");
   st_info("\n");
 
-  return cmp_files(info1,info2,shift);
+  return compare_aligned(set1,set2,shift);
+}
+
+static bool straight_comparison(cmp_set *set1,cmp_set *set2)
+{
+  return compare_aligned(set1,set2,0);
+}
+
+/*
+ * comparing one reference file against several others decodes the reference only once.
+ * all files are opened together, and each block of the reference is compared with the
+ * matching block of every other file still in the running, taking their byte-shifts
+ * into account.  the reference's beginning is likewise only read once to find the shifts.
+ */
+
+typedef struct _cmp_candidate {
+  wave_info *info;
+  int shift;
+  bool usable;
+  wlong start;       /* offset within the reference's data where this file's data begins */
+  wlong remaining;   /* bytes of this file's data not compared yet */
+  wlong compared;
+  wlong differing;
+  wlong first_diff;  /* 1-based offset within this file's data of the first difference, or 0 */
+} cmp_candidate;
+
+static void find_candidate_shift(wave_info *ref,unsigned char *refbuf,wlong refbytes,cmp_candidate *cand,unsigned char *buf)
+{
+  wlong bytes;
+  progress_info proginfo;
+
+  proginfo.initialized = FALSE;
+  proginfo.prefix = "Scanning";
+  proginfo.clause = "and";
+  proginfo.filename1 = ref->filename;
+  proginfo.filedesc1 = NULL;
+  proginfo.filename2 = cand->info->filename;
+  proginfo.filedesc2 = NULL;
+  proginfo.bytes_total = 1;
+
+  prog_update(&proginfo);
+
+  bytes = min(refbytes,cand->info->data_size);
+
+  open_and_read_beginning(cand->info,buf,(int)bytes);
+
+  if (!find_shift(refbuf,buf,bytes,(int)ref->block_align,&cand->shift)) {
+    prog_error(&proginfo);
+    st_warning("these files do not share identical data within the first %ld bytes -- skipping file: [%s]",bytes,cand->info->filename);
+    cand->usable = FALSE;
+    return;
+  }
+
+  prog_success(&proginfo);
+}
+
+static bool multi_comparison(wave_info **infos,int numfiles)
+{
+  cmp_candidate *cands;
+  unsigned char *refbuf,*buf;
+  char desc[FILENAME_SIZE],shiftstr[32],diffstr[32];
+  wlong bufsize,refbytes,pos,bytes,from,len;
+  int i,n,first,count,active,identical = 0;
+  progress_info proginfo;
+
+  n = numfiles - 1;
+
+  if (NULL == (cands = calloc(n,sizeof(cmp_candidate))))
+    st_error("could not allocate memory for file comparison array");
+
+  bufsize = max(XFER_SIZE,(shift_secs * infos[0]->rate));
+
+  if (NULL == (refbuf = malloc(2 * bufsize * sizeof(unsigned char))))
+    st_error("could not allocate %d-byte comparison buffer",bufsize);
+
+  buf = refbuf + bufsize;
+
+  for (i=0;i<n;i++) {
+    cands[i].info = infos[i+1];
+    cands[i].usable = check_headers(infos[0],cands[i].info,FALSE);
+  }
+
+  if (align) {
+    refbytes = min(infos[0]->data_size,shift_secs * infos[0]->rate);
+    open_and_read_beginning(infos[0],refbuf,(int)refbytes);
+    for (i=0;i<n;i++)
+      if (cands[i].usable)
+        find_candidate_shift(infos[0],refbuf,refbytes,&cands[i],buf);
+    st_info("\n");
+  }
+
+  st_snprintf(desc,FILENAME_SIZE,"%d other files",n);
+
+  proginfo.initialized = FALSE;
+  proginfo.prefix = "Comparing";
+  proginfo.clause = "and";
+  proginfo.filename1 = infos[0]->filename;
+  proginfo.filedesc1 = infos[0]->m_ss;
+  proginfo.filename2 = desc;
+  proginfo.filedesc2 = NULL;
+  proginfo.bytes_total = infos[0]->data_size;
+
+  prog_update(&proginfo);
+
+  open_file(infos[0]);
+  discard_header(infos[0]);
+
+  active = 0;
+  for (i=0;i<n;i++) {
+    if (!cands[i].usable)
+      continue;
+
+    /* a negative shift means this file has extra data at the beginning, which is skipped */
+    if (!open_input_stream_range(cands[i].info,(cands[i].shift < 0) ? -cands[i].shift : 0,cands[i].info->data_size)) {
+      prog_error(&proginfo);
+      st_error("error while shifting %d bytes from file: [%s]",-cands[i].shift,cands[i].info->filename);
+    }
+
+    cands[i].start = (cands[i].shift > 0) ? cands[i].shift : 0;
+    cands[i].remaining = cands[i].info->data_size - ((cands[i].shift < 0) ? -cands[i].shift : 0);
+
+    pipeline_read_ahead(cands[i].info->input,cands[i].remaining);
+
+    active++;
+  }
+
+  pipeline_read_ahead(infos[0]->input,infos[0]->data_size);
+
+  for (pos=0;pos<infos[0]->data_size && active>0;pos+=bytes) {
+    bytes = min(infos[0]->data_size - pos,XFER_SIZE);
+
+    if (read_n_bytes(infos[0]->input,refbuf,(int)bytes,&proginfo) != (int)bytes) {
+      prog_error(&proginfo);
+      st_error("error while reading %d bytes from file: [%s]",(int)bytes,infos[0]->filename);
+    }
+
+    for (i=0;i<n;i++) {
+      if (!cands[i].usable || 0 == cands[i].remaining)
+        continue;
+
+      from = max(pos,cands[i].start);
+      if (from >= pos + bytes)
+        continue;
+
+      len = min(pos + bytes - from,cands[i].remaining);
+
+      if (read_n_bytes(cands[i].info->input,buf,(int)len,NULL) != (int)len) {
+        prog_error(&proginfo);
+        st_error("error while reading %d bytes from file: [%s]",(int)len,cands[i].info->filename);
+      }
+
+      if ((count = vec_count_mismatches(refbuf + (from - pos),buf,(int)len,(int)len,&first)) > 0) {
+        cands[i].differing += count;
+        if (0 == cands[i].first_diff)
+          cands[i].first_diff = cands[i].compared + ((cands[i].shift < 0) ? -cands[i].shift : 0) + first + 1;
+      }
+
+      cands[i].compared += len;
+      cands[i].remaining -= len;
+
+      if (0 == cands[i].remaining)
+        active--;
+    }
+  }
+
+  close_input_stream(infos[0]);
+  for (i=0;i<n;i++)
+    if (cands[i].usable)
+      close_input_stream(cands[i].info);
+
+  prog_success(&proginfo);
+
+  st_info("\n");
+  st_info("      shift     compared    differing  first diff  file\n");
+  st_info("   ---------------------------------------------------------------\n");
+
+  for (i=0;i<n;i++) {
+    if (!cands[i].usable) {
+      st_info("%11s %12s %12s %11s  %s\n","-","-","-","-",cands[i].info->filename);
+      continue;
+    }
+
+    st_snprintf(shiftstr,32,"%d",cands[i].shift);
+    if (cands[i].first_diff)
+      st_snprintf(diffstr,32,"%lu",cands[i].first_diff);
+    else
+      strcpy(diffstr,"-");
+
+    st_info("%11s %12lu %12lu %11s  %s\n",shiftstr,cands[i].compared,cands[i].differing,diffstr,cands[i].info->filename);
+
+    if (0 == cands[i].differing && cands[i].compared > 0)
+      identical++;
+  }
+
+  st_info("\n");
+  st_info("%d of %d files have WAVE data identical to that of [%s]",identical,n,infos[0]->filename);
+  if (align)
+    st_info(", modulo a byte-shift");
+  st_info(" (up to the smaller size of each pair).\n");
+
+  st_free(refbuf);
+  st_free(cands);
+
+  return (identical == n) ? TRUE : FALSE;
 }
 
-static bool straight_comparison(wave_info *info1,wave_info *info2)
+static bool compare_sets(wave_info **infos,int numfiles1,int numfiles2)
 {
-  return cmp_files(info1,info2,0);
+  cmp_set set1,set2;
+
+  set_init(&set1,infos,numfiles1);
+  set_init(&set2,infos + numfiles1,numfiles2);
+
+  show_sets(&set1,&set2);
+
+  if (align)
+    return shift_comparison(&set1,&set2);
+
+  return straight_comparison(&set1,&set2);
 }
 
 static bool process_files(char *filename1,char *filename2)
 {
-  wave_info *info1,*info2;
+  wave_info *infos[2];
   bool success;
 
-  if (NULL == (info1 = new_wave_info(filename1)))
+  if (NULL == (infos[0] = new_wave_info(filename1)))
     return FALSE;
 
-  if (NULL == (info2 = new_wave_info(filename2)))
+  if (NULL == (infos[1] = new_wave_info(filename2)))
     return FALSE;
 
-  if (align)
-    success = shift_comparison(info1,info2);
-  else
-    success = straight_comparison(info1,info2);
+  success = compare_sets(infos,1,1);
 
-  st_free(info1);
-  st_free(info2);
+  st_free(infos[0]);
+  st_free(infos[1]);
 
   return success;
 }
@@ -404,17 +1297,53 @@ static bool process_files(char *filename1,char *filename2)
 static bool process(int argc,char **argv,int start)
 {
   char *filename1,*filename2;
+  wave_info **infos;
+  int i,numfiles;
   bool success;
 
   success = FALSE;
 
   input_init(start,argc,argv);
+  input_read_all_files();
+  numfiles = input_get_file_count();
+
+  if (numfiles < 2)
+    st_error("need two or more files to process");
+
+  if (set_size >= numfiles)
+    st_error("need at least one more file than the %d in the first set",set_size);
 
-  if (!(filename1 = input_get_filename()) || !(filename2 = input_get_filename())) {
-    st_error("need exactly two files to process");
+  if (2 == numfiles && 0 == set_size) {
+    filename1 = input_get_filename();
+    filename2 = input_get_filename();
+    return process_files(filename1,filename2);
   }
 
-  success = process_files(filename1,filename2);
+  /* with more than two files, the first one is compared against each of the others, unless they form two sets */
+  if (0 == set_size && (track || list))
+    st_error("differing regions and bytes can only be listed when comparing two files or two sets of files");
+
+  if (NULL == (infos = malloc(numfiles * sizeof(wave_info *))))
+    st_error("could not allocate memory for file info array");
+
+  for (i=0;i<numfiles;i++) {
+    filename1 = input_get_filename();
+    if (NULL == (infos[i] = new_wave_info(filename1)))
+      st_error("could not open file: [%s]",filename1);
+  }
+
+  if (set_size > 0) {
+    unit = "set";
+    unit_title = "Set";
+    success = compare_sets(infos,set_size,numfiles - set_size);
+  }
+  else
+    success = multi_comparison(infos,numfiles);
+
+  for (i=0;i<numfiles;i++)
+    st_free(infos[i]);
+
+  st_free(infos);
 
   return success;
 }
@@ -29,6 +29,7 @@ mode_module mode_conv = {
   "Converts files from one format to another",
   CVSIDSTR,
   TRUE,
+  TRUE,
   conv_main,
   conv_help
 };
@@ -63,17 +64,40 @@ static void parse(int argc,char **argv,int *first_arg)
   *first_arg = optind;
 }
 
+static int get_output_formats(format_module **formats)
+/* fills out the formats to convert each file to, and returns how many there are */
+{
+  int i;
+
+  if (st_ops.num_output_formats <= 1) {
+    formats[0] = st_ops.output_format;
+    return 1;
+  }
+
+  for (i=0;i<st_ops.num_output_formats;i++)
+    formats[i] = st_ops.output_formats[i];
+
+  return st_ops.num_output_formats;
+}
+
 static bool conv_file(wave_info *info)
 {
-  int bytes;
-  proc_info output_proc;
-  FILE *output = NULL;
-  char outfilename[FILENAME_SIZE];
+  int bytes,nout,i,j;
+  format_module *formats[MAX_OUTPUT_FORMATS];
+  proc_info output_proc[MAX_OUTPUT_FORMATS];
+  FILE *output[MAX_OUTPUT_FORMATS];
+  char outfilename[MAX_OUTPUT_FORMATS][FILENAME_SIZE],others[BUF_SIZE];
   unsigned char *header = NULL,nullpad[BUF_SIZE];
   bool success;
   progress_info proginfo;
 
-  create_output_filename(info->filename,info->input_format->extension,outfilename);
+  /* the file is decoded once, and its data sent to an encoder for each output format */
+  nout = get_output_formats(formats);
+
+  for (i=0;i<nout;i++) {
+    output[i] = NULL;
+    create_output_filename_fmt(formats[i],info->filename,info->input_format->extension,outfilename[i]);
+  }
 
   success = FALSE;
 
@@ -82,16 +106,31 @@ static bool conv_file(wave_info *info)
   proginfo.clause = "-->";
   proginfo.filename1 = info->filename;
   proginfo.filedesc1 = info->m_ss;
-  proginfo.filename2 = outfilename;
+  proginfo.filename2 = outfilename[0];
   proginfo.filedesc2 = NULL;
   proginfo.bytes_total = info->total_size;
 
+  if (nout > 1) {
+    st_snprintf(others,BUF_SIZE,"+ %d more",nout - 1);
+    proginfo.filedesc2 = others;
+  }
+
   prog_update(&proginfo);
 
-  if (files_are_identical(info->filename,outfilename)) {
-    prog_error(&proginfo);
-    st_warning("output file would overwrite input file -- skipping.");
-    return FALSE;
+  for (i=0;i<nout;i++) {
+    if (files_are_identical(info->filename,outfilename[i])) {
+      prog_error(&proginfo);
+      st_warning("output file would overwrite input file -- skipping.");
+      return FALSE;
+    }
+
+    for (j=0;j<i;j++) {
+      if (!strcmp(outfilename[i],outfilename[j])) {
+        prog_error(&proginfo);
+        st_warning("output formats [%s] and [%s] would both write file: [%s] -- skipping.",formats[j]->name,formats[i]->name,outfilename[i]);
+        return FALSE;
+      }
+    }
   }
 
   if (!open_input_stream(info)) {
@@ -100,10 +139,12 @@ static bool conv_file(wave_info *info)
     return FALSE;
   }
 
-  if (NULL == (output = open_output_stream(outfilename,&output_proc))) {
-    prog_error(&proginfo);
-    st_warning("could not open output file -- skipping.");
-    goto cleanup;
+  for (i=0;i<nout;i++) {
+    if (NULL == (output[i] = open_output_stream_fmt(formats[i],outfilename[i],&output_proc[i]))) {
+      prog_error(&proginfo);
+      st_warning("could not open output file: [%s] -- skipping.",outfilename[i]);
+      goto cleanup;
+    }
   }
 
   if (NULL == (header = malloc(info->header_size * sizeof(unsigned char)))) {
@@ -124,13 +165,15 @@ static bool conv_file(wave_info *info)
     goto cleanup;
   }
 
-  if ((info->header_size > 0) && write_n_bytes(output,header,info->header_size,&proginfo) != info->header_size) {
-    prog_error(&proginfo);
-    st_warning("error while writing %d-byte WAVE header -- skipping.",info->header_size);
-    goto cleanup;
+  for (i=0;i<nout;i++) {
+    if ((info->header_size > 0) && write_n_bytes(output[i],header,info->header_size,(0 == i) ? &proginfo : NULL) != info->header_size) {
+      prog_error(&proginfo);
+      st_warning("error while writing %d-byte WAVE header -- skipping.",info->header_size);
+      goto cleanup;
+    }
   }
 
-  if ((info->data_size > 0) && (transfer_n_bytes(info->input,output,info->data_size,&proginfo) != info->data_size)) {
+  if ((info->data_size > 0) && (transfer_n_bytes_multi(info->input,output,nout,info->data_size,&proginfo) != info->data_size)) {
     prog_error(&proginfo);
     st_warning("error while transferring %lu-byte data chunk -- skipping.",info->data_size);
     goto cleanup;
@@ -152,24 +195,20 @@ static bool conv_file(wave_info *info)
     }
 
     if (1 == bytes) {
-      if (0 == nullpad[0]) {
-        if (write_n_bytes(output,nullpad,1,&proginfo) != 1) {
+      for (i=0;i<nout;i++) {
+        if (write_n_bytes(output[i],nullpad,1,(0 == i) ? &proginfo : NULL) != 1) {
           prog_error(&proginfo);
-          st_warning("error while writing NULL pad byte -- skipping.");
-          goto cleanup;
-        }
-      }
-      else {
-        if (write_n_bytes(output,nullpad,1,&proginfo) != 1) {
-          prog_error(&proginfo);
-          st_warning("error while writing initial extra byte -- skipping.");
+          if (0 == nullpad[0])
+            st_warning("error while writing NULL pad byte -- skipping.");
+          else
+            st_warning("error while writing initial extra byte -- skipping.");
           goto cleanup;
         }
       }
     }
   }
 
-  if (PROB_EXTRA_CHUNKS(info) && (transfer_n_bytes(info->input,output,info->extra_riff_size,&proginfo) != info->extra_riff_size)) {
+  if (PROB_EXTRA_CHUNKS(info) && (transfer_n_bytes_multi(info->input,output,nout,info->extra_riff_size,&proginfo) != info->extra_riff_size)) {
     st_warning("error while transferring %lu extra bytes -- skipping.",info->extra_riff_size);
     goto cleanup;
   }
@@ -181,9 +220,17 @@ static bool conv_file(wave_info *info)
 cleanup:
   st_free(header);
 
-  if ((output) && ((CLOSE_CHILD_ERROR_OUTPUT == close_output(output,output_proc)) || !success)) {
-    success = FALSE;
-    remove_file(outfilename);
+  /* every encoder has to be reaped - if any of them failed, none of the outputs are kept */
+  for (i=0;i<nout;i++) {
+    if ((output[i]) && (CLOSE_CHILD_ERROR_OUTPUT == close_output(output[i],output_proc[i])))
+      success = FALSE;
+  }
+
+  if (!success) {
+    for (i=0;i<nout;i++) {
+      if (output[i])
+        remove_file(outfilename[i]);
+    }
   }
 
   close_input_stream(info);
@@ -266,20 +313,15 @@ static bool process_file(char *filename)
 
 static bool process(int argc,char **argv,int start)
 {
-  char *filename;
   bool success;
 
-  success = TRUE;
-
   if (read_from_terminal) {
     return conv_terminal();
   }
 
   input_init(start,argc,argv);
 
-  while ((filename = input_get_filename())) {
-    success = (process_file(filename) && success);
-  }
+  success = process_input_files(process_file,NULL);
 
   return success;
 }
@@ -30,6 +30,7 @@ mode_module mode_cue = {
   "Generates a CUE sheet or split points from a set of files",
   CVSIDSTR,
   FALSE,
+  FALSE,
   cue_main,
   cue_help
 };
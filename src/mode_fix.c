@@ -29,6 +29,7 @@ mode_module mode_fix = {
   "Fixes sector-boundary problems with CD-quality PCM WAVE data",
   CVSIDSTR,
   TRUE,
+  FALSE,
   fix_main,
   fix_help
 };
@@ -240,11 +241,16 @@ static bool open_this_file(int i,char *outfilename,progress_info *proginfo)
   proginfo->filedesc1 = files[i]->m_ss;
   proginfo->filename2 = outfilename;
 
+  /* make room for this file's encoder */
+  reap_outputs_behind(output_encoders() - 1);
+
   if (NULL == (files[i]->output = open_output_stream(outfilename,&files[i]->output_proc))) {
     prog_error(proginfo);
     st_error("could not open output file: [%s]",outfilename);
   }
 
+  queue_output_stream(files[i]->output,&files[i]->output_proc);
+
   make_canonical_header(header,files[i]);
 
   if ((numfiles - 1 == i) && pad)
@@ -351,7 +357,7 @@ static bool write_fixed_files()
         }
       }
 
-      close_output_stream(files[cur_output]);
+      close_output_behind(files[cur_output]->output,&files[cur_output]->output_proc);
       files[cur_output]->output = NULL;
       cur_output++;
       if (cur_output < numfiles) {
@@ -363,11 +369,14 @@ static bool write_fixed_files()
     }
   }
 
+  reap_outputs_behind(0);
+
   success = TRUE;
 
 cleanup:
   if (!success) {
     close_output_stream(files[cur_output]);
+    reap_outputs_behind(0);
     remove_file(outfilename);
     st_error("failed to fix files");
   }
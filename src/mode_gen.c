@@ -30,6 +30,7 @@ mode_module mode_gen = {
   "Generates CD-quality PCM WAVE data files containing silence",
   CVSIDSTR,
   TRUE,
+  FALSE,
   gen_main,
   gen_help
 };
@@ -23,7 +23,19 @@
 #endif
 
 #include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include "mode.h"
+#if !defined(WIN32) && defined(HAVE_PTHREAD_CREATE) && defined(HAVE_SEM_INIT)
+#include <pthread.h>
+#include <semaphore.h>
+#endif
+#if defined(HAVE_SYS_XATTR_H) && defined(HAVE_GETXATTR) && defined(HAVE_SETXATTR)
+#include <sys/xattr.h>
+#endif
 
 CVSID("$Id: mode_hash.c,v 1.93 2009/03/17 17:23:05 jason Exp $")
 
@@ -33,30 +45,77 @@ static void hash_help(void);
 mode_module mode_hash = {
   "hash",
   "shnhash",
-  "Computes the MD5 or SHA1 fingerprint of PCM WAVE data",
+  "Computes fingerprints of PCM WAVE data",
   CVSIDSTR,
   FALSE,
+  TRUE,
   hash_main,
   hash_help
 };
 
-enum {
-  HASH_MD5,
-  HASH_SHA1
-};
-
 #define COMPOSITE "composite"
 
+/* most fingerprint algorithms that can be computed in one pass */
+#define MAX_HASHES 8
+
+/* largest fingerprint size, in bytes */
+#define MAX_DIGEST_SIZE 64
+
+/* run several algorithms over the same data in worker threads */
+#if !defined(WIN32) && defined(HAVE_PTHREAD_CREATE) && defined(HAVE_SEM_INIT)
+#define THREADED_HASHING
+#endif
+
+/* keep fingerprints in extended attributes of the files, named with this prefix */
+#define XATTR_PREFIX "user.shntool."
+
+#if defined(HAVE_SYS_XATTR_H) && defined(HAVE_GETXATTR) && defined(HAVE_SETXATTR)
+#define XATTR_HASHES
+#ifdef __APPLE__
+#define XATTR_GET(f,n,v,s) getxattr(f,n,v,s,0,0)
+#define XATTR_SET(f,n,v,s) setxattr(f,n,v,s,0,0)
+#else
+#define XATTR_GET(f,n,v,s) getxattr(f,n,v,s)
+#define XATTR_SET(f,n,v,s) setxattr(f,n,v,s,0)
+#endif
+#endif
+
+/* a fingerprint algorithm, as seen by the code that feeds it WAVE data */
+typedef struct _hash_module {
+  char *name;                                   /* name of the algorithm on the command line */
+  int digest_size;                              /* size of the fingerprint, in bytes */
+  void *ctx;                                    /* computation context */
+  void (*init_ctx)(void *);                     /* starts a new computation */
+  void (*process_block)(const void *,size_t,void *);  /* processes data in multiples of 64 bytes */
+  void (*process_bytes)(const void *,size_t,void *);  /* processes data of any length */
+  void (*finish_ctx)(void *,void *);            /* finishes the computation, storing the fingerprint */
+
+  /* optional functions */
+  bool (*process_fd)(int,off_t,wlong,progress_info *,void *);  /* reads and processes data straight from a file */
+  void (*cleanup)(void *);                      /* releases anything held on to between computations */
+  size_t ctx_size;                              /* size of a context, for process_lanes */
+  void (*process_lanes)(void **,const unsigned char **,int,int);  /* processes the same number of blocks for several contexts at once */
+} hash_module;
+
 static unsigned long maxbytes;
-static unsigned char audio_hash[32];
+static unsigned char audio_hash[MAX_HASHES][MAX_DIGEST_SIZE];
 
 static bool composite_hash = FALSE;
+static bool verify_embedded = FALSE;
+static char *stored_list = NULL;
+static bool stored_xattr = FALSE;
+static bool verify_stored = FALSE;
+static double sample_percent = 0.0;
+static unsigned long sample_seed;
 static int remaining_bytes = 0;
 static int num_processed = 0;
 static int numfiles;
-static int hash_algorithm = HASH_MD5;
 static progress_info proginfo;
 
+/* algorithms chosen on the command line, in the order their fingerprints are printed */
+static hash_module *hashes[MAX_HASHES];
+static int num_hashes = 0;
+
 static wave_info **files;
 
 /* shntool: modified GNU coreutils 5.93 md5/sha1 routines below */
@@ -118,7 +177,10 @@ static wave_info **files;
    64-byte boundary.  (RFC 1321, 3.1: Step 1)  */
 static const unsigned char fillbuf[64] = { 0x80, 0 /* , 0, 0, ...  */ };
 
-char global_buffer[BLOCKSIZE + 72];
+/* shntool: data is read and hashed HASH_BUFFER_SIZE bytes at a time, a multiple of BLOCKSIZE */
+#define HASH_BUFFER_SIZE (16 * BLOCKSIZE)
+
+char global_buffer[HASH_BUFFER_SIZE + 72];
 /* shntool: end common md5/sha1 definitions */
 
 /* shntool: global md5 context */
@@ -185,101 +247,7 @@ md5_finish_ctx (struct md5_ctx *ctx, void *resbuf)
   return md5_read_ctx (ctx, resbuf);
 }
 
-/* Compute MD5 message digest for bytes read from STREAM.  The
-   resulting message digest number will be written into the 16 bytes
-   beginning at RESBLOCK.  */
-int
-md5_stream (FILE *stream, void *resblock)
-{
-  size_t sum;
-  unsigned long totalbytes = 0;  /* shntool */
-
-  /* shntool: */
-  if (0 == maxbytes)
-    return 0;
-
-  /* Initialize the computation context.  */
-  /* shntool: now done outside of this function */
-/*
-  md5_init_ctx (&md5_global_ctx);
-*/
-
-  /* Iterate over full file contents.  */
-  /* shntool: stop after WAVE data is read */
-  while (1)
-    {
-      /* We read the file in blocks of BLOCKSIZE bytes.  One call of the
-	 computation function processes the whole buffer so that with the
-	 next round of the loop another block can be read.  */
-      size_t n;
-      sum = 0;
-
-      /* Read block.  Take care for partial reads.  */
-
-      while (1)
-	{
-	  n = read_n_bytes(stream, (unsigned char *)(global_buffer + sum), BLOCKSIZE - sum, &proginfo);
-
-	  sum += n;
-      totalbytes += n;  /* shntool */
-
-      /* shntool: if total bytes read exceeded the WAVE data size, discard the rest and adjust sum */
-      if (totalbytes > maxbytes) {
-        sum -= (totalbytes - maxbytes);
-        totalbytes = maxbytes;
-      }
-
-	  if (sum == BLOCKSIZE)
-	    break;
-
-	  if (n == 0)
-	    {
-	      /* Check for the error flag IFF N == 0, so that we don't
-		 exit the loop after a partial read due to e.g., EAGAIN
-		 or EWOULDBLOCK.  */
-	      if (ferror (stream))
-		return 1;
-	      goto md5_process_partial_block;
-	    }
-
-	  /* We've read at least one byte, so ignore errors.  But always
-	     check for EOF, since feof may be true even though N > 0.
-	     Otherwise, we could end up calling fread after EOF.  */
-	  if (feof (stream))
-	    goto md5_process_partial_block;
-	}
-
-      /* Process buffer with BLOCKSIZE bytes.  Note that
-			BLOCKSIZE % 64 == 0
-       */
-      md5_process_block (global_buffer, BLOCKSIZE, &md5_global_ctx);
-    }
-
- md5_process_partial_block:;
-
-  /* Process any remaining bytes.  */
-  /* shntool: now done outside this function */
-/*
-  if (sum > 0)
-    md5_process_bytes (global_buffer, sum, &md5_global_ctx);
-*/
-
-  /* shntool: keep track of partial blocks */
-  remaining_bytes = sum;
-
-  /* Construct result in desired memory.  */
-  /* shntool: now done outside this function */
-/*
-  md5_finish_ctx (&md5_global_ctx, resblock);
-*/
-
-  /* shntool: use custom return code */
-/*
-  return 0;
-*/
-
-  return (totalbytes == maxbytes) ? 0 : 2;
-}
+/* shntool: md5_stream() removed - hash_stream() below reads the WAVE data for all active algorithms */
 
 /* Compute MD5 message digest for LEN bytes beginning at BUFFER.  The
    result is always in little endian byte order, so that a byte-wise
@@ -639,100 +607,7 @@ sha1_finish_ctx (struct sha1_ctx *ctx, void *resbuf)
   return sha1_read_ctx (ctx, resbuf);
 }
 
-/* Compute SHA1 message digest for bytes read from STREAM.  The
-   resulting message digest number will be written into the 16 bytes
-   beginning at RESBLOCK.  */
-int
-sha1_stream (FILE *stream, void *resblock)
-{
-  size_t sum;
-  unsigned long totalbytes = 0;  /* shntool */
-
-  /* shntool: */
-  if (0 == maxbytes)
-    return 0;
-
-  /* Initialize the computation context.  */
-  /* shntool: now done outside of this function */
-/*
-  sha1_init_ctx (&sha1_global_ctx);
-*/
-
-  /* Iterate over full file contents.  */
-  /* shntool: stop after WAVE data is read */
-  while (1)
-    {
-      /* We read the file in blocks of BLOCKSIZE bytes.  One call of the
-	 computation function processes the whole buffer so that with the
-	 next round of the loop another block can be read.  */
-      size_t n;
-      sum = 0;
-
-      /* Read block.  Take care for partial reads.  */
-      while (1)
-	{
-	  n = read_n_bytes(stream, (unsigned char *)(global_buffer + sum), BLOCKSIZE - sum, &proginfo);
-
-	  sum += n;
-      totalbytes += n;  /* shntool */
-
-      /* shntool: if total bytes read exceeded the WAVE data size, discard the rest and adjust sum */
-      if (totalbytes > maxbytes) {
-        sum -= (totalbytes - maxbytes);
-        totalbytes = maxbytes;
-      }
-
-	  if (sum == BLOCKSIZE)
-	    break;
-
-	  if (n == 0)
-	    {
-	      /* Check for the error flag IFF N == 0, so that we don't
-		 exit the loop after a partial read due to e.g., EAGAIN
-		 or EWOULDBLOCK.  */
-	      if (ferror (stream))
-		return 1;
-	      goto sha1_process_partial_block;
-	    }
-
-	  /* We've read at least one byte, so ignore errors.  But always
-	     check for EOF, since feof may be true even though N > 0.
-	     Otherwise, we could end up calling fread after EOF.  */
-	  if (feof (stream))
-	    goto sha1_process_partial_block;
-	}
-
-      /* Process buffer with BLOCKSIZE bytes.  Note that
-			BLOCKSIZE % 64 == 0
-       */
-      sha1_process_block (global_buffer, BLOCKSIZE, &sha1_global_ctx);
-    }
-
- sha1_process_partial_block:;
-
-  /* Process any remaining bytes.  */
-  /* shntool: now done outside this function */
-/*
-  if (sum > 0)
-    sha1_process_bytes (global_buffer, sum, &sha1_global_ctx);
-*/
-
-  /* shntool: keep track of partial blocks */
-  remaining_bytes = sum;
-
-  /* Construct result in desired memory.  */
-  /* shntool: now done outside this function */
-/*
-  sha1_finish_ctx (&sha1_global_ctx, resblock);
-*/
-
-  /* shntool: use custom return code */
-/*
-  return 0;
-*/
-
-  return (totalbytes == maxbytes) ? 0 : 2;
-}
+/* shntool: sha1_stream() removed - hash_stream() below reads the WAVE data for all active algorithms */
 
 /* Compute MD5 message digest for LEN bytes beginning at BUFFER.  The
    result is always in little endian byte order, so that a byte-wise
@@ -969,183 +844,2092 @@ sha1_process_block (const void *buffer, size_t len, struct sha1_ctx *ctx)
     }
 }
 
-/* shntool-specific stuff starts here */
+/* sha256.c - Functions to compute SHA256 message digest of files or
+   memory blocks according to the NIST specification FIPS-180-2.
 
-static void hash_help()
-{
-  st_info("Usage: %s [OPTIONS] [files]\n",st_progname());
-  st_info("\n");
-  st_info("Mode-specific options:\n");
-  st_info("\n");
-  st_info("  -c      generate composite fingerprint from input files\n");
-  st_info("  -h      show this help screen\n");
-  st_info("  -m      generate MD5 fingerprints (default)\n");
-  st_info("  -s      generate SHA1 fingerprints\n");
-  st_info("\n");
-}
+   Copyright (C) 2005 Free Software Foundation, Inc.
 
-static void parse(int argc,char **argv,int *first_arg)
-{
-  int c;
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; either version 2, or (at your option) any
+   later version.
 
-  while ((c = st_getopt(argc,argv,"cms")) != -1) {
-    switch (c) {
-      case 'c':
-        composite_hash = TRUE;
-        break;
-      case 'm':
-        hash_algorithm = HASH_MD5;
-        break;
-      case 's':
-        hash_algorithm = HASH_SHA1;
-        break;
-    }
-  }
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
 
-  *first_arg = optind;
-}
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.  */
 
-void hash_init_ctx()
-{
-  switch (hash_algorithm) {
-    case HASH_MD5:
-      md5_init_ctx(&md5_global_ctx);
-      break;
-    case HASH_SHA1:
-      sha1_init_ctx(&sha1_global_ctx);
-      break;
-  }
-}
+/* Written by David Madore, considerably copypasting from
+   Scott G. Miller's sha1.c
+*/
 
-int hash_stream(FILE *stream)
-{
-  switch (hash_algorithm) {
-    case HASH_MD5:
-      return md5_stream(stream,audio_hash);
-      break;
-    case HASH_SHA1:
-      return sha1_stream(stream,audio_hash);
-      break;
-  }
+#include "sha256.h"
 
-  return 3;
-}
+/* shntool: global sha256 context */
+struct sha256_ctx sha256_global_ctx;
 
-void hash_process_bytes()
-{
-  switch (hash_algorithm) {
-    case HASH_MD5:
-      md5_process_bytes(global_buffer,remaining_bytes,&md5_global_ctx);
-      break;
-    case HASH_SHA1:
-      sha1_process_bytes(global_buffer,remaining_bytes,&sha1_global_ctx);
-      break;
-  }
-}
+/* shntool: SHA256 is big endian, like SHA1, so it uses the same swapping macro */
 
-void hash_finish_ctx()
+/*
+  Takes a pointer to a 256 bit block of data (eight 32 bit ints) and
+  initializes it to the start constants of the SHA256 algorithm.  This
+  must be called before using hash in the call to sha256_hash
+*/
+void
+sha256_init_ctx (struct sha256_ctx *ctx)
 {
-  switch (hash_algorithm) {
-    case HASH_MD5:
-      md5_finish_ctx(&md5_global_ctx,audio_hash);
-      break;
-    case HASH_SHA1:
-      sha1_finish_ctx(&sha1_global_ctx,audio_hash);
-      break;
-  }
-}
+  ctx->state[0] = 0x6a09e667UL;
+  ctx->state[1] = 0xbb67ae85UL;
+  ctx->state[2] = 0x3c6ef372UL;
+  ctx->state[3] = 0xa54ff53aUL;
+  ctx->state[4] = 0x510e527fUL;
+  ctx->state[5] = 0x9b05688cUL;
+  ctx->state[6] = 0x1f83d9abUL;
+  ctx->state[7] = 0x5be0cd19UL;
 
-void hash_process_block()
-{
-  switch (hash_algorithm) {
-    case HASH_MD5:
-      md5_process_block(global_buffer,BLOCKSIZE,&md5_global_ctx);
-      break;
-    case HASH_SHA1:
-      sha1_process_block(global_buffer,BLOCKSIZE,&sha1_global_ctx);
-      break;
-  }
+  ctx->total[0] = ctx->total[1] = 0;
+  ctx->buflen = 0;
 }
 
-static void print_audio_hash(char *filename)
-{
-  int i,hash_hex_bytes = 0;
+/* Put result from CTX in first 32 bytes following RESBUF.  The result
+   must be in little endian byte order.
 
-  switch (hash_algorithm) {
-    case HASH_MD5:
-      hash_hex_bytes = 32;
-      break;
-    case HASH_SHA1:
-      hash_hex_bytes = 40;
-      break;
-  }
+   IMPORTANT: On some systems it is required that RESBUF is correctly
+   aligned for a 32-bit value.  */
+void *
+sha256_read_ctx (const struct sha256_ctx *ctx, void *resbuf)
+{
+  int i;
 
-  for (i=0;i<(hash_hex_bytes/2);i++)
-    st_output("%02x",audio_hash[i]);
+  for (i = 0; i < 8; i++)
+    ((md5_uint32 *) resbuf)[i] = SWAP_SHA1 (ctx->state[i]);
 
-  st_output("  [shntool]  %s\n",filename);
+  return resbuf;
 }
 
-static bool generate_audio_hash_single(wave_info *info)
-{
-  unsigned char *header;
-  int retval;
-  bool success;
+/* Process the remaining bytes in the internal buffer and the usual
+   prolog according to the standard and write the result to RESBUF.
 
-  success = FALSE;
+   IMPORTANT: On some systems it is required that RESBUF is correctly
+   aligned for a 32 bits value.  */
+void *
+sha256_finish_ctx (struct sha256_ctx *ctx, void *resbuf)
+{
+  /* Take yet unprocessed bytes into account.  */
+  md5_uint32 bytes = ctx->buflen;
+  size_t pad;
 
-  proginfo.initialized = FALSE;
-  proginfo.filename2 = info->filename;
-  proginfo.filedesc2 = info->m_ss;
-  proginfo.bytes_total = info->data_size;
+  /* Now count remaining bytes.  */
+  ctx->total[0] += bytes;
+  if (ctx->total[0] < bytes)
+    ++ctx->total[1];
 
-  prog_update(&proginfo);
+  pad = bytes >= 56 ? 64 + 56 - bytes : 56 - bytes;
+  memcpy (&ctx->buffer[bytes], fillbuf, pad);
 
-  if (!open_input_stream(info)) {
-    st_warning("could not reopen input file: [%s]",info->filename);
-    return FALSE;
-  }
+  /* Put the 64-bit file length in *bits* at the end of the buffer.  */
+  *(md5_uint32 *) &ctx->buffer[bytes + pad + 4] = SWAP_SHA1 (ctx->total[0] << 3);
+  *(md5_uint32 *) &ctx->buffer[bytes + pad] = SWAP_SHA1 ((ctx->total[1] << 3) |
+						      (ctx->total[0] >> 29));
 
-  if (NULL == (header = malloc(info->header_size * sizeof(unsigned char)))) {
-    prog_error(&proginfo);
-    st_warning("could not allocate %d-byte WAVE header",info->header_size);
-    goto cleanup_single1;
-  }
+  /* Process last bytes.  */
+  sha256_process_block (ctx->buffer, bytes + pad + 8, ctx);
 
-  if (read_n_bytes(info->input,header,info->header_size,NULL) != info->header_size) {
-    prog_error(&proginfo);
-    st_warning("error while discarding %d-byte WAVE header from file: [%s]",info->header_size,info->filename);
-    goto cleanup_single2;
-  }
+  return sha256_read_ctx (ctx, resbuf);
+}
 
-  maxbytes = info->data_size;
-  remaining_bytes = 0;
+/* Compute SHA256 message digest for LEN bytes beginning at BUFFER.  The
+   result is always in little endian byte order, so that a byte-wise
+   output yields to the wanted ASCII representation of the message
+   digest.  */
+void *
+sha256_buffer (const char *buffer, size_t len, void *resblock)
+{
+  struct sha256_ctx ctx;
 
   /* Initialize the computation context.  */
-  hash_init_ctx();
-
-  retval = hash_stream(info->input);
+  sha256_init_ctx (&ctx);
 
-  /* Add the last bytes if necessary.  */
-  if (remaining_bytes > 0)
-    hash_process_bytes();
+  /* Process whole buffer but last len % 64 bytes.  */
+  sha256_process_bytes (buffer, len, &ctx);
 
-  /* Construct result in desired memory.  */
-  hash_finish_ctx();
+  /* Put result in desired memory area.  */
+  return sha256_finish_ctx (&ctx, resblock);
+}
 
-  if (retval) {
-    prog_error(&proginfo);
-    st_warning("possibly truncated and/or corrupt file: [%s]",info->filename);
-    goto cleanup_single2;
-  }
+void
+sha256_process_bytes (const void *buffer, size_t len, struct sha256_ctx *ctx)
+{
+  /* When we already have some bits in our internal buffer concatenate
+     both inputs first.  */
+  if (ctx->buflen != 0)
+    {
+      size_t left_over = ctx->buflen;
+      size_t add = 128 - left_over > len ? len : 128 - left_over;
 
-  success = TRUE;
+      memcpy (&ctx->buffer[left_over], buffer, add);
+      ctx->buflen += add;
 
-  prog_success(&proginfo);
+      if (ctx->buflen > 64)
+	{
+	  sha256_process_block (ctx->buffer, ctx->buflen & ~63, ctx);
 
-  print_audio_hash(info->filename);
+	  ctx->buflen &= 63;
+	  /* The regions in the following copy operation cannot overlap.  */
+	  memcpy (ctx->buffer, &ctx->buffer[(left_over + add) & ~63],
+		  ctx->buflen);
+	}
 
-cleanup_single2:
+      buffer = (const char *) buffer + add;
+      len -= add;
+    }
+
+  /* Process available complete blocks.  */
+  if (len >= 64)
+    {
+#if !_STRING_ARCH_unaligned
+      if (UNALIGNED_P (buffer))
+	while (len > 64)
+	  {
+	    sha256_process_block (memcpy (ctx->buffer, buffer, 64), 64, ctx);
+	    buffer = (const char *) buffer + 64;
+	    len -= 64;
+	  }
+      else
+#endif
+	{
+	  sha256_process_block (buffer, len & ~63, ctx);
+	  buffer = (const char *) buffer + (len & ~63);
+	  len &= 63;
+	}
+    }
+
+  /* Move remaining bytes in internal buffer.  */
+  if (len > 0)
+    {
+      size_t left_over = ctx->buflen;
+
+      memcpy (&ctx->buffer[left_over], buffer, len);
+      left_over += len;
+      if (left_over >= 64)
+	{
+	  sha256_process_block (ctx->buffer, 64, ctx);
+	  left_over -= 64;
+	  memcpy (ctx->buffer, &ctx->buffer[64], left_over);
+	}
+      ctx->buflen = left_over;
+    }
+}
+
+/* --- Code below is the primary difference between sha1.c and sha256.c --- */
+
+/* SHA256 round constants */
+#define K(I) sha256_round_constants[I]
+static const md5_uint32 sha256_round_constants[64] = {
+  0x428a2f98UL, 0x71374491UL, 0xb5c0fbcfUL, 0xe9b5dba5UL,
+  0x3956c25bUL, 0x59f111f1UL, 0x923f82a4UL, 0xab1c5ed5UL,
+  0xd807aa98UL, 0x12835b01UL, 0x243185beUL, 0x550c7dc3UL,
+  0x72be5d74UL, 0x80deb1feUL, 0x9bdc06a7UL, 0xc19bf174UL,
+  0xe49b69c1UL, 0xefbe4786UL, 0x0fc19dc6UL, 0x240ca1ccUL,
+  0x2de92c6fUL, 0x4a7484aaUL, 0x5cb0a9dcUL, 0x76f988daUL,
+  0x983e5152UL, 0xa831c66dUL, 0xb00327c8UL, 0xbf597fc7UL,
+  0xc6e00bf3UL, 0xd5a79147UL, 0x06ca6351UL, 0x14292967UL,
+  0x27b70a85UL, 0x2e1b2138UL, 0x4d2c6dfcUL, 0x53380d13UL,
+  0x650a7354UL, 0x766a0abbUL, 0x81c2c92eUL, 0x92722c85UL,
+  0xa2bfe8a1UL, 0xa81a664bUL, 0xc24b8b70UL, 0xc76c51a3UL,
+  0xd192e819UL, 0xd6990624UL, 0xf40e3585UL, 0x106aa070UL,
+  0x19a4c116UL, 0x1e376c08UL, 0x2748774cUL, 0x34b0bcb5UL,
+  0x391c0cb3UL, 0x4ed8aa4aUL, 0x5b9cca4fUL, 0x682e6ff3UL,
+  0x748f82eeUL, 0x78a5636fUL, 0x84c87814UL, 0x8cc70208UL,
+  0x90befffaUL, 0xa4506cebUL, 0xbef9a3f7UL, 0xc67178f2UL,
+};
+
+/* Round functions.  */
+#undef F1
+#undef F2
+#define F2(A,B,C) ( ( A & B ) | ( C & ( A | B ) ) )
+#define F1(E,F,G) ( G ^ ( E & ( F ^ G ) ) )
+
+/* Process LEN bytes of BUFFER, accumulating context into CTX.
+   It is assumed that LEN % 64 == 0.
+   Most of this code comes from GnuPG's cipher/sha1.c.  */
+
+void
+sha256_process_block (const void *buffer, size_t len, struct sha256_ctx *ctx)
+{
+  const md5_uint32 *words = buffer;
+  size_t nwords = len / sizeof (md5_uint32);
+  const md5_uint32 *endp = words + nwords;
+  md5_uint32 x[16];
+  md5_uint32 a = ctx->state[0];
+  md5_uint32 b = ctx->state[1];
+  md5_uint32 c = ctx->state[2];
+  md5_uint32 d = ctx->state[3];
+  md5_uint32 e = ctx->state[4];
+  md5_uint32 f = ctx->state[5];
+  md5_uint32 g = ctx->state[6];
+  md5_uint32 h = ctx->state[7];
+
+  /* First increment the byte count.  FIPS PUB 180-2 specifies the possible
+     length of the file up to 2^64 bits.  Here we only compute the
+     number of bytes.  Do a double word increment.  */
+  ctx->total[0] += len;
+  if (ctx->total[0] < len)
+    ++ctx->total[1];
+
+#undef rol
+#define rol(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define S0(x) (rol(x,25)^rol(x,14)^(x>>3))
+#define S1(x) (rol(x,15)^rol(x,13)^(x>>10))
+#define SS0(x) (rol(x,30)^rol(x,19)^rol(x,10))
+#define SS1(x) (rol(x,26)^rol(x,21)^rol(x,7))
+
+#undef M
+#define M(I) ( tm =   S1(x[(I-2)&0x0f]) + x[(I-7)&0x0f] \
+		    + S0(x[(I-15)&0x0f]) + x[I&0x0f]    \
+	       , x[I&0x0f] = tm )
+
+#undef R
+#define R(A,B,C,D,E,F,G,H,K,M)  do { t0 = SS0(A) + F2(A,B,C); \
+				     t1 = H + SS1(E)  \
+				      + F1(E,F,G)     \
+				      + K	      \
+				      + M;	      \
+				     D += t1;  H = t0 + t1; \
+			       } while(0)
+
+  while (words < endp)
+    {
+      md5_uint32 tm;
+      md5_uint32 t0, t1;
+      int t;
+      for (t = 0; t < 16; t++)
+	{
+	  x[t] = SWAP_SHA1 (*words);
+	  words++;
+	}
+
+      R( a, b, c, d, e, f, g, h, K( 0), x[ 0] );
+      R( h, a, b, c, d, e, f, g, K( 1), x[ 1] );
+      R( g, h, a, b, c, d, e, f, K( 2), x[ 2] );
+      R( f, g, h, a, b, c, d, e, K( 3), x[ 3] );
+      R( e, f, g, h, a, b, c, d, K( 4), x[ 4] );
+      R( d, e, f, g, h, a, b, c, K( 5), x[ 5] );
+      R( c, d, e, f, g, h, a, b, K( 6), x[ 6] );
+      R( b, c, d, e, f, g, h, a, K( 7), x[ 7] );
+      R( a, b, c, d, e, f, g, h, K( 8), x[ 8] );
+      R( h, a, b, c, d, e, f, g, K( 9), x[ 9] );
+      R( g, h, a, b, c, d, e, f, K(10), x[10] );
+      R( f, g, h, a, b, c, d, e, K(11), x[11] );
+      R( e, f, g, h, a, b, c, d, K(12), x[12] );
+      R( d, e, f, g, h, a, b, c, K(13), x[13] );
+      R( c, d, e, f, g, h, a, b, K(14), x[14] );
+      R( b, c, d, e, f, g, h, a, K(15), x[15] );
+      R( a, b, c, d, e, f, g, h, K(16), M(16) );
+      R( h, a, b, c, d, e, f, g, K(17), M(17) );
+      R( g, h, a, b, c, d, e, f, K(18), M(18) );
+      R( f, g, h, a, b, c, d, e, K(19), M(19) );
+      R( e, f, g, h, a, b, c, d, K(20), M(20) );
+      R( d, e, f, g, h, a, b, c, K(21), M(21) );
+      R( c, d, e, f, g, h, a, b, K(22), M(22) );
+      R( b, c, d, e, f, g, h, a, K(23), M(23) );
+      R( a, b, c, d, e, f, g, h, K(24), M(24) );
+      R( h, a, b, c, d, e, f, g, K(25), M(25) );
+      R( g, h, a, b, c, d, e, f, K(26), M(26) );
+      R( f, g, h, a, b, c, d, e, K(27), M(27) );
+      R( e, f, g, h, a, b, c, d, K(28), M(28) );
+      R( d, e, f, g, h, a, b, c, K(29), M(29) );
+      R( c, d, e, f, g, h, a, b, K(30), M(30) );
+      R( b, c, d, e, f, g, h, a, K(31), M(31) );
+      R( a, b, c, d, e, f, g, h, K(32), M(32) );
+      R( h, a, b, c, d, e, f, g, K(33), M(33) );
+      R( g, h, a, b, c, d, e, f, K(34), M(34) );
+      R( f, g, h, a, b, c, d, e, K(35), M(35) );
+      R( e, f, g, h, a, b, c, d, K(36), M(36) );
+      R( d, e, f, g, h, a, b, c, K(37), M(37) );
+      R( c, d, e, f, g, h, a, b, K(38), M(38) );
+      R( b, c, d, e, f, g, h, a, K(39), M(39) );
+      R( a, b, c, d, e, f, g, h, K(40), M(40) );
+      R( h, a, b, c, d, e, f, g, K(41), M(41) );
+      R( g, h, a, b, c, d, e, f, K(42), M(42) );
+      R( f, g, h, a, b, c, d, e, K(43), M(43) );
+      R( e, f, g, h, a, b, c, d, K(44), M(44) );
+      R( d, e, f, g, h, a, b, c, K(45), M(45) );
+      R( c, d, e, f, g, h, a, b, K(46), M(46) );
+      R( b, c, d, e, f, g, h, a, K(47), M(47) );
+      R( a, b, c, d, e, f, g, h, K(48), M(48) );
+      R( h, a, b, c, d, e, f, g, K(49), M(49) );
+      R( g, h, a, b, c, d, e, f, K(50), M(50) );
+      R( f, g, h, a, b, c, d, e, K(51), M(51) );
+      R( e, f, g, h, a, b, c, d, K(52), M(52) );
+      R( d, e, f, g, h, a, b, c, K(53), M(53) );
+      R( c, d, e, f, g, h, a, b, K(54), M(54) );
+      R( b, c, d, e, f, g, h, a, K(55), M(55) );
+      R( a, b, c, d, e, f, g, h, K(56), M(56) );
+      R( h, a, b, c, d, e, f, g, K(57), M(57) );
+      R( g, h, a, b, c, d, e, f, K(58), M(58) );
+      R( f, g, h, a, b, c, d, e, K(59), M(59) );
+      R( e, f, g, h, a, b, c, d, K(60), M(60) );
+      R( d, e, f, g, h, a, b, c, K(61), M(61) );
+      R( c, d, e, f, g, h, a, b, K(62), M(62) );
+      R( b, c, d, e, f, g, h, a, K(63), M(63) );
+
+      a = ctx->state[0] += a;
+      b = ctx->state[1] += b;
+      c = ctx->state[2] += c;
+      d = ctx->state[3] += d;
+      e = ctx->state[4] += e;
+      f = ctx->state[5] += f;
+      g = ctx->state[6] += g;
+      h = ctx->state[7] += h;
+    }
+}
+
+/* shntool-specific stuff starts here */
+
+static void md5_init(void *ctx)
+{
+  md5_init_ctx((struct md5_ctx *)ctx);
+}
+
+static void md5_block(const void *buffer,size_t len,void *ctx)
+{
+  md5_process_block(buffer,len,(struct md5_ctx *)ctx);
+}
+
+static void md5_bytes(const void *buffer,size_t len,void *ctx)
+{
+  md5_process_bytes(buffer,len,(struct md5_ctx *)ctx);
+}
+
+static void md5_finish(void *ctx,void *resbuf)
+{
+  md5_finish_ctx((struct md5_ctx *)ctx,resbuf);
+}
+
+static void md5_lanes(void **ctx,const unsigned char **data,int streams,int blocks)
+{
+  unsigned int state[MAX_HASH_LANES * 4];
+  struct md5_ctx *c;
+  md5_uint32 len = 64 * blocks;
+  int i;
+
+  for (i=0;i<streams;i++) {
+    c = (struct md5_ctx *)ctx[i];
+    state[4*i] = c->A;
+    state[4*i+1] = c->B;
+    state[4*i+2] = c->C;
+    state[4*i+3] = c->D;
+  }
+
+  vec_md5_blocks(state,data,streams,blocks);
+
+  for (i=0;i<streams;i++) {
+    c = (struct md5_ctx *)ctx[i];
+    c->A = state[4*i];
+    c->B = state[4*i+1];
+    c->C = state[4*i+2];
+    c->D = state[4*i+3];
+    c->total[0] += len;
+    if (c->total[0] < len)
+      ++c->total[1];
+  }
+}
+
+static void sha1_init(void *ctx)
+{
+  sha1_init_ctx((struct sha1_ctx *)ctx);
+}
+
+static void sha1_block(const void *buffer,size_t len,void *ctx)
+{
+  sha1_process_block(buffer,len,(struct sha1_ctx *)ctx);
+}
+
+static void sha1_bytes(const void *buffer,size_t len,void *ctx)
+{
+  sha1_process_bytes(buffer,len,(struct sha1_ctx *)ctx);
+}
+
+static void sha1_finish(void *ctx,void *resbuf)
+{
+  sha1_finish_ctx((struct sha1_ctx *)ctx,resbuf);
+}
+
+static void sha1_lanes(void **ctx,const unsigned char **data,int streams,int blocks)
+{
+  unsigned int state[MAX_HASH_LANES * 5];
+  struct sha1_ctx *c;
+  md5_uint32 len = 64 * blocks;
+  int i;
+
+  for (i=0;i<streams;i++) {
+    c = (struct sha1_ctx *)ctx[i];
+    state[5*i] = c->A;
+    state[5*i+1] = c->B;
+    state[5*i+2] = c->C;
+    state[5*i+3] = c->D;
+    state[5*i+4] = c->E;
+  }
+
+  vec_sha1_blocks(state,data,streams,blocks);
+
+  for (i=0;i<streams;i++) {
+    c = (struct sha1_ctx *)ctx[i];
+    c->A = state[5*i];
+    c->B = state[5*i+1];
+    c->C = state[5*i+2];
+    c->D = state[5*i+3];
+    c->E = state[5*i+4];
+    c->total[0] += len;
+    if (c->total[0] < len)
+      ++c->total[1];
+  }
+}
+
+static void sha256_init(void *ctx)
+{
+  sha256_init_ctx((struct sha256_ctx *)ctx);
+}
+
+static void sha256_block(const void *buffer,size_t len,void *ctx)
+{
+  sha256_process_block(buffer,len,(struct sha256_ctx *)ctx);
+}
+
+static void sha256_bytes(const void *buffer,size_t len,void *ctx)
+{
+  sha256_process_bytes(buffer,len,(struct sha256_ctx *)ctx);
+}
+
+static void sha256_finish(void *ctx,void *resbuf)
+{
+  sha256_finish_ctx((struct sha256_ctx *)ctx,resbuf);
+}
+
+/*
+ * sha256tree: the WAVE data is cut into TREE_CHUNK_SIZE-byte chunks, and each chunk is hashed
+ * on its own with SHA256, prefixed by a TREE_LEAF byte.  the fingerprint is the SHA256 of all
+ * chunk hashes in order, prefixed by a TREE_NODE byte.  since no chunk depends on any other,
+ * they are hashed a batch at a time by a pool of threads, one chunk per thread.  WAVE data that
+ * needs no decoding is read by the threads themselves, each from its own offset in the file.
+ */
+
+#define TREE_CHUNK_SIZE 1048576
+#define TREE_LEAF 0x00
+#define TREE_NODE 0x01
+
+/* most chunks hashed at once */
+#define MAX_TREE_THREADS 32
+
+typedef struct _tree_chunk {
+  char *buffer;                 /* chunk data */
+  size_t len;                   /* size of the chunk, or how much of it has been filled so far */
+  int fd;                       /* file to read the chunk from, or -1 if it is already in buffer */
+  off_t offset;                 /* where the chunk starts in fd */
+  bool failed;                  /* whether the chunk could not be read from fd */
+  unsigned char hash[32];       /* SHA256 of the chunk */
+} tree_chunk;
+
+typedef struct _tree_batch {
+  tree_chunk chunks[MAX_TREE_THREADS];
+  int count;                    /* number of complete chunks */
+} tree_batch;
+
+struct tree_ctx {
+  struct sha256_ctx root;       /* hash of the chunk hashes so far */
+  tree_batch batches[2];        /* while one batch is hashed, the next one is filled */
+  int current;                  /* batch being filled */
+  bool busy;                    /* whether the other batch is being hashed */
+  int limit;                    /* chunks per batch */
+  bool failed;                  /* whether any chunk could not be read */
+  progress_info *proginfo;      /* progress to update as chunks read from a file are done */
+};
+
+static struct tree_ctx tree_global_ctx;
+
+#ifdef HAVE_PREAD
+
+static bool tree_read(int fd,char *buffer,size_t len,off_t offset)
+/* reads exactly len bytes from fd at offset */
+{
+  ssize_t n;
+
+  while (len > 0) {
+    if ((n = pread(fd,buffer,len,offset)) <= 0) {
+      if (n < 0 && EINTR == errno)
+        continue;
+      return FALSE;
+    }
+    buffer += n;
+    offset += n;
+    len -= n;
+  }
+
+  return TRUE;
+}
+
+#endif
+
+static void tree_hash_chunk(tree_chunk *chunk)
+{
+  struct sha256_ctx ctx;
+  unsigned char prefix = TREE_LEAF;
+
+#ifdef HAVE_PREAD
+  if (chunk->fd >= 0 && !tree_read(chunk->fd,chunk->buffer,chunk->len,chunk->offset)) {
+    chunk->failed = TRUE;
+    return;
+  }
+#endif
+
+  sha256_init_ctx(&ctx);
+  sha256_process_bytes(&prefix,1,&ctx);
+  sha256_process_bytes(chunk->buffer,chunk->len,&ctx);
+  sha256_finish_ctx(&ctx,chunk->hash);
+}
+
+#ifdef THREADED_HASHING
+
+typedef struct _tree_pool {
+  pthread_t threads[MAX_TREE_THREADS];
+  int count;                    /* threads running, or -1 if they could not be started */
+  sem_t work;                   /* posted once per chunk to hash */
+  sem_t done;                   /* posted once per chunk hashed */
+  pthread_mutex_t lock;         /* guards batch and next */
+  tree_batch *batch;            /* batch being hashed, or NULL to make the threads exit */
+  int next;                     /* next chunk in batch to hand out */
+} tree_pool;
+
+static tree_pool pool;
+
+static void *tree_thread_main(void *arg)
+{
+  tree_chunk *chunk;
+
+  for (;;) {
+    while (sem_wait(&pool.work) && EINTR == errno)
+      ;
+
+    pthread_mutex_lock(&pool.lock);
+    chunk = (pool.batch) ? &pool.batch->chunks[pool.next++] : NULL;
+    pthread_mutex_unlock(&pool.lock);
+
+    if (NULL == chunk)
+      break;
+
+    tree_hash_chunk(chunk);
+
+    sem_post(&pool.done);
+  }
+
+  return NULL;
+}
+
+static void tree_pool_stop()
+{
+  int i;
+
+  if (pool.count <= 0)
+    return;
+
+  pthread_mutex_lock(&pool.lock);
+  pool.batch = NULL;
+  pthread_mutex_unlock(&pool.lock);
+
+  for (i=0;i<pool.count;i++)
+    sem_post(&pool.work);
+
+  for (i=0;i<pool.count;i++)
+    pthread_join(pool.threads[i],NULL);
+
+  sem_destroy(&pool.work);
+  sem_destroy(&pool.done);
+  pthread_mutex_destroy(&pool.lock);
+
+  pool.count = 0;
+}
+
+static bool tree_pool_start(int threads)
+/* starts the thread pool, unless it is already running - returns whether it is */
+{
+  int i;
+
+  if (pool.count > 0)
+    return TRUE;
+
+  if (pool.count < 0 || threads < 2)
+    return FALSE;
+
+  if (sem_init(&pool.work,0,0) || sem_init(&pool.done,0,0) || pthread_mutex_init(&pool.lock,NULL)) {
+    pool.count = -1;
+    return FALSE;
+  }
+
+  pool.batch = NULL;
+
+  for (i=0;i<threads;i++) {
+    if (pthread_create(&pool.threads[i],NULL,tree_thread_main,NULL))
+      break;
+    pool.count = i + 1;
+  }
+
+  if (pool.count < threads) {
+    st_debug1("could not start %d tree hashing threads -- hashing chunks in one thread",threads);
+    tree_pool_stop();
+    pool.count = -1;
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+#endif
+
+static void tree_dispatch(tree_batch *batch,int threads)
+/* starts hashing the chunks in batch */
+{
+  int i;
+
+#ifdef THREADED_HASHING
+  if (tree_pool_start(threads)) {
+    pthread_mutex_lock(&pool.lock);
+    pool.batch = batch;
+    pool.next = 0;
+    pthread_mutex_unlock(&pool.lock);
+
+    for (i=0;i<batch->count;i++)
+      sem_post(&pool.work);
+
+    return;
+  }
+#endif
+
+  for (i=0;i<batch->count;i++)
+    tree_hash_chunk(&batch->chunks[i]);
+}
+
+static void tree_wait(struct tree_ctx *ctx)
+/* waits for the batch being hashed, and adds its chunk hashes to the root hash */
+{
+  tree_batch *batch = &ctx->batches[1 - ctx->current];
+  int i;
+
+  if (!ctx->busy)
+    return;
+
+#ifdef THREADED_HASHING
+  if (pool.count > 0)
+    for (i=0;i<batch->count;i++)
+      while (sem_wait(&pool.done) && EINTR == errno)
+        ;
+#endif
+
+  for (i=0;i<batch->count;i++) {
+    if (batch->chunks[i].failed) {
+      ctx->failed = TRUE;
+      continue;
+    }
+
+    sha256_process_bytes(batch->chunks[i].hash,32,&ctx->root);
+
+    if (batch->chunks[i].fd >= 0 && ctx->proginfo) {
+      ctx->proginfo->bytes_written += batch->chunks[i].len;
+      prog_update(ctx->proginfo);
+    }
+  }
+
+  ctx->busy = FALSE;
+}
+
+static void tree_reset_batch(tree_batch *batch)
+{
+  int i;
+
+  batch->count = 0;
+
+  for (i=0;i<MAX_TREE_THREADS;i++) {
+    batch->chunks[i].len = 0;
+    batch->chunks[i].fd = -1;
+    batch->chunks[i].failed = FALSE;
+  }
+}
+
+static void tree_submit(struct tree_ctx *ctx)
+/* hands the batch being filled off to be hashed, and starts filling the other one */
+{
+  tree_wait(ctx);
+
+  tree_dispatch(&ctx->batches[ctx->current],ctx->limit);
+
+  ctx->busy = TRUE;
+  ctx->current = 1 - ctx->current;
+
+  tree_reset_batch(&ctx->batches[ctx->current]);
+}
+
+static tree_chunk *tree_chunk_to_fill(struct tree_ctx *ctx)
+/* returns the chunk currently being filled */
+{
+  tree_chunk *chunk = &ctx->batches[ctx->current].chunks[ctx->batches[ctx->current].count];
+
+  if (NULL == chunk->buffer && NULL == (chunk->buffer = malloc(TREE_CHUNK_SIZE)))
+    st_error("could not allocate %d-byte tree hash chunk",TREE_CHUNK_SIZE);
+
+  return chunk;
+}
+
+static void tree_add_chunk(struct tree_ctx *ctx)
+/* marks the chunk being filled as complete */
+{
+  if (++ctx->batches[ctx->current].count == ctx->limit)
+    tree_submit(ctx);
+}
+
+static void tree_init(void *c)
+{
+  struct tree_ctx *ctx = (struct tree_ctx *)c;
+  unsigned char prefix = TREE_NODE;
+
+  sha256_init_ctx(&ctx->root);
+  sha256_process_bytes(&prefix,1,&ctx->root);
+
+  ctx->limit = min(job_threads(),MAX_TREE_THREADS);
+  ctx->current = 0;
+  ctx->busy = FALSE;
+  ctx->failed = FALSE;
+  ctx->proginfo = NULL;
+
+  tree_reset_batch(&ctx->batches[0]);
+}
+
+static void tree_bytes(const void *buffer,size_t len,void *c)
+{
+  struct tree_ctx *ctx = (struct tree_ctx *)c;
+  tree_chunk *chunk;
+  size_t n;
+
+  while (len > 0) {
+    chunk = tree_chunk_to_fill(ctx);
+
+    n = min(len,TREE_CHUNK_SIZE - chunk->len);
+
+    memcpy(chunk->buffer + chunk->len,buffer,n);
+
+    chunk->len += n;
+    buffer = (const char *)buffer + n;
+    len -= n;
+
+    if (TREE_CHUNK_SIZE == chunk->len)
+      tree_add_chunk(ctx);
+  }
+}
+
+#ifdef HAVE_PREAD
+
+static bool tree_process_fd(int fd,off_t offset,wlong len,progress_info *proginfo,void *c)
+{
+  struct tree_ctx *ctx = (struct tree_ctx *)c;
+  tree_chunk *chunk;
+  size_t n;
+  wlong read_here = 0;
+
+  ctx->proginfo = proginfo;
+
+  /* fill out a chunk left over from the previous file, if any */
+  chunk = tree_chunk_to_fill(ctx);
+
+  if (chunk->len > 0) {
+    n = (size_t)min(len,TREE_CHUNK_SIZE - chunk->len);
+
+    if (!tree_read(fd,chunk->buffer + chunk->len,n,offset))
+      ctx->failed = TRUE;
+
+    chunk->len += n;
+    offset += n;
+    len -= n;
+    read_here += n;
+
+    if (TREE_CHUNK_SIZE == chunk->len)
+      tree_add_chunk(ctx);
+  }
+
+  /* let the threads read all whole chunks themselves */
+  while (len >= TREE_CHUNK_SIZE && !ctx->failed) {
+    chunk = tree_chunk_to_fill(ctx);
+
+    chunk->fd = fd;
+    chunk->offset = offset;
+    chunk->len = TREE_CHUNK_SIZE;
+
+    offset += TREE_CHUNK_SIZE;
+    len -= TREE_CHUNK_SIZE;
+
+    tree_add_chunk(ctx);
+  }
+
+  /* the threads must be done with fd before it is closed */
+  if (ctx->batches[ctx->current].count > 0)
+    tree_submit(ctx);
+
+  tree_wait(ctx);
+
+  /* keep the last partial chunk for the next file to fill out */
+  if (len > 0 && !ctx->failed) {
+    chunk = tree_chunk_to_fill(ctx);
+
+    if (!tree_read(fd,chunk->buffer,(size_t)len,offset))
+      ctx->failed = TRUE;
+
+    chunk->len = (size_t)len;
+    read_here += len;
+  }
+
+  if (proginfo && read_here > 0) {
+    proginfo->bytes_written += read_here;
+    prog_update(proginfo);
+  }
+
+  ctx->proginfo = NULL;
+
+  return !ctx->failed;
+}
+
+#define TREE_PROCESS_FD tree_process_fd
+#else
+#define TREE_PROCESS_FD NULL
+#endif
+
+static void tree_finish(void *c,void *resbuf)
+{
+  struct tree_ctx *ctx = (struct tree_ctx *)c;
+
+  tree_batch *batch = &ctx->batches[ctx->current];
+
+  /* the last chunk may be short */
+  if (batch->chunks[batch->count].len > 0)
+    batch->count++;
+
+  if (batch->count > 0)
+    tree_submit(ctx);
+
+  tree_wait(ctx);
+
+  sha256_finish_ctx(&ctx->root,resbuf);
+}
+
+static void tree_cleanup(void *c)
+{
+  struct tree_ctx *ctx = (struct tree_ctx *)c;
+  int i,j;
+
+#ifdef THREADED_HASHING
+  tree_pool_stop();
+#endif
+
+  for (i=0;i<2;i++)
+    for (j=0;j<MAX_TREE_THREADS;j++) {
+      st_free(ctx->batches[i].chunks[j].buffer);
+      ctx->batches[i].chunks[j].buffer = NULL;
+    }
+}
+
+/* all available algorithms - the first one is the default */
+static hash_module hash_modules[] = {
+  { "md5",        16, &md5_global_ctx,    md5_init,    md5_block,    md5_bytes,    md5_finish,    NULL,            NULL,
+    sizeof(struct md5_ctx),  md5_lanes  },
+  { "sha1",       20, &sha1_global_ctx,   sha1_init,   sha1_block,   sha1_bytes,   sha1_finish,   NULL,            NULL,
+    sizeof(struct sha1_ctx), sha1_lanes },
+  { "sha256",     32, &sha256_global_ctx, sha256_init, sha256_block, sha256_bytes, sha256_finish, NULL,            NULL,
+    0,                       NULL       },
+  { "sha256tree", 32, &tree_global_ctx,   tree_init,   tree_bytes,   tree_bytes,   tree_finish,   TREE_PROCESS_FD, tree_cleanup,
+    0,                       NULL       },
+  { NULL,          0, NULL,               NULL,        NULL,         NULL,         NULL,          NULL,            NULL,
+    0,                       NULL       }
+};
+
+static hash_module *find_hash(char *name)
+{
+  int i;
+
+  for (i=0;hash_modules[i].name;i++)
+    if (!strcmp(hash_modules[i].name,name))
+      return &hash_modules[i];
+
+  return NULL;
+}
+
+static void select_hashes(char *list)
+/* makes the algorithms in the comma-separated list the active ones */
+{
+  char *names,*name;
+  hash_module *hash;
+  int i;
+
+  if (NULL == (names = strdup(list)))
+    st_error("could not duplicate hash algorithm list");
+
+  num_hashes = 0;
+
+  for (name=strtok(names,",");name;name=strtok(NULL,",")) {
+    if (NULL == (hash = find_hash(name)))
+      st_help("unknown hash algorithm: [%s]",name);
+
+    for (i=0;i<num_hashes;i++)
+      if (hashes[i] == hash)
+        st_help("hash algorithm listed more than once: [%s]",name);
+
+    if (MAX_HASHES == num_hashes)
+      st_help("too many hash algorithms -- maximum is %d",MAX_HASHES);
+
+    hashes[num_hashes++] = hash;
+  }
+
+  st_free(names);
+
+  if (0 == num_hashes)
+    st_help("missing hash algorithm list");
+}
+
+static int hash_index(char *name)
+/* returns the position of the given algorithm among the active ones, or -1 if it isn't active */
+{
+  int i;
+
+  for (i=0;i<num_hashes;i++)
+    if (!strcmp(hashes[i]->name,name))
+      return i;
+
+  return -1;
+}
+
+#ifdef THREADED_HASHING
+
+/*
+ * with several algorithms active, each one gets a worker thread, and every buffer of
+ * WAVE data is handed to all of them at once.  while they hash it, the next buffer is
+ * read into a spare one, so the decoder and all algorithms can keep going together.
+ */
+
+typedef struct _hash_worker {
+  pthread_t thread;
+  sem_t start;
+  sem_t done;
+  hash_module *hash;
+} hash_worker;
+
+static hash_worker workers[MAX_HASHES];
+static int num_workers = 0;
+static bool workers_busy = FALSE;
+static const char *work_buffer = NULL;
+static size_t work_len = 0;
+
+static void *hash_worker_main(void *arg)
+{
+  hash_worker *w = (hash_worker *)arg;
+
+  for (;;) {
+    while (sem_wait(&w->start) && EINTR == errno)
+      ;
+
+    if (NULL == work_buffer)
+      break;
+
+    w->hash->process_block(work_buffer,work_len,w->hash->ctx);
+
+    sem_post(&w->done);
+  }
+
+  return NULL;
+}
+
+static void hash_workers_start()
+{
+  int i;
+
+  /* jobs run in processes of their own, so threads are only started by whichever one hashes */
+  if (num_workers > 0 || num_hashes < 2)
+    return;
+
+  for (i=0;i<num_hashes;i++) {
+    workers[i].hash = hashes[i];
+
+    if (sem_init(&workers[i].start,0,0) || sem_init(&workers[i].done,0,0) ||
+        pthread_create(&workers[i].thread,NULL,hash_worker_main,&workers[i]))
+      break;
+  }
+
+  num_workers = i;
+
+  /* fall back to hashing in this thread if not every algorithm got a worker */
+  if (num_workers < num_hashes) {
+    st_debug1("could not start hash worker threads -- hashing in one thread");
+    work_buffer = NULL;
+    for (i=0;i<num_workers;i++) {
+      sem_post(&workers[i].start);
+      pthread_join(workers[i].thread,NULL);
+    }
+    num_workers = -1;
+  }
+}
+
+static void hash_workers_wait()
+{
+  int i;
+
+  if (!workers_busy)
+    return;
+
+  for (i=0;i<num_workers;i++)
+    while (sem_wait(&workers[i].done) && EINTR == errno)
+      ;
+
+  workers_busy = FALSE;
+}
+
+static bool hash_workers_submit(const char *buffer,size_t len)
+{
+  int i;
+
+  hash_workers_start();
+
+  if (num_workers <= 0)
+    return FALSE;
+
+  hash_workers_wait();
+
+  work_buffer = buffer;
+  work_len = len;
+  workers_busy = TRUE;
+
+  for (i=0;i<num_workers;i++)
+    sem_post(&workers[i].start);
+
+  return TRUE;
+}
+
+static void hash_workers_stop()
+{
+  int i;
+
+  hash_workers_wait();
+
+  if (num_workers <= 0)
+    return;
+
+  work_buffer = NULL;
+
+  for (i=0;i<num_workers;i++) {
+    sem_post(&workers[i].start);
+    pthread_join(workers[i].thread,NULL);
+    sem_destroy(&workers[i].start);
+    sem_destroy(&workers[i].done);
+  }
+
+  num_workers = 0;
+}
+
+/* spare buffer, filled while the workers hash the other one */
+static char spare_buffer[HASH_BUFFER_SIZE + 72];
+
+#else
+
+#define hash_workers_submit(a,b) FALSE
+#define hash_workers_wait()
+#define hash_workers_stop()
+
+#endif
+
+static void hash_help()
+{
+  st_info("Usage: %s [OPTIONS] [files]\n",st_progname());
+  st_info("\n");
+  st_info("Mode-specific options:\n");
+  st_info("\n");
+  st_info("  -a list generate fingerprints with each algorithm in comma-separated list: {md5, sha1, sha256, sha256tree}\n");
+  st_info("  -c      generate composite fingerprint from input files\n");
+  st_info("  -e      decode files with an embedded MD5 signature, and check it against the decoded data\n");
+  st_info("  -h      show this help screen\n");
+  st_info("  -l file keep fingerprints in file, and only hash input files that changed since they were stored\n");
+  st_info("  -m      generate MD5 fingerprints (default)\n");
+  st_info("  -n pct  also hash pct percent of unchanged files, and check them against their stored fingerprints\n");
+  st_info("  -s      generate SHA1 fingerprints\n");
+  st_info("  -t      only check fingerprints against the stored ones, without storing them\n");
+  st_info("  -x      keep fingerprints in extended attributes (%s*) of each file, like -l\n",XATTR_PREFIX);
+  st_info("\n");
+}
+
+static void parse(int argc,char **argv,int *first_arg)
+{
+  int c;
+
+  select_hashes(hash_modules[0].name);
+
+  while ((c = st_getopt(argc,argv,"a:cel:mn:stx")) != -1) {
+    switch (c) {
+      case 'a':
+        if (NULL == optarg)
+          st_help("missing hash algorithm list");
+        select_hashes(optarg);
+        break;
+      case 'c':
+        composite_hash = TRUE;
+        break;
+      case 'e':
+        verify_embedded = TRUE;
+        break;
+      case 'l':
+        if (NULL == optarg)
+          st_help("missing fingerprint list filename");
+        stored_list = optarg;
+        break;
+      case 'm':
+        select_hashes("md5");
+        break;
+      case 'n':
+        if (NULL == optarg)
+          st_help("missing percentage of unchanged files to check");
+        sample_percent = atof(optarg);
+        if (sample_percent <= 0.0 || sample_percent > 100.0)
+          st_help("percentage of unchanged files to check must be greater than 0 and at most 100: [%s]",optarg);
+        break;
+      case 's':
+        select_hashes("sha1");
+        break;
+      case 't':
+        verify_stored = TRUE;
+        break;
+      case 'x':
+#ifndef XATTR_HASHES
+        st_help("extended attributes are not supported on this system");
+#endif
+        stored_xattr = TRUE;
+        break;
+    }
+  }
+
+  if (stored_list && stored_xattr)
+    st_help("fingerprints can be kept in a list or in extended attributes, but not both");
+
+  if ((verify_stored || sample_percent > 0.0) && NULL == stored_list && !stored_xattr)
+    st_help("checking stored fingerprints requires a fingerprint list or extended attributes");
+
+  if (composite_hash && (stored_list || stored_xattr))
+    st_help("composite fingerprints cannot be stored");
+
+  if (composite_hash && job_count() > 1)
+    st_help("composite fingerprints are generated one file at a time, and cannot be combined with -j");
+
+  /* chosen before any jobs start, so -n picks files the same way whichever job hashes them */
+  sample_seed = (unsigned long)time(NULL) ^ ((unsigned long)getpid() << 16);
+
+  *first_arg = optind;
+}
+
+void hash_init_ctx()
+{
+  int i;
+
+  for (i=0;i<num_hashes;i++)
+    hashes[i]->init_ctx(hashes[i]->ctx);
+}
+
+static void hash_blocks(const char *buffer,size_t len)
+/* runs whole blocks of data through every active algorithm */
+{
+  int i;
+
+  if (hash_workers_submit(buffer,len))
+    return;
+
+  for (i=0;i<num_hashes;i++)
+    hashes[i]->process_block(buffer,len,hashes[i]->ctx);
+}
+
+int hash_stream(FILE *stream)
+/* hashes up to maxbytes of WAVE data from stream, in whole blocks.  bytes left over
+ * that don't fill a block are kept at the start of global_buffer, in remaining_bytes.
+ */
+{
+  char *buffer = global_buffer;
+  unsigned long totalbytes = 0;
+  size_t sum,whole;
+  int n = 0;
+
+  if (0 == maxbytes)
+    return 0;
+
+  for (;;) {
+    sum = 0;
+
+    while (sum < HASH_BUFFER_SIZE && totalbytes < maxbytes) {
+      n = read_n_bytes(stream,(unsigned char *)(buffer + sum),(int)min(HASH_BUFFER_SIZE - sum,maxbytes - totalbytes),&proginfo);
+      if (n <= 0)
+        break;
+      sum += n;
+      totalbytes += n;
+    }
+
+    if (sum < HASH_BUFFER_SIZE)
+      break;
+
+    hash_blocks(buffer,sum);
+
+#ifdef THREADED_HASHING
+    /* read on into the other buffer while this one is being hashed */
+    if (num_workers > 0)
+      buffer = (buffer == global_buffer) ? spare_buffer : global_buffer;
+#endif
+  }
+
+  whole = sum - (sum % BLOCKSIZE);
+
+  if (whole > 0)
+    hash_blocks(buffer,whole);
+
+  hash_workers_wait();
+
+  /* keep the partial block for hash_process_bytes(), or for the next file to fill out */
+  if (sum > whole)
+    memmove(global_buffer,buffer + whole,sum - whole);
+
+  remaining_bytes = (int)(sum - whole);
+
+  if (totalbytes == maxbytes)
+    return 0;
+
+  return (n < 0 || ferror(stream)) ? 1 : 2;
+}
+
+void hash_process_bytes()
+{
+  int i;
+
+  for (i=0;i<num_hashes;i++)
+    hashes[i]->process_bytes(global_buffer,remaining_bytes,hashes[i]->ctx);
+}
+
+void hash_finish_ctx()
+{
+  int i;
+
+  for (i=0;i<num_hashes;i++)
+    hashes[i]->finish_ctx(hashes[i]->ctx,audio_hash[i]);
+}
+
+void hash_process_block()
+{
+  hash_blocks(global_buffer,BLOCKSIZE);
+  hash_workers_wait();
+}
+
+static void print_audio_hash(char *filename)
+{
+  int i,j;
+
+  for (j=0;j<num_hashes;j++) {
+    for (i=0;i<hashes[j]->digest_size;i++)
+      st_output("%02x",audio_hash[j][i]);
+
+    /* tag each fingerprint with its algorithm when there is more than one per file */
+    if (num_hashes > 1)
+      st_output("  [shntool:%s]  %s\n",hashes[j]->name,filename);
+    else
+      st_output("  [shntool]  %s\n",filename);
+  }
+}
+
+static bool direct_input(wave_info *info,int *fd,off_t *offset)
+/* checks whether the only active algorithm can read the rest of the WAVE data straight from the file */
+{
+  struct stat st;
+  long pos;
+
+  if (1 != num_hashes || NULL == hashes[0]->process_fd || NO_CHILD_PID != info->input_proc.pid)
+    return FALSE;
+
+  *fd = fileno(info->input);
+
+  if (fstat(*fd,&st) || !S_ISREG(st.st_mode) || (pos = ftell(info->input)) < 0)
+    return FALSE;
+
+  *offset = (off_t)pos;
+
+  return TRUE;
+}
+
+static int hash_input(wave_info *info)
+/* hashes the rest of the WAVE data in info, returning 0 on success like hash_stream() */
+{
+  off_t offset;
+  int fd;
+
+  if (direct_input(info,&fd,&offset))
+    return (hashes[0]->process_fd(fd,offset,(wlong)maxbytes,&proginfo,hashes[0]->ctx)) ? 0 : 1;
+
+  pipeline_read_ahead(info->input,(wlong)maxbytes);
+
+  return hash_stream(info->input);
+}
+
+static void hash_cleanup()
+{
+  int i;
+
+  hash_workers_stop();
+
+  for (i=0;i<num_hashes;i++)
+    if (hashes[i]->cleanup)
+      hashes[i]->cleanup(hashes[i]->ctx);
+}
+
+static bool read_embedded_hash(wave_info *info,unsigned char *hash)
+/* gets the MD5 signature that the input file stores for its audio data, if it is also that of its WAVE data */
+{
+  if (hash_index("md5") < 0 || NULL == info->input_format->embedded_md5)
+    return FALSE;
+
+  /* only PCM samples filling whole bytes, with no 8-bit unsigned/signed ambiguity, are hashed the same way */
+  if ((WAVE_FORMAT_PCM != info->wave_format && WAVE_FORMAT_EXTENSIBLE != info->wave_format) ||
+      info->bits_per_sample <= 8 || 0 != info->bits_per_sample % 8 || info->bits_per_sample * info->channels != info->block_align * 8)
+    return FALSE;
+
+  if (!info->input_format->embedded_md5(info,hash))
+    return FALSE;
+
+  st_debug1("found embedded MD5 signature in file: [%s]",info->filename);
+
+  return TRUE;
+}
+
+/*
+ * stored fingerprints: with -l or -x, the fingerprints of each file are kept between runs, along with
+ * the size, mtime and inode the file had when they were generated.  a file that still has them is not
+ * decoded again, unless -n picks it for a check against bit rot.  a fingerprint list holds the same
+ * lines hash mode prints, and the lines of a file that follow a comment with its status were generated
+ * when the file had that status, e.g.
+ *
+ *   #shntool:md5 41943084 1234567890 5678  foo.wav
+ *   0123456789abcdef0123456789abcdef  [shntool]  foo.wav
+ *
+ * where the comment names the algorithm of the file's untagged line, if it has one.  fingerprints with no
+ * status, such as those in an existing list of MD5 or SHA1 fingerprints, are checked the next time the
+ * file is hashed with their algorithm.  files are matched by name, as given on the command line.
+ */
+
+/* files changed this recently don't have their status stored, since a further change within
+ * the same second would leave their size and mtime unchanged
+ */
+#define STORED_MIN_AGE 2
+
+#define STORED_MAGIC "#shntool"
+
+#define STORED_LINE_SIZE (FILENAME_SIZE + 256)
+
+enum {
+  STORED_NONE,                  /* the file has to be hashed */
+  STORED_CURRENT,               /* the stored fingerprints still hold */
+  STORED_SAMPLED                /* the stored fingerprints are to be checked against the decoded data */
+};
+
+typedef struct _file_status {
+  bool valid;
+  unsigned long size;
+  unsigned long mtime;
+  unsigned long inode;
+} file_status;
+
+typedef struct _stored_file {
+  char *filename;
+  int index;                                    /* position in list order */
+  file_status comment;                          /* status from the latest comment, while the list is read */
+  hash_module *untagged;                        /* algorithm of the untagged line, as named by the comment */
+  int count;
+  hash_module *hash[MAX_HASHES];                /* algorithm of each fingerprint */
+  file_status status[MAX_HASHES];               /* status of the file when each fingerprint was generated */
+  unsigned char digest[MAX_HASHES][MAX_DIGEST_SIZE];
+} stored_file;
+
+/* a fingerprint to store in the list, as reported by a job */
+typedef struct _stored_update {
+  int entry;
+  int module;
+  file_status status;
+  unsigned char digest[MAX_DIGEST_SIZE];
+} stored_update;
+
+static stored_file **stored_files = NULL;       /* entries in list order */
+static stored_file **stored_sorted = NULL;      /* entries in filename order, for lookups */
+static int stored_count = 0;
+static int sorted_count = 0;
+static int stored_size = 0;
+static bool stored_changed = FALSE;
+
+static bool storing()
+/* checks whether fingerprints are kept between runs */
+{
+  return (NULL != stored_list || stored_xattr);
+}
+
+static bool get_file_status(char *filename,file_status *fs)
+/* fills out fs from the current status of filename */
+{
+  struct stat sz;
+
+  fs->valid = FALSE;
+
+  if (stat(filename,&sz))
+    return FALSE;
+
+  fs->size = (unsigned long)sz.st_size;
+  fs->mtime = (unsigned long)sz.st_mtime;
+  fs->inode = (unsigned long)sz.st_ino;
+  fs->valid = TRUE;
+
+  return TRUE;
+}
+
+static bool same_status(file_status *a,file_status *b)
+{
+  return (a->valid && b->valid && a->size == b->size && a->mtime == b->mtime && a->inode == b->inode);
+}
+
+static hash_module *untagged_hash(int size)
+/* returns the algorithm an untagged fingerprint of the given size is taken to be, when nothing names it */
+{
+  int i;
+
+  for (i=0;hash_modules[i].name;i++)
+    if (size == hash_modules[i].digest_size)
+      return &hash_modules[i];
+
+  return NULL;
+}
+
+static int parse_digest(char *s,unsigned char *digest)
+/* converts the hex digits at the start of s, returning the number of bytes, or -1 */
+{
+  unsigned int byte;
+  int n = 0;
+
+  while (isxdigit((int)s[0]) && isxdigit((int)s[1])) {
+    if (MAX_DIGEST_SIZE == n || 1 != sscanf(s,"%2x",&byte))
+      return -1;
+    digest[n++] = (unsigned char)byte;
+    s += 2;
+  }
+
+  return (0 == n || ' ' != *s) ? -1 : n;
+}
+
+static void format_digest(char *s,unsigned char *digest,int size)
+{
+  int i;
+
+  for (i=0;i<size;i++)
+    sprintf(s + 2 * i,"%02x",digest[i]);
+}
+
+static int compare_stored(const void *a,const void *b)
+{
+  return strcmp((*(stored_file **)a)->filename,(*(stored_file **)b)->filename);
+}
+
+static stored_file *stored_find(char *filename)
+/* returns the list entry for filename */
+{
+  stored_file key,*k = &key,**found;
+
+  /* while the list is being read, the lines of a file follow one another */
+  if (NULL == stored_sorted) {
+    if (stored_count > 0 && !strcmp(stored_files[stored_count-1]->filename,filename))
+      return stored_files[stored_count-1];
+    return NULL;
+  }
+
+  key.filename = filename;
+
+  found = bsearch(&k,stored_sorted,sorted_count,sizeof(stored_file *),compare_stored);
+
+  return (found) ? *found : NULL;
+}
+
+static stored_file *stored_entry(char *filename)
+/* returns the list entry for filename, adding one to the end of the list if needed */
+{
+  stored_file *entry;
+
+  if ((entry = stored_find(filename)))
+    return entry;
+
+  if (stored_count == stored_size) {
+    stored_size = (stored_size) ? stored_size * 2 : 256;
+    if (NULL == (stored_files = realloc(stored_files,stored_size * sizeof(stored_file *))))
+      st_error("could not allocate memory for fingerprint list");
+  }
+
+  if (NULL == (entry = calloc(1,sizeof(stored_file))) || NULL == (entry->filename = strdup(filename)))
+    st_error("could not allocate memory for fingerprint list");
+
+  entry->index = stored_count;
+
+  stored_files[stored_count++] = entry;
+
+  return entry;
+}
+
+static int stored_slot(stored_file *entry,hash_module *hash)
+/* returns the position of the fingerprint for hash in entry, or -1 if it has none */
+{
+  int i;
+
+  for (i=0;i<entry->count;i++)
+    if (entry->hash[i] == hash)
+      return i;
+
+  return -1;
+}
+
+static void stored_set(stored_file *entry,hash_module *hash,file_status *fs,unsigned char *digest)
+/* adds or replaces the fingerprint for hash in entry */
+{
+  int i;
+
+  if ((i = stored_slot(entry,hash)) < 0) {
+    if (MAX_HASHES == entry->count)
+      return;
+    i = entry->count++;
+    entry->hash[i] = hash;
+  }
+
+  entry->status[i] = *fs;
+
+  memcpy(entry->digest[i],digest,hash->digest_size);
+}
+
+static bool stored_parse(char *line)
+/* adds one line of a fingerprint list to the entries, returning FALSE if it isn't understood */
+{
+  char *p,*name;
+  unsigned char digest[MAX_DIGEST_SIZE];
+  hash_module *hash = NULL;
+  stored_file *entry;
+  file_status fs;
+  int size,n;
+
+  if (!strncmp(line,STORED_MAGIC,strlen(STORED_MAGIC))) {
+    p = line + strlen(STORED_MAGIC);
+
+    if (':' == *p) {
+      name = ++p;
+      p += strcspn(p," ");
+      if (0 == *p)
+        return FALSE;
+      *p = 0;
+      hash = find_hash(name);
+      *p = ' ';
+      if (NULL == hash)
+        return FALSE;
+    }
+
+    if (' ' != *p || 3 != sscanf(p,"%lu %lu %lu%n",&fs.size,&fs.mtime,&fs.inode,&n) || strncmp(p + n,"  ",2) || 0 == p[n+2])
+      return FALSE;
+
+    fs.valid = TRUE;
+
+    entry = stored_entry(p + n + 2);
+    entry->comment = fs;
+    entry->untagged = hash;
+
+    return TRUE;
+  }
+
+  if ('#' == *line || 0 == *line)
+    return TRUE;
+
+  if ((size = parse_digest(line,digest)) < 0)
+    return FALSE;
+
+  p = line + 2 * size;
+
+  if (strncmp(p,"  [shntool",10))
+    return FALSE;
+
+  p += 10;
+
+  if (':' == *p) {
+    name = ++p;
+    p += strcspn(p,"]");
+    if (0 == *p)
+      return FALSE;
+    *p = 0;
+    hash = find_hash(name);
+    *p = ']';
+    if (NULL == hash) {
+      st_debug1("ignoring stored fingerprint with unknown algorithm in line: [%s]",line);
+      return TRUE;
+    }
+  }
+
+  if (strncmp(p,"]  ",3) || 0 == p[3])
+    return FALSE;
+
+  entry = stored_entry(p + 3);
+
+  if (NULL == hash)
+    hash = (entry->untagged) ? entry->untagged : untagged_hash(size);
+
+  if (NULL == hash || size != hash->digest_size)
+    return FALSE;
+
+  stored_set(entry,hash,&entry->comment,digest);
+
+  return TRUE;
+}
+
+static void stored_sort()
+/* prepares the entries for lookups by filename */
+{
+  int i;
+
+  if (NULL == (stored_sorted = malloc((stored_count + 1) * sizeof(stored_file *))))
+    st_error("could not allocate memory for fingerprint list");
+
+  for (i=0;i<stored_count;i++)
+    stored_sorted[i] = stored_files[i];
+
+  sorted_count = stored_count;
+
+  qsort(stored_sorted,sorted_count,sizeof(stored_file *),compare_stored);
+}
+
+static void stored_load()
+/* reads the fingerprint list, if it exists yet, and adds an entry for each valid input file */
+{
+  FILE *f;
+  char line[STORED_LINE_SIZE];
+  int i,lineno = 0,len;
+
+  if (NULL == stored_list)
+    return;
+
+  if (NULL == (f = fopen(stored_list,"r"))) {
+    if (ENOENT != errno || verify_stored)
+      st_error("could not open fingerprint list: [%s]: %s",stored_list,strerror(errno));
+    st_debug1("starting new fingerprint list: [%s]",stored_list);
+  }
+  else {
+    while (fgets(line,STORED_LINE_SIZE,f)) {
+      lineno++;
+
+      len = strlen(line);
+      if (len > 0 && '\n' != line[len-1] && !feof(f))
+        st_error("line %d of fingerprint list is too long: [%s]",lineno,stored_list);
+
+      while (len > 0 && ('\n' == line[len-1] || '\r' == line[len-1]))
+        line[--len] = 0;
+
+      if (!stored_parse(line))
+        st_warning("ignoring unrecognized line %d of fingerprint list: [%s]",lineno,stored_list);
+    }
+
+    if (ferror(f))
+      st_error("error while reading fingerprint list: [%s]",stored_list);
+
+    fclose(f);
+
+    st_debug1("read %d entries from fingerprint list: [%s]",stored_count,stored_list);
+  }
+
+  stored_sort();
+
+  /* input files not in the list yet go at the end of it */
+  for (i=0;i<numfiles;i++)
+    stored_entry(files[i]->filename);
+
+  st_free(stored_sorted);
+
+  stored_sort();
+}
+
+static void stored_save()
+/* writes the fingerprint list back, if anything in it changed */
+{
+  FILE *f = NULL;
+  char tmp[FILENAME_SIZE],hex[2*MAX_DIGEST_SIZE+1];
+  stored_file *entry;
+  file_status *fs = NULL;
+  bool tagged,ok;
+  int i,j,pass,fd;
+
+  if (NULL == stored_list || verify_stored || !stored_changed)
+    return;
+
+  st_snprintf(tmp,FILENAME_SIZE,"%s.%ld",stored_list,(long)getpid());
+
+  if (-1 == (fd = open(tmp,O_WRONLY|O_CREAT|O_EXCL,0666)) || NULL == (f = fdopen(fd,"w")))
+    st_error("could not create temporary fingerprint list: [%s]: %s",tmp,strerror(errno));
+
+  for (i=0;i<stored_count;i++) {
+    entry = stored_files[i];
+
+    if (0 == entry->count)
+      continue;
+
+    /* a lone fingerprint is written the way hash mode prints it, as long as its algorithm can be told */
+    tagged = (1 != entry->count || (!entry->status[0].valid && entry->hash[0] != untagged_hash(entry->hash[0]->digest_size)));
+
+    /* fingerprints with no status go first, then the others after a comment with their status */
+    fs = NULL;
+
+    for (pass=0;pass<2;pass++) {
+      for (j=0;j<entry->count;j++) {
+        if (entry->status[j].valid != (1 == pass))
+          continue;
+        if (entry->status[j].valid && (NULL == fs || !same_status(fs,&entry->status[j]))) {
+          fs = &entry->status[j];
+          fprintf(f,"%s%s%s %lu %lu %lu  %s\n",STORED_MAGIC,(tagged) ? "" : ":",(tagged) ? "" : entry->hash[j]->name,
+                  fs->size,fs->mtime,fs->inode,entry->filename);
+        }
+        format_digest(hex,entry->digest[j],entry->hash[j]->digest_size);
+        if (tagged)
+          fprintf(f,"%s  [shntool:%s]  %s\n",hex,entry->hash[j]->name,entry->filename);
+        else
+          fprintf(f,"%s  [shntool]  %s\n",hex,entry->filename);
+      }
+    }
+  }
+
+  ok = !ferror(f);
+
+  if (fclose(f))
+    ok = FALSE;
+
+  if (!ok || rename(tmp,stored_list)) {
+    unlink(tmp);
+    st_error("could not write fingerprint list: [%s]",stored_list);
+  }
+
+  st_debug1("wrote %d entries to fingerprint list: [%s]",stored_count,stored_list);
+}
+
+static void stored_merge(void *data,int len)
+/* records a fingerprint in the list - jobs report these to the parent, which writes the list */
+{
+  stored_update *u = (stored_update *)data;
+  stored_file *entry;
+  hash_module *hash = &hash_modules[u->module];
+  int i,keep = 0;
+
+  if (sizeof(stored_update) != len || u->entry < 0 || u->entry >= stored_count)
+    return;
+
+  entry = stored_files[u->entry];
+
+  if ((i = stored_slot(entry,hash)) >= 0 && !memcmp(entry->digest[i],u->digest,hash->digest_size) &&
+      (same_status(&entry->status[i],&u->status) || (!entry->status[i].valid && !u->status.valid)))
+    return;
+
+  /* fingerprints generated when the file had another known status no longer describe it */
+  for (i=0;i<entry->count;i++) {
+    if (u->status.valid && entry->status[i].valid && !same_status(&entry->status[i],&u->status))
+      continue;
+    entry->hash[keep] = entry->hash[i];
+    entry->status[keep] = entry->status[i];
+    memcpy(entry->digest[keep],entry->digest[i],MAX_DIGEST_SIZE);
+    keep++;
+  }
+
+  entry->count = keep;
+
+  stored_set(entry,hash,&u->status,u->digest);
+
+  stored_changed = TRUE;
+}
+
+#ifdef XATTR_HASHES
+
+static void xattr_name(char *name,hash_module *hash)
+{
+  st_snprintf(name,BUF_SIZE,"%s%s",XATTR_PREFIX,hash->name);
+}
+
+#endif
+
+static bool stored_get(char *filename,hash_module *hash,file_status *fs,unsigned char *digest)
+/* gets the stored fingerprint of filename for hash, and the status of the file when it was generated */
+{
+  stored_file *entry;
+  int i;
+#ifdef XATTR_HASHES
+  char name[BUF_SIZE],value[BUF_SIZE];
+  ssize_t len;
+#endif
+
+  fs->valid = FALSE;
+
+  if (stored_list) {
+    if (NULL == (entry = stored_find(filename)) || (i = stored_slot(entry,hash)) < 0)
+      return FALSE;
+    *fs = entry->status[i];
+    memcpy(digest,entry->digest[i],hash->digest_size);
+    return TRUE;
+  }
+
+#ifdef XATTR_HASHES
+  xattr_name(name,hash);
+
+  if ((len = XATTR_GET(filename,name,value,BUF_SIZE-1)) <= 0)
+    return FALSE;
+
+  value[len] = 0;
+
+  /* the fingerprint, followed by the status of the file if it was known */
+  if (hash->digest_size != parse_digest(value,digest)) {
+    st_debug1("ignoring unrecognized extended attribute [%s] of file: [%s]",name,filename);
+    return FALSE;
+  }
+
+  if (3 == sscanf(value + 2 * hash->digest_size,"%lu %lu %lu",&fs->size,&fs->mtime,&fs->inode))
+    fs->valid = TRUE;
+
+  return TRUE;
+#else
+  return FALSE;
+#endif
+}
+
+static void stored_put(char *filename,hash_module *hash,file_status *fs,unsigned char *digest)
+/* stores the fingerprint of filename for hash, along with the status of the file, if known */
+{
+  stored_update u;
+  stored_file *entry;
+#ifdef XATTR_HASHES
+  char name[BUF_SIZE],value[BUF_SIZE],old[BUF_SIZE];
+  ssize_t len;
+#endif
+
+  if (stored_list) {
+    if (NULL == (entry = stored_find(filename)))
+      return;
+    memset(&u,0,sizeof(stored_update));
+    u.entry = entry->index;
+    u.module = (int)(hash - hash_modules);
+    u.status = *fs;
+    memcpy(u.digest,digest,hash->digest_size);
+    if (job_count() > 1)
+      job_report(&u,sizeof(stored_update));
+    else
+      stored_merge(&u,sizeof(stored_update));
+    return;
+  }
+
+#ifdef XATTR_HASHES
+  xattr_name(name,hash);
+
+  format_digest(value,digest,hash->digest_size);
+
+  /* a file whose status isn't known gets its fingerprint checked next time */
+  if (fs->valid)
+    st_snprintf(value + 2 * hash->digest_size,BUF_SIZE - 2 * hash->digest_size," %lu %lu %lu",fs->size,fs->mtime,fs->inode);
+
+  /* setting an attribute updates the ctime of the file, so leave an unchanged one alone */
+  if ((len = XATTR_GET(filename,name,old,BUF_SIZE-1)) == (ssize_t)strlen(value) && !memcmp(old,value,len))
+    return;
+
+  if (XATTR_SET(filename,name,value,strlen(value)))
+    st_warning("could not store %s fingerprint in extended attribute of file: [%s]: %s",hash->name,filename,strerror(errno));
+#endif
+}
+
+static bool picked_for_sample(char *filename)
+/* decides whether -n picks an unchanged file to be checked, independently of which job looks at it */
+{
+  unsigned long h = sample_seed;
+  char *p;
+
+  for (p=filename;*p;p++)
+    h = (h ^ (unsigned char)*p) * 16777619UL;
+
+  h ^= h >> 13;
+  h *= 2654435761UL;
+  h ^= h >> 16;
+
+  return ((double)(h % 1000000UL) < sample_percent * 10000.0);
+}
+
+static int stored_lookup(wave_info *info,file_status *now)
+/* gets the status of the file, and decides whether its stored fingerprints can be used as they are.
+ * when they can, they are left in audio_hash.
+ */
+{
+  file_status was;
+  int j;
+
+  if (!storing() || !get_file_status(info->filename,now))
+    return STORED_NONE;
+
+  for (j=0;j<num_hashes;j++)
+    if (!stored_get(info->filename,hashes[j],&was,audio_hash[j]) || !same_status(&was,now))
+      return STORED_NONE;
+
+  if (sample_percent > 0.0 && picked_for_sample(info->filename)) {
+    st_debug1("checking stored fingerprints of unchanged file: [%s]",info->filename);
+    return STORED_SAMPLED;
+  }
+
+  st_debug1("using stored fingerprints of unchanged file: [%s]",info->filename);
+
+  return STORED_CURRENT;
+}
+
+static bool stored_check(wave_info *info,file_status *now)
+/* checks the fingerprints just generated in audio_hash against the stored ones, and stores them unless only verifying */
+{
+  unsigned char stored[MAX_HASHES][MAX_DIGEST_SIZE];
+  file_status was,after;
+  bool success = TRUE,keep[MAX_HASHES];
+  int j;
+
+  if (!storing() || !now->valid)
+    return TRUE;
+
+  /* a file that changed while it was hashed, or that might change again unnoticed, is stored without its status */
+  if (!get_file_status(info->filename,&after) || !same_status(now,&after) ||
+      (unsigned long)time(NULL) < now->mtime + STORED_MIN_AGE)
+    after.valid = FALSE;
+
+  for (j=0;j<num_hashes;j++) {
+    keep[j] = FALSE;
+
+    if (!stored_get(info->filename,hashes[j],&was,stored[j])) {
+      if (verify_stored)
+        st_warning("no stored %s fingerprint for file: [%s]",hashes[j]->name,info->filename);
+      continue;
+    }
+
+    if (!memcmp(stored[j],audio_hash[j],hashes[j]->digest_size))
+      continue;
+
+    if (same_status(&was,now)) {
+      st_warning("stored %s fingerprint does not match decoded data in unchanged file: [%s]",hashes[j]->name,info->filename);
+      keep[j] = TRUE;
+      success = FALSE;
+    }
+    else if (verify_stored || !was.valid) {
+      st_warning("stored %s fingerprint does not match decoded data in file: [%s]",hashes[j]->name,info->filename);
+      keep[j] = TRUE;
+      success = FALSE;
+    }
+    else
+      st_debug1("replacing stored %s fingerprint of modified file: [%s]",hashes[j]->name,info->filename);
+  }
+
+  if (verify_stored)
+    return success;
+
+  /* a mismatched fingerprint is kept, but without the status of the file, so it is checked again next time */
+  if (!success)
+    after.valid = FALSE;
+
+  for (j=0;j<num_hashes;j++)
+    stored_put(info->filename,hashes[j],&after,(keep[j]) ? stored[j] : audio_hash[j]);
+
+  return success;
+}
+
+static bool generate_audio_hash_single(wave_info *info)
+{
+  unsigned char *header,embedded_hash[16];
+  int retval,stored;
+  bool success,has_embedded_hash;
+  file_status now;
+
+  success = FALSE;
+
+  proginfo.initialized = FALSE;
+  proginfo.filename2 = info->filename;
+  proginfo.filedesc2 = info->m_ss;
+  proginfo.bytes_total = info->data_size;
+
+  stored = stored_lookup(info,&now);
+
+  has_embedded_hash = (STORED_CURRENT != stored && read_embedded_hash(info,embedded_hash));
+
+  prog_update(&proginfo);
+
+  /* the fingerprints stored by an earlier run still hold */
+  if (STORED_CURRENT == stored) {
+    prog_success(&proginfo);
+    print_audio_hash(info->filename);
+    return TRUE;
+  }
+
+  /* the file already knows its fingerprint, so there is nothing to decode */
+  if (has_embedded_hash && !verify_embedded && STORED_SAMPLED != stored && 1 == num_hashes) {
+    memcpy(audio_hash[0],embedded_hash,16);
+    prog_success(&proginfo);
+    print_audio_hash(info->filename);
+    return stored_check(info,&now);
+  }
+
+  if (!open_input_stream(info)) {
+    st_warning("could not reopen input file: [%s]",info->filename);
+    return FALSE;
+  }
+
+  if (NULL == (header = malloc(info->header_size * sizeof(unsigned char)))) {
+    prog_error(&proginfo);
+    st_warning("could not allocate %d-byte WAVE header",info->header_size);
+    goto cleanup_single1;
+  }
+
+  if (read_n_bytes(info->input,header,info->header_size,NULL) != info->header_size) {
+    prog_error(&proginfo);
+    st_warning("error while discarding %d-byte WAVE header from file: [%s]",info->header_size,info->filename);
+    goto cleanup_single2;
+  }
+
+  maxbytes = info->data_size;
+  remaining_bytes = 0;
+
+  /* Initialize the computation context.  */
+  hash_init_ctx();
+
+  retval = hash_input(info);
+
+  /* Add the last bytes if necessary.  */
+  if (remaining_bytes > 0)
+    hash_process_bytes();
+
+  /* Construct result in desired memory.  */
+  hash_finish_ctx();
+
+  if (retval) {
+    prog_error(&proginfo);
+    st_warning("possibly truncated and/or corrupt file: [%s]",info->filename);
+    goto cleanup_single2;
+  }
+
+  success = TRUE;
+
+  prog_success(&proginfo);
+
+  print_audio_hash(info->filename);
+
+  if (has_embedded_hash && memcmp(audio_hash[hash_index("md5")],embedded_hash,16)) {
+    st_warning("embedded MD5 signature does not match decoded data in file: [%s]",info->filename);
+    success = FALSE;
+  }
+
+  if (!stored_check(info,&now))
+    success = FALSE;
+
+cleanup_single2:
   st_free(header);
 
 cleanup_single1:
@@ -1194,7 +2978,7 @@ static bool generate_audio_hash_composite(wave_info *info)
 
   maxbytes = info->data_size - bytes_to_read;
 
-  retval = hash_stream(info->input);
+  retval = hash_input(info);
 
   if (retval)
     st_error("possibly truncated and/or corrupt file: [%s]",info->filename);
@@ -1231,6 +3015,330 @@ static bool process_file(char *filename)
   return success;
 }
 
+/*
+ * multi-buffer hashing: when the only algorithm can hash several streams at once, the separate
+ * fingerprints of several files are generated together, one file per vector lane.  each lane is
+ * fed from its own input a buffer at a time, any decoders all run at once, and results are printed
+ * in input order.  only the earliest file not yet printed shows its progress.
+ */
+
+enum {
+  LANE_INVALID,                 /* not a valid input file */
+  LANE_BUSY,                    /* still being hashed */
+  LANE_DONE,                    /* fingerprint generated */
+  LANE_REOPEN,                  /* input file could not be reopened */
+  LANE_HEADER,                  /* WAVE header could not be read */
+  LANE_TRUNCATED                /* WAVE data ended early */
+};
+
+typedef struct _lane_file {
+  char *filename;
+  wave_info *info;
+  void *ctx;                    /* computation context */
+  unsigned char *buffer;        /* WAVE data read but not yet hashed */
+  size_t avail;                 /* bytes waiting in buffer */
+  wlong left;                   /* WAVE data bytes not yet read */
+  wlong hashed;                 /* WAVE data bytes hashed so far */
+  bool truncated;               /* whether the WAVE data ended early */
+  bool has_embedded_hash;
+  unsigned char embedded_hash[16];
+  int stored;                   /* what to make of the stored fingerprint */
+  file_status now;              /* status of the file when it was opened */
+  int status;
+  unsigned char hash[MAX_DIGEST_SIZE];
+  struct _lane_file *next;      /* next file in input order */
+} lane_file;
+
+static lane_file *lane_head = NULL;     /* earliest file not yet printed */
+static lane_file *lane_tail = NULL;     /* latest file opened */
+static lane_file *lane_shown = NULL;    /* file whose progress is on screen */
+
+static int lane_width()
+/* returns how many files to hash together, or 1 to hash them one at a time */
+{
+  if (composite_hash || 1 != num_hashes || NULL == hashes[0]->process_lanes || job_count() > 1 || numfiles < 2)
+    return 1;
+
+  return min(vec_hash_lanes(),MAX_HASH_LANES);
+}
+
+static bool prescanned(char *filename)
+/* checks whether process() found the given file to be valid */
+{
+  int i;
+
+  for (i=0;i<numfiles;i++)
+    if (!strcmp(files[i]->filename,filename))
+      return TRUE;
+
+  return FALSE;
+}
+
+static lane_file *lane_open(char *filename)
+/* opens the next file to hash, and queues it for its result to be printed */
+{
+  lane_file *f;
+  wave_info *info;
+  unsigned char *header;
+  bool header_ok;
+
+  if (NULL == (f = calloc(1,sizeof(lane_file))) || NULL == (f->filename = strdup(filename)))
+    st_error("could not allocate memory for hashing state of file: [%s]",filename);
+
+  if (lane_tail)
+    lane_tail->next = f;
+  else
+    lane_head = f;
+  lane_tail = f;
+
+  /* leave the warnings about invalid files until their turn, rather than in the middle of another file's progress */
+  if (!prescanned(filename) || NULL == (info = new_wave_info(filename))) {
+    f->status = LANE_INVALID;
+    return f;
+  }
+
+  num_processed++;
+
+  f->info = info;
+  f->status = LANE_BUSY;
+
+  /* the fingerprint stored by an earlier run still holds */
+  if (STORED_CURRENT == (f->stored = stored_lookup(info,&f->now))) {
+    memcpy(f->hash,audio_hash[0],hashes[0]->digest_size);
+    f->status = LANE_DONE;
+    return f;
+  }
+
+  f->has_embedded_hash = read_embedded_hash(info,f->embedded_hash);
+
+  /* the file already knows its fingerprint, so there is nothing to decode */
+  if (f->has_embedded_hash && !verify_embedded && STORED_SAMPLED != f->stored) {
+    memcpy(f->hash,f->embedded_hash,16);
+    f->status = LANE_DONE;
+    return f;
+  }
+
+  if (!open_input_stream(info)) {
+    f->status = LANE_REOPEN;
+    return f;
+  }
+
+  header_ok = (NULL != (header = malloc(info->header_size * sizeof(unsigned char))) &&
+               read_n_bytes(info->input,header,info->header_size,NULL) == info->header_size);
+
+  st_free(header);
+
+  if (!header_ok) {
+    close_input_stream(info);
+    f->status = LANE_HEADER;
+    return f;
+  }
+
+  if (NULL == (f->ctx = malloc(hashes[0]->ctx_size)) || NULL == (f->buffer = malloc(HASH_BUFFER_SIZE)))
+    st_error("could not allocate memory for hashing state of file: [%s]",filename);
+
+  hashes[0]->init_ctx(f->ctx);
+
+  f->left = info->data_size;
+
+  return f;
+}
+
+static void lane_fill(lane_file *f)
+/* reads WAVE data until the buffer is full or the data runs out */
+{
+  int want,n;
+
+  if (0 == f->left || f->avail >= HASH_BUFFER_SIZE)
+    return;
+
+  want = (int)min(HASH_BUFFER_SIZE - f->avail,f->left);
+
+  if ((n = read_n_bytes(f->info->input,f->buffer + f->avail,want,NULL)) < 0)
+    n = 0;
+
+  f->avail += n;
+  f->left -= n;
+
+  if (n != want) {
+    f->left = 0;
+    f->truncated = TRUE;
+  }
+}
+
+static void lane_finish(lane_file *f)
+/* hashes the last bytes of a file that has read all of its WAVE data */
+{
+  hashes[0]->process_bytes(f->buffer,f->avail,f->ctx);
+  hashes[0]->finish_ctx(f->ctx,f->hash);
+
+  f->hashed += f->avail;
+  f->status = (f->truncated) ? LANE_TRUNCATED : LANE_DONE;
+
+  close_input_stream(f->info);
+
+  st_free(f->buffer);
+  st_free(f->ctx);
+  f->buffer = NULL;
+  f->ctx = NULL;
+}
+
+static void lane_progress(lane_file *f)
+/* shows the progress of a file, starting its progress line if needed */
+{
+  if (f != lane_shown) {
+    proginfo.initialized = FALSE;
+    proginfo.filename2 = f->info->filename;
+    proginfo.filedesc2 = f->info->m_ss;
+    proginfo.bytes_total = f->info->data_size;
+
+    prog_update(&proginfo);
+
+    lane_shown = f;
+  }
+
+  proginfo.bytes_written = f->hashed;
+
+  prog_update(&proginfo);
+}
+
+static bool lane_print(lane_file *f)
+/* reports the result for a file, the way generate_audio_hash_single() would have */
+{
+  wave_info *info;
+  bool success = FALSE;
+
+  if (LANE_INVALID == f->status) {
+    /* let new_wave_info() say what is wrong with it */
+    if ((info = new_wave_info(f->filename)))
+      st_free(info);
+    st_free(f->filename);
+    st_free(f);
+    return FALSE;
+  }
+
+  lane_progress(f);
+
+  switch (f->status) {
+    case LANE_DONE:
+      success = TRUE;
+      prog_success(&proginfo);
+      memcpy(audio_hash[0],f->hash,hashes[0]->digest_size);
+      print_audio_hash(f->info->filename);
+      if (f->has_embedded_hash && memcmp(f->hash,f->embedded_hash,16)) {
+        st_warning("embedded MD5 signature does not match decoded data in file: [%s]",f->info->filename);
+        success = FALSE;
+      }
+      if (STORED_CURRENT != f->stored && !stored_check(f->info,&f->now))
+        success = FALSE;
+      break;
+    case LANE_REOPEN:
+      st_warning("could not reopen input file: [%s]",f->info->filename);
+      break;
+    case LANE_HEADER:
+      prog_error(&proginfo);
+      st_warning("error while discarding %d-byte WAVE header from file: [%s]",f->info->header_size,f->info->filename);
+      break;
+    case LANE_TRUNCATED:
+      prog_error(&proginfo);
+      st_warning("possibly truncated and/or corrupt file: [%s]",f->info->filename);
+      break;
+  }
+
+  lane_shown = NULL;
+
+  st_free(f->info);
+  st_free(f->filename);
+  st_free(f);
+
+  return success;
+}
+
+static bool lane_flush()
+/* prints the results of all finished files that no unfinished file precedes */
+{
+  lane_file *f;
+  bool success = TRUE;
+
+  while (lane_head && LANE_BUSY != lane_head->status) {
+    f = lane_head;
+    if (NULL == (lane_head = f->next))
+      lane_tail = NULL;
+    success = (lane_print(f) && success);
+  }
+
+  return success;
+}
+
+static bool hash_files_together(int width)
+/* generates a separate fingerprint for each remaining input file, width files at a time */
+{
+  lane_file *lanes[MAX_HASH_LANES],*f;
+  void *ctx[MAX_HASH_LANES];
+  const unsigned char *data[MAX_HASH_LANES];
+  char *filename;
+  bool success = TRUE,more = TRUE;
+  int i,active = 0,blocks;
+  size_t used;
+
+  st_debug1("hashing up to %d files at once",width);
+
+  for (;;) {
+    /* keep every lane busy while there are files left */
+    while (more && active < width) {
+      if (NULL == (filename = input_get_filename())) {
+        more = FALSE;
+        break;
+      }
+      if (LANE_BUSY == (f = lane_open(filename))->status)
+        lanes[active++] = f;
+    }
+
+    /* read more data, and finish the files that have no whole blocks left */
+    for (i=0;i<active;) {
+      lane_fill(lanes[i]);
+      if (0 == lanes[i]->left && lanes[i]->avail < 64) {
+        lane_finish(lanes[i]);
+        lanes[i] = lanes[--active];
+      }
+      else
+        i++;
+    }
+
+    success = (lane_flush() && success);
+
+    if (0 == active) {
+      if (!more)
+        break;
+      continue;
+    }
+
+    /* hash as many whole blocks as every lane has */
+    blocks = HASH_BUFFER_SIZE / 64;
+    for (i=0;i<active;i++) {
+      blocks = min(blocks,(int)(lanes[i]->avail / 64));
+      ctx[i] = lanes[i]->ctx;
+      data[i] = lanes[i]->buffer;
+    }
+
+    hashes[0]->process_lanes(ctx,data,active,blocks);
+
+    used = 64 * blocks;
+
+    for (i=0;i<active;i++) {
+      lanes[i]->avail -= used;
+      lanes[i]->hashed += used;
+      if (lanes[i]->avail > 0)
+        memmove(lanes[i]->buffer,lanes[i]->buffer + used,lanes[i]->avail);
+    }
+
+    if (lane_head && LANE_BUSY == lane_head->status)
+      lane_progress(lane_head);
+  }
+
+  return success;
+}
+
 static void composite_init(wlong total)
 {
   if (!composite_hash)
@@ -1271,7 +3379,7 @@ static void composite_finish()
 
 static bool process(int argc,char **argv,int start)
 {
-  int i,j = 0,badfiles = 0;
+  int i,j = 0,badfiles = 0,width;
   char *filename;
   wlong total = 0;
   bool success;
@@ -1305,6 +3413,8 @@ static bool process(int argc,char **argv,int start)
 
   reorder_files(files,numfiles);
 
+  stored_load();
+
   proginfo.prefix = "Hashing";
   proginfo.clause = NULL;
   proginfo.filename1 = NULL;
@@ -1314,12 +3424,23 @@ static bool process(int argc,char **argv,int start)
 
   input_init(start,argc,argv);
 
-  while ((filename = input_get_filename())) {
-    success = (process_file(filename) && success);
+  if (composite_hash) {
+    /* a composite fingerprint runs every file through one hash context, so they must be done in order */
+    while ((filename = input_get_filename())) {
+      success = (process_file(filename) && success);
+    }
   }
+  else if ((width = lane_width()) > 1)
+    success = (hash_files_together(width) && success);
+  else
+    success = (process_input_files(process_file,stored_merge) && success);
 
   composite_finish();
 
+  stored_save();
+
+  hash_cleanup();
+
   for (i=0;i<numfiles;i++)
     st_free(files[i]);
 
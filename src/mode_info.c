@@ -29,6 +29,7 @@ mode_module mode_info = {
   "Displays detailed information about PCM WAVE data",
   CVSIDSTR,
   FALSE,
+  TRUE,
   info_main,
   info_help
 };
@@ -187,16 +188,11 @@ static bool process_file(char *filename)
 
 static bool process(int argc,char **argv,int start)
 {  
-  char *filename;
   bool success;
 
-  success = TRUE;
-
   input_init(start,argc,argv);
 
-  while ((filename = input_get_filename())) {
-    success = (process_file(filename) && success);
-  }
+  success = process_input_files(process_file,NULL);
 
   return success;
 }
@@ -30,6 +30,7 @@ mode_module mode_join = {
   "Joins PCM WAVE data from multiple files into one",
   CVSIDSTR,
   TRUE,
+  FALSE,
   join_main,
   join_help
 };
@@ -30,6 +30,7 @@ mode_module mode_len = {
   "Displays length, size and properties of PCM WAVE data",
   CVSIDSTR,
   FALSE,
+  TRUE,
   len_main,
   len_help
 };
@@ -46,6 +47,14 @@ typedef enum {
   LEVEL_TBYTES
 } len_levels;
 
+typedef struct _len_report {
+  wlong total_size;
+  wlong data_size;
+  wlong avg_bytes_per_sec;
+  wlong actual_size;
+  unsigned long problems;
+} len_report;
+
 static int totals_unit_level = LEVEL_UNKNOWN;
 static int file_unit_level = LEVEL_UNKNOWN;
 static int num_processed = 0;
@@ -312,16 +321,21 @@ static void show_totals_line()
   st_free(info);
 }
 
-static void update_totals(wave_info *info)
+static void update_totals(void *data,int len)
 {
-  total_size += (double)info->total_size;
-  total_data_size += (double)info->data_size;
-  total_length += (double)info->data_size / (double)info->avg_bytes_per_sec;
+  len_report *r = (len_report *)data;
 
-  if (PROB_NOT_CD(info))
+  if (sizeof(len_report) != len)
+    return;
+
+  total_size += (double)r->total_size;
+  total_data_size += (double)r->data_size;
+  total_length += (double)r->data_size / (double)r->avg_bytes_per_sec;
+
+  if (PROB_NOT_CD(r))
     all_cd_quality = FALSE;
 
-  total_disk_size += (double)info->actual_size;
+  total_disk_size += (double)r->actual_size;
 
   num_processed++;
 }
@@ -329,13 +343,20 @@ static void update_totals(wave_info *info)
 static bool process_file(char *filename)
 {
   wave_info *info;
+  len_report r;
   bool success;
 
   if (NULL == (info = new_wave_info(filename)))
     return FALSE;
 
-  if ((success = show_stats(info)))
-    update_totals(info);
+  if ((success = show_stats(info))) {
+    r.total_size = info->total_size;
+    r.data_size = info->data_size;
+    r.avg_bytes_per_sec = info->avg_bytes_per_sec;
+    r.actual_size = info->actual_size;
+    r.problems = info->problems;
+    job_report(&r,sizeof(len_report));
+  }
 
   st_free(info);
 
@@ -344,18 +365,13 @@ static bool process_file(char *filename)
 
 static bool process(int argc,char **argv,int start)
 {
-  char *filename;
   bool success;
 
-  success = TRUE;
-
   show_len_banner();
 
   input_init(start,argc,argv);
 
-  while ((filename = input_get_filename())) {
-    success = (process_file(filename) && success);
-  }
+  success = process_input_files(process_file,update_totals);
 
   show_totals_line();
 
@@ -31,6 +31,7 @@ mode_module mode_split = {
   "Splits PCM WAVE data from one file into multiple files",
   CVSIDSTR,
   TRUE,
+  FALSE,
   split_main,
   split_help
 };
@@ -57,6 +58,12 @@ static char *leadin = NULL;
 static char *leadout = NULL;
 static char *extract_tracks = NULL;
 static char *manipulate_chars = NULL;
+static char *gap_length = NULL;
+static long gap_level = 0;
+static bool snap_to_sectors = FALSE;
+static int gap_word_size = 2;
+static long gap_word_level = 0;
+static FILE *spool = NULL;
 
 typedef struct _cue_info {
   /* global */
@@ -86,9 +93,11 @@ static void split_help()
   st_info("\n");
   st_info("Mode-specific options:\n");
   st_info("\n");
+  st_info("  -b      with -g, move split points to the nearest sector boundary within each gap\n");
   st_info("  -c num  start counting from num when naming output files (default is 1)\n");
   st_info("  -e len  prefix each track with len amount of lead-in from previous track (*)\n");
   st_info("  -f file read split point data from file\n");
+  st_info("  -g len  split at the middle of each gap of silence lasting at least len (*)\n");
   st_info("  -h      show this help screen\n");
   st_info("  -l len  split input file into files of length len (*)\n");
   st_info("  -m str  specify character manipulation string (alternating from/to)\n");
@@ -97,6 +106,7 @@ static void split_help()
     st_info(SPLIT_NUM_FORMAT ", ",i+1);
   }
   st_info("...)\n");
+  st_info("  -s lvl  with -g, samples within +/- lvl on a 16-bit scale count as silence (default is 0)\n");
   st_info("  -t fmt  name output files in user-specified format based on CUE sheet fields.\n");
   st_info("          (%%p = performer, %%a = album, %%t = track title, %%n = track number)\n");
   st_info("  -u len  postfix each track with len amount of lead-out from next track (*)\n");
@@ -116,8 +126,11 @@ static void parse(int argc,char **argv,int *first_arg)
   st_ops.output_prefix = SPLIT_PREFIX;
   cueinfo.format = NULL;
 
-  while ((c = st_getopt(argc,argv,"c:e:f:l:n:m:t:u:x:")) != -1) {
+  while ((c = st_getopt(argc,argv,"bc:e:f:g:l:n:m:s:t:u:x:")) != -1) {
     switch (c) {
+      case 'b':
+        snap_to_sectors = TRUE;
+        break;
       case 'c':
         if (NULL == optarg)
           st_error("missing starting count");
@@ -135,6 +148,11 @@ static void parse(int argc,char **argv,int *first_arg)
           st_error("missing split point file");
         split_point_file = optarg;
         break;
+      case 'g':
+        if (NULL == optarg)
+          st_error("missing gap length");
+        gap_length = optarg;
+        break;
       case 'l':
         if (NULL == optarg)
           st_error("missing repeated split point");
@@ -150,6 +168,13 @@ static void parse(int argc,char **argv,int *first_arg)
           st_error("missing number output format");
         num_format = optarg;
         break;
+      case 's':
+        if (NULL == optarg)
+          st_error("missing silence level");
+        gap_level = atol(optarg);
+        if (gap_level < 0 || gap_level > 32767)
+          st_help("silence level must be between 0 and 32767");
+        break;
       case 't':
         if (NULL == optarg)
           st_error("missing cue format");
@@ -171,7 +196,13 @@ static void parse(int argc,char **argv,int *first_arg)
     }
   }
 
-  if (optind >= argc && !split_point_file)
+  if (gap_length && (split_point_file || repeated_split_point))
+    st_help("gaps of silence cannot be combined with other split points");
+
+  if ((snap_to_sectors || gap_level > 0) && !gap_length)
+    st_help("sector boundaries and silence level can only be used when splitting at gaps of silence");
+
+  if (optind >= argc && !split_point_file && !gap_length)
     st_help("if file to be split is not given, then a split point file must be specified");
 
   *first_arg = optind;
@@ -212,14 +243,90 @@ static void adjust_for_leadinout(wlong leadin_bytes,wlong leadout_bytes)
   }
 }
 
+static void skip_input(wave_info *info,wlong *pos,wlong to,wlong end,progress_info *proginfo)
+/* moves the input on to offset 'to' of the WAVE data, seeking over or not decoding what lies before it where possible */
+{
+  unsigned char *buf;
+  wlong bytes,skipped;
+
+  if (NULL == info->input) {
+    if (spool) {
+      /* the data was decoded while looking for gaps, so read it back instead of decoding it again */
+      if (fseek(spool,(long)to,SEEK_SET)) {
+        prog_error(proginfo);
+        st_error("could not seek within temporary file holding decoded data");
+      }
+      info->input = spool;
+      info->input_proc.pid = NO_CHILD_PID;
+    }
+    else if (!open_input_stream_range(info,to,end)) {
+      prog_error(proginfo);
+      st_error("could not reopen input file: [%s]",info->filename);
+    }
+
+    *pos = to;
+    return;
+  }
+
+  if (to <= *pos)
+    return;
+
+  bytes = to - *pos;
+  *pos = to;
+  skipped = bytes;
+
+  if (NO_CHILD_PID == info->input_proc.pid && 0 == fseek(info->input,(long)bytes,SEEK_CUR))
+    return;
+
+  /* restarting the decoder further on costs less than decoding everything in between */
+  if (info->input_format->decoder_range_args && bytes > XFER_SIZE) {
+    close_input_stream(info);
+
+    if (!open_input_stream_range(info,to,end)) {
+      prog_error(proginfo);
+      st_error("could not reopen input file: [%s]",info->filename);
+    }
+
+    return;
+  }
+
+  if (NULL == (buf = malloc(XFER_SIZE * sizeof(unsigned char)))) {
+    prog_error(proginfo);
+    st_error("could not allocate %d-byte buffer to skip input",XFER_SIZE);
+  }
+
+  while (bytes > 0) {
+    if (read_n_bytes(info->input,buf,(int)min(bytes,XFER_SIZE),NULL) != (int)min(bytes,XFER_SIZE)) {
+      prog_error(proginfo);
+      st_error("error while skipping %lu bytes of data",skipped);
+    }
+    bytes -= min(bytes,XFER_SIZE);
+  }
+
+  st_free(buf);
+}
+
+static wlong unique_bytes(int current,wlong leadin_bytes,wlong leadout_bytes)
+/* returns the amount of data that goes to this file alone, and not to its neighbors as lead-in/lead-out */
+{
+  wlong bytes = files[current]->new_data_size;
+
+  if (0 != current)
+    bytes -= leadout_bytes;
+  if (numfiles - 1 != current)
+    bytes -= leadin_bytes;
+
+  return bytes;
+}
+
 static bool split_file(wave_info *info)
 {
   unsigned char header[CANONICAL_HEADER_SIZE];
   char outfilename[FILENAME_SIZE],filenum[FILENAME_SIZE];
   int current;
-  wint discard,bytes;
   bool success;
-  wlong leadin_bytes, leadout_bytes, bytes_to_xfer;
+  wlong leadin_bytes, leadout_bytes, bytes_to_xfer, overlap_bytes, transferred;
+  wlong data_offset, data_end, pos;
   progress_info proginfo;
 
   success = FALSE;
@@ -233,24 +340,30 @@ static bool split_file(wave_info *info)
   proginfo.filedesc2 = NULL;
   proginfo.bytes_total = 0;
 
-  if (!open_input_stream(info)) {
-    prog_error(&proginfo);
-    st_error("could not reopen input file: [%s]",info->filename);
-  }
+  leadin_bytes = (leadin) ? smrt_parse((unsigned char *)leadin,info) : 0;
+  leadout_bytes = (leadout) ? smrt_parse((unsigned char *)leadout,info) : 0;
+  adjust_for_leadinout(leadin_bytes,leadout_bytes);
 
-  discard = info->header_size;
-  while (discard > 0) {
-    bytes = min(discard,CANONICAL_HEADER_SIZE);
-    if (read_n_bytes(info->input,header,bytes,NULL) != bytes) {
-      prog_error(&proginfo);
-      st_error("error while discarding %d-byte WAVE header",info->header_size);
+  overlap_bytes = leadin_bytes + leadout_bytes;
+
+  /* find where the data needed by the last extracted file ends, so that nothing after it is decoded */
+  data_end = 0;
+  data_offset = 0;
+  for (current=0;current<numfiles;current++) {
+    if (0 != current) {
+      data_offset += overlap_bytes;
+      if (extract_track[current-1] || extract_track[current])
+        data_end = data_offset;
     }
-    discard -= bytes;
+    data_offset += unique_bytes(current,leadin_bytes,leadout_bytes);
+    if (extract_track[current])
+      data_end = data_offset;
   }
 
-  leadin_bytes = (leadin) ? smrt_parse((unsigned char *)leadin,info) : 0;
-  leadout_bytes = (leadout) ? smrt_parse((unsigned char *)leadout,info) : 0;
-  adjust_for_leadinout(leadin_bytes,leadout_bytes);
+  /* the input is opened when the first data that is needed comes up */
+  info->input = NULL;
+  data_offset = 0;
+  pos = 0;
 
   for (current=0;current<numfiles;current++) {
     if (SPLIT_INPUT_CUE == input_type && cueinfo.format) {
@@ -282,20 +395,22 @@ static bool split_file(wave_info *info)
       proginfo.prefix = "Splitting";
       proginfo.filename2 = outfilename;
 
+      /* make room for this file's encoder, next to the one still being fed the previous file */
+      reap_outputs_behind(output_encoders() - ((0 != current) ? 2 : 1));
+
       if (NULL == (files[current]->output = open_output_stream(outfilename,&files[current]->output_proc))) {
         prog_error(&proginfo);
         st_error("could not open output file");
       }
+
+      queue_output_stream(files[current]->output,&files[current]->output_proc);
     }
     else {
+      /* data only this file would get is never read, so there is no output to write it to */
       proginfo.prefix = "Skipping ";
       proginfo.filename2 = NULLDEVICE;
 
-      if (NULL == (files[current]->output = open_output(NULLDEVICE))) {
-        prog_error(&proginfo);
-        st_error("while skipping track %d: could not open output file: [%s]",current+1,NULLDEVICE);
-      }
-
+      files[current]->output = NULL;
       files[current]->output_proc.pid = NO_CHILD_PID;
     }
 
@@ -306,7 +421,7 @@ static bool split_file(wave_info *info)
 
     prog_update(&proginfo);
 
-    if (write_n_bytes(files[current]->output,header,CANONICAL_HEADER_SIZE,&proginfo) != CANONICAL_HEADER_SIZE) {
+    if (extract_track[current] && write_n_bytes(files[current]->output,header,CANONICAL_HEADER_SIZE,&proginfo) != CANONICAL_HEADER_SIZE) {
       prog_error(&proginfo);
       st_warning("error while writing %d-byte WAVE header",CANONICAL_HEADER_SIZE);
       goto cleanup;
@@ -315,37 +430,58 @@ static bool split_file(wave_info *info)
     /* if this is not the first file, finish up writing previous file, and simultaneously start writing to current file */
     if (0 != current) {
       /* write overlapping lead-in/lead-out data to both previous and current files */
-      if (transfer_n_bytes2(info->input,files[current]->output,files[current-1]->output,leadin_bytes+leadout_bytes,&proginfo) != leadin_bytes+leadout_bytes) {
-        prog_error(&proginfo);
-        st_warning("error while transferring %ld bytes of lead-in/lead-out",leadin_bytes+leadout_bytes);
-        goto cleanup;
+      if (extract_track[current-1] || extract_track[current]) {
+        skip_input(info,&pos,data_offset,data_end,&proginfo);
+
+        if (extract_track[current-1] && extract_track[current])
+          transferred = transfer_n_bytes2(info->input,files[current]->output,files[current-1]->output,overlap_bytes,&proginfo);
+        else
+          transferred = transfer_n_bytes(info->input,(extract_track[current]) ? files[current]->output : files[current-1]->output,overlap_bytes,&proginfo);
+
+        pos += transferred;
+
+        if (transferred != overlap_bytes) {
+          prog_error(&proginfo);
+          st_warning("error while transferring %ld bytes of lead-in/lead-out",overlap_bytes);
+          goto cleanup;
+        }
       }
 
+      data_offset += overlap_bytes;
+
       /* pad and close previous file */
-      if (PROB_ODD_SIZED_DATA(files[current-1]) && (1 != write_padding(files[current-1]->output,1,&proginfo))) {
-        prog_error(&proginfo);
-        st_warning("error while NULL-padding odd-sized data chunk");
-        goto cleanup;
-      }
+      if (extract_track[current-1]) {
+        if (PROB_ODD_SIZED_DATA(files[current-1]) && (1 != write_padding(files[current-1]->output,1,&proginfo))) {
+          prog_error(&proginfo);
+          st_warning("error while NULL-padding odd-sized data chunk");
+          goto cleanup;
+        }
 
-      close_output(files[current-1]->output,files[current-1]->output_proc);
+        close_output_behind(files[current-1]->output,&files[current-1]->output_proc);
+      }
     }
 
     /* transfer unique non-overlapping data from input file to current file */
-    bytes_to_xfer = files[current]->new_data_size;
-    if (0 != current)
-      bytes_to_xfer -= leadout_bytes;
-    if (numfiles - 1 != current)
-      bytes_to_xfer -= leadin_bytes;
+    bytes_to_xfer = unique_bytes(current,leadin_bytes,leadout_bytes);
 
-    if (transfer_n_bytes(info->input,files[current]->output,bytes_to_xfer,&proginfo) != bytes_to_xfer) {
-      prog_error(&proginfo);
-      st_warning("error while transferring %ld bytes of data",bytes_to_xfer);
-      goto cleanup;
+    if (extract_track[current]) {
+      skip_input(info,&pos,data_offset,data_end,&proginfo);
+
+      transferred = transfer_n_bytes(info->input,files[current]->output,bytes_to_xfer,&proginfo);
+
+      pos += transferred;
+
+      if (transferred != bytes_to_xfer) {
+        prog_error(&proginfo);
+        st_warning("error while transferring %ld bytes of data",bytes_to_xfer);
+        goto cleanup;
+      }
     }
 
+    data_offset += bytes_to_xfer;
+
     /* if this is the last file, close it */
-    if (numfiles - 1 == current) {
+    if (numfiles - 1 == current && extract_track[current]) {
       /* pad and close current file */
       if (PROB_ODD_SIZED_DATA(files[current]) && (1 != write_padding(files[current]->output,1,&proginfo))) {
         prog_error(&proginfo);
@@ -353,19 +489,25 @@ static bool split_file(wave_info *info)
         goto cleanup;
       }
 
-      close_output(files[current]->output,files[current]->output_proc);
+      close_output_behind(files[current]->output,&files[current]->output_proc);
     }
 
     prog_success(&proginfo);
   }
 
-  close_input_stream(info);
+  reap_outputs_behind(0);
+
+  if (info->input)
+    close_input_stream(info);
+  spool = NULL;
 
   success = TRUE;
 
 cleanup:
   if (!success) {
-    close_output(files[current]->output,files[current]->output_proc);
+    if (files[current]->output)
+      close_output(files[current]->output,files[current]->output_proc);
+    reap_outputs_behind(0);
     remove_file(outfilename);
     st_error("failed to split file");
   }
@@ -802,6 +944,193 @@ static void read_split_points_repeated(wave_info *info)
   numfiles++;
 }
 
+/*
+ * splitting at gaps reads the input once, looking for runs of silence at least as long as the
+ * given gap, where every sample stays within the silence level.  rather than testing each sample,
+ * the scan alternates between looking for the next quiet sample and the next loud one, skipping
+ * over music and silence a whole buffer at a time.  each gap gets a split point in its middle.
+ * decoded input is copied to a temporary file as it is scanned, so that split_file() can read
+ * it from there instead of running the decoder a second time.
+ */
+
+static long word_value(unsigned char *p)
+/* returns the value of a little-endian PCM sample */
+{
+  long v;
+
+  switch (gap_word_size) {
+    case 1:
+      return (long)p[0] - 128;
+    case 3:
+      v = (long)p[0] | ((long)p[1] << 8) | ((long)p[2] << 16);
+      return (v & 0x800000L) ? v - 0x1000000L : v;
+    case 4:
+      return (long)(int)((unsigned long)p[0] | ((unsigned long)p[1] << 8) | ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24));
+    default:
+      return (long)(short)(p[0] | (p[1] << 8));
+  }
+}
+
+static int find_sample(unsigned char *buf,int len,bool loud)
+/* returns the offset of the first sample in buf that is loud (or quiet), or -1 if there is none */
+{
+  long v;
+  int i;
+
+  if (2 == gap_word_size)
+    return (loud) ? vec_first_loud16(buf,len,(int)gap_word_level) : vec_first_quiet16(buf,len,(int)gap_word_level);
+
+  for (i=0;i+gap_word_size<=len;i+=gap_word_size) {
+    v = word_value(buf + i);
+    if (((v > gap_word_level || v < -gap_word_level) ? TRUE : FALSE) == loud)
+      return i;
+  }
+
+  return -1;
+}
+
+static void add_gap_split_point(wave_info *info,wlong gap_start,wlong gap_end,wlong *points,int *numpoints)
+{
+  wlong point,sector_point;
+
+  point = gap_start + (gap_end - gap_start) / 2;
+  point -= point % info->block_align;
+
+  /* a gap shorter than a sector might not contain a sector boundary */
+  sector_point = ((point + CD_BLOCK_SIZE / 2) / CD_BLOCK_SIZE) * CD_BLOCK_SIZE;
+  if (snap_to_sectors && input_is_cd_quality && sector_point >= gap_start && sector_point <= gap_end)
+    point = sector_point;
+
+  if ((*numpoints > 0 && point <= points[*numpoints - 1]) || 0 == point || point >= info->data_size)
+    return;
+
+  if (SPLIT_MAX_PIECES - 1 == *numpoints)
+    st_error("too many split files would be created -- maximum is %d",SPLIT_MAX_PIECES);
+
+  st_debug1("found %lu-byte gap of silence at offset %lu, splitting at %lu",gap_end - gap_start,gap_start,point);
+
+  points[(*numpoints)++] = point;
+}
+
+static void read_split_points_silence(wave_info *info)
+{
+  unsigned char *buf;
+  wlong gap_bytes,block_size,pos,bytes,run_start = 0,points[SPLIT_MAX_PIECES];
+  int frame_size,numpoints = 0,p,q,i;
+  bool in_silence = TRUE;
+  progress_info proginfo;
+
+  if (WAVE_FORMAT_PCM != info->wave_format || info->bits_per_sample < 8 || info->bits_per_sample > 32 || info->bits_per_sample % 8)
+    st_error("gaps of silence can only be found in 8-, 16-, 24- or 32-bit PCM WAVE data");
+
+  if (snap_to_sectors && !input_is_cd_quality)
+    st_warning("input file is not CD-quality -- split points will not be moved to sector boundaries");
+
+  gap_word_size = (int)info->bits_per_sample / 8;
+
+  /* the silence level is given on a 16-bit scale */
+  if (gap_word_size > 2)
+    gap_word_level = gap_level << (8 * (gap_word_size - 2));
+  else if (gap_word_size < 2)
+    gap_word_level = gap_level >> 8;
+  else
+    gap_word_level = gap_level;
+
+  if (0 == (gap_bytes = smrt_parse((unsigned char *)gap_length,info)))
+    st_error("gap length must be positive");
+
+  frame_size = (int)max(info->block_align,1);
+  block_size = XFER_SIZE - XFER_SIZE % frame_size;
+
+  proginfo.initialized = FALSE;
+  proginfo.prefix = "Scanning";
+  proginfo.clause = NULL;
+  proginfo.filename1 = info->filename;
+  proginfo.filedesc1 = info->m_ss;
+  proginfo.filename2 = NULL;
+  proginfo.filedesc2 = NULL;
+  proginfo.bytes_total = info->data_size;
+
+  prog_update(&proginfo);
+
+  if (NULL == (buf = malloc(block_size * sizeof(unsigned char)))) {
+    prog_error(&proginfo);
+    st_error("could not allocate %lu-byte scan buffer",block_size);
+  }
+
+  if (!open_input_stream(info)) {
+    prog_error(&proginfo);
+    st_error("could not open input file: [%s]",info->filename);
+  }
+
+  discard_header(info);
+
+  if (info->input_format->decoder && NULL == (spool = tmpfile())) {
+    prog_error(&proginfo);
+    st_error("could not create temporary file for decoded data");
+  }
+
+  for (pos=0;pos<info->data_size;pos+=bytes) {
+    bytes = min(info->data_size - pos,block_size);
+
+    if (read_n_bytes(info->input,buf,(int)bytes,&proginfo) != (int)bytes) {
+      prog_error(&proginfo);
+      st_error("error while reading %lu bytes from input file",bytes);
+    }
+
+    if (spool && write_n_bytes(spool,buf,(int)bytes,NULL) != (int)bytes) {
+      prog_error(&proginfo);
+      st_error("error while writing %lu bytes to temporary file",bytes);
+    }
+
+    /* only whole frames are scanned, and in_silence carries over between blocks */
+    for (p=0;p+frame_size<=(int)bytes;) {
+      if (in_silence) {
+        if ((q = find_sample(buf + p,(int)bytes - p,TRUE)) < 0)
+          break;
+        q = p + q - (p + q) % frame_size;
+        /* silence at the very beginning is not a gap between tracks */
+        if (run_start > 0 && pos + q - run_start >= gap_bytes)
+          add_gap_split_point(info,run_start,pos + q,points,&numpoints);
+        in_silence = FALSE;
+        p = q + frame_size;
+      }
+      else {
+        if ((q = find_sample(buf + p,(int)bytes - p,FALSE)) < 0)
+          break;
+        p += q - q % frame_size;
+        run_start = pos + p;
+        in_silence = TRUE;
+      }
+    }
+  }
+
+  st_free(buf);
+
+  close_input_stream(info);
+
+  prog_success(&proginfo);
+
+  for (i=0;i<numpoints;i++) {
+    create_new_splitfile();
+
+    files[numfiles]->beginning_byte = points[i];
+    files[numfiles]->data_size = points[i] - ((i > 0) ? points[i-1] : 0);
+
+    adjust_splitfile(numfiles);
+
+    numfiles++;
+  }
+
+  if (NULL == (files[numfiles] = new_wave_info(NULL)))
+    st_error("could not allocate memory for split points array");
+
+  numfiles++;
+
+  if (1 == numfiles)
+    st_error("no gaps of silence found -- nothing to do");
+}
+
 static void get_extractable_tracks()
 {
   int i,start,end;
@@ -864,7 +1193,9 @@ static bool process_file(char *filename)
 
   get_extractable_tracks();
 
-  if (repeated_split_point)
+  if (gap_length)
+    read_split_points_silence(info);
+  else if (repeated_split_point)
     read_split_points_repeated(info);
   else
     read_split_points_file(info);
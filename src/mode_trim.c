@@ -29,6 +29,7 @@ mode_module mode_trim = {
   "Trims PCM WAVE silence from the ends of files",
   CVSIDSTR,
   TRUE,
+  TRUE,
   trim_main,
   trim_help
 };
@@ -73,111 +74,324 @@ static void parse(int argc,char **argv,int *first_arg)
   *first_arg = optind;
 }
 
-static void do_read_cached(wave_info *info,char *buf,int req_bytes,progress_info *proginfo)
-/* implements a local cache of data read from a file descriptor.
- * this is needed because scan_file() below only wants to read a few
- * bytes at a time, which is inefficient.
+static wlong scan_backwards(wave_info *info,long data_start,wlong from,unsigned char *buf,progress_info *proginfo)
+/* returns the offset of the last non-zero byte in the data, found by seeking back from the end of the
+ * file one block at a time.  'from' must be at or before a non-zero byte, so that the search stops there.
  */
 {
-  static char cache[XFER_SIZE];
-  static int cur_pos;
-  static int cur_max;
-  static int cur_total;
-  int bytes_read, req_filled;
-
-  /* check if being initialized */
-
-  if (NULL == info) {
-    cur_pos = XFER_SIZE;
-    cur_max = XFER_SIZE;
-    cur_total = 0;
+  wlong end,bytes;
+  int last;
+
+  for (end=info->data_size;end>from;end-=bytes) {
+    bytes = min(end - from,XFER_SIZE);
+
+    if (fseek(info->input,data_start + (long)(end - bytes),SEEK_SET)) {
+      prog_error(proginfo);
+      st_error("could not seek to offset %lu of WAVE data in input file",end - bytes);
+    }
+
+    if (read_n_bytes(info->input,buf,(int)bytes,proginfo) != (int)bytes) {
+      prog_error(proginfo);
+      st_error("error while reading %d bytes from input file",(int)bytes);
+    }
+
+    if ((last = vec_last_nonzero(buf,(int)bytes)) >= 0)
+      return end - bytes + last;
+  }
+
+  return from;
+}
+
+static void scan_file(wave_info *info,wlong *skip_beginning,wlong *skip_end,progress_info *proginfo)
+{
+  unsigned char *buf;
+  wlong pos,bytes,first = 0,last = 0;
+  long data_start = -1;
+  int sample_size,i;
+  bool found_noise = FALSE;
+
+  if (!open_input_stream(info)) {
+    st_warning("could not open input file: [%s]",info->filename);
     return;
   }
 
-  /* first, read from cached data */
+  discard_header(info);
+
+  sample_size = max(((int)info->bits_per_sample * (int)info->channels) / 8,1);
+
+  if (NULL == (buf = malloc(XFER_SIZE * sizeof(unsigned char))))
+    st_error("could not allocate %d-byte scan buffer",XFER_SIZE);
 
-  req_filled = 0;
-  while (cur_pos < cur_max && req_filled < req_bytes) {
-    buf[req_filled] = cache[cur_pos];
-    cur_pos++;
-    req_filled++;
-    cur_total++;
+  /* trailing silence in a WAVE file can be found by reading it backwards from the end */
+  if (trim_end && NULL == info->input_format->decoder && !strcmp(info->input_format->name,"wav")) {
+    if ((data_start = ftell(info->input)) >= 0 && fseek(info->input,data_start,SEEK_SET))
+      data_start = -1;
   }
 
-  if (req_filled == req_bytes)
-    return;
+  for (pos=0;pos<info->data_size;pos+=bytes) {
+    bytes = min(info->data_size - pos,XFER_SIZE);
 
-  /* ran out of cached data - try to read more from the file descriptor */
+    if (read_n_bytes(info->input,buf,(int)bytes,proginfo) != (int)bytes) {
+      prog_error(proginfo);
+      st_error("error while reading %d bytes from input file",(int)bytes);
+    }
 
-  cur_pos = 0;
-  cur_max = min(info->data_size - (wlong)cur_total,XFER_SIZE);
+    if (!found_noise) {
+      if ((i = vec_first_nonzero(buf,(int)bytes)) < 0)
+        continue;
+      found_noise = TRUE;
+      first = pos + i;
+      if (!trim_end)
+        break;
+      if (data_start >= 0) {
+        last = scan_backwards(info,data_start,first,buf,proginfo);
+        break;
+      }
+    }
 
-  if (cur_max != (bytes_read = fread(cache,1,cur_max,info->input))) {
-    prog_error(proginfo);
-    st_error("error while reading %d bytes into local cache from input file",cur_max);
+    if ((i = vec_last_nonzero(buf,(int)bytes)) >= 0)
+      last = pos + i;
   }
 
-  proginfo->bytes_written += bytes_read;
-  prog_update(proginfo);
+  st_free(buf);
 
-  do_read_cached(info,buf+req_filled,req_bytes-req_filled,proginfo);
+  close_input_stream(info);
+
+  if (!found_noise) {
+    *skip_beginning = *skip_end = info->data_size;
+    return;
+  }
+
+  /* silence is counted in whole samples, the last of which may be cut short */
+  *skip_beginning = first - first % sample_size;
+  *skip_end = info->data_size - min(last - last % sample_size + sample_size,info->data_size);
 }
 
-static void scan_file(wave_info *info,wlong *skip_beginning,wlong *skip_end,progress_info *proginfo)
+static void set_header_sizes(unsigned char *header,wave_info *info,wlong data_bytes)
 {
+  put_data_size(header,info->header_size,data_bytes);
+
+  if (PROB_EXTRA_CHUNKS(info))
+    put_chunk_size(header,info->header_size+data_bytes+info->extra_riff_size-8);
+  else
+    put_chunk_size(header,info->header_size+data_bytes-8);
+}
+
+static bool write_silence(FILE *output,wlong bytes)
+{
+  unsigned char zeros[BUF_SIZE];
+  int n;
+
+  memset(zeros,0,BUF_SIZE);
+
+  while (bytes > 0) {
+    n = (int)min(bytes,BUF_SIZE);
+    if (write_n_bytes(output,zeros,n,NULL) != n)
+      return FALSE;
+    bytes -= n;
+  }
+
+  return TRUE;
+}
+
+/*
+ * decoding compressed input twice, once to find the silence and once to trim it, doubles what
+ * is usually the slowest part of the job.  instead, such input is trimmed in one pass: leading
+ * silence is dropped as it comes in, and audio is written out as soon as it starts.  a run of
+ * silence after that might turn out to be trailing silence, so it is only counted, and written
+ * out as zeroes once more audio follows.  the WAVE header is patched with the final data size
+ * if the output file can be seeked.  otherwise (e.g. for an encoder), the data goes to a
+ * temporary file, which is sent along with the header once its size is known.
+ */
+
+static bool trim_file_single_pass(wave_info *info,char *outfilename,progress_info *proginfo)
+{
+  proc_info output_proc;
+  FILE *output = NULL,*data = NULL;
+  unsigned char *header = NULL,*buf = NULL,nulltrim[BUF_SIZE];
+  wlong pos,bytes,block_size,from,to,skip_beginning = 0,held = 0,data_bytes = 0;
   int sample_size,i;
-  bool is_silence,found_noise;
-  char sample[BUF_SIZE];
-  wlong bytes_to_read,bytes_remaining,tmp_beginning_bytes,tmp_end_bytes;
+  bool has_null_pad,started,seekable = FALSE,success = FALSE;
+
+  has_null_pad = odd_sized_data_chunk_is_null_padded(info);
 
   if (!open_input_stream(info)) {
-    st_warning("could not open input file: [%s]",info->filename);
-    return;
+    prog_error(proginfo);
+    st_warning("could not open input file -- skipping.");
+    return FALSE;
   }
 
-  discard_header(info);
+  sample_size = max(((int)info->bits_per_sample * (int)info->channels) / 8,1);
 
-  sample_size = ((int)info->bits_per_sample * (int)info->channels) / 8;
-  tmp_beginning_bytes = 0;
-  tmp_end_bytes = 0;
-  found_noise = FALSE;
+  /* blocks hold whole samples, so that silence can be measured in samples within each block */
+  block_size = XFER_SIZE - XFER_SIZE % sample_size;
 
-  bytes_remaining = info->data_size;
+  if (NULL == (header = malloc(info->header_size * sizeof(unsigned char))) ||
+      NULL == (buf = malloc(block_size * sizeof(unsigned char))))
+  {
+    prog_error(proginfo);
+    st_warning("could not allocate memory for trimming -- skipping.");
+    goto cleanup;
+  }
 
-  do_read_cached(NULL,sample,0,proginfo);
+  if (read_n_bytes(info->input,header,info->header_size,proginfo) != info->header_size) {
+    prog_error(proginfo);
+    st_warning("error while discarding %d-byte WAVE header -- skipping.",info->header_size);
+    goto cleanup;
+  }
 
-  while (bytes_remaining > 0) {
-    bytes_to_read = min(bytes_remaining,sample_size);
+  if (!do_header_kluges(header,info)) {
+    prog_error(proginfo);
+    st_warning("could not fix WAVE header -- skipping.");
+    goto cleanup;
+  }
 
-    do_read_cached(info,sample,bytes_to_read,proginfo);
+  if (PROB_EXTRA_CHUNKS(info) && !has_null_pad)
+    info->extra_riff_size++;
 
-    /* compare this sample against silence (all zeroes) */
-    is_silence = TRUE;
-    for (i=0;i<bytes_to_read;i++) {
-      if (sample[i]) {
-        is_silence = FALSE;
-        found_noise = TRUE;
-        break;
+  started = !trim_beginning;
+
+  for (pos=0;pos<info->data_size;pos+=bytes) {
+    bytes = min(info->data_size - pos,block_size);
+
+    if (read_n_bytes(info->input,buf,(int)bytes,proginfo) != (int)bytes) {
+      prog_error(proginfo);
+      st_warning("error while reading %lu bytes -- skipping.",bytes);
+      goto cleanup;
+    }
+
+    from = 0;
+
+    if (!started) {
+      if ((i = vec_first_nonzero(buf,(int)bytes)) < 0) {
+        skip_beginning += bytes;
+        continue;
+      }
+      from = i - i % sample_size;
+      skip_beginning += from;
+      started = TRUE;
+    }
+
+    if (NULL == output) {
+      if (NULL == (output = open_output_stream(outfilename,&output_proc))) {
+        prog_error(proginfo);
+        st_warning("could not open output file -- skipping.");
+        goto cleanup;
+      }
+
+      seekable = (NO_CHILD_PID == output_proc.pid && 0 == fseek(output,0,SEEK_CUR)) ? TRUE : FALSE;
+
+      if (seekable)
+        data = output;
+      else if (NULL == (data = tmpfile())) {
+        prog_error(proginfo);
+        st_warning("could not create temporary file for trimmed data -- skipping.");
+        goto cleanup;
+      }
+
+      /* the data size is filled in once it is known */
+      if (seekable && (info->header_size > 0) && write_n_bytes(output,header,info->header_size,NULL) != info->header_size) {
+        prog_error(proginfo);
+        st_warning("error while writing %d-byte WAVE header -- skipping.",info->header_size);
+        goto cleanup;
       }
     }
 
-    if (is_silence) {
-      if (!found_noise) {
-        tmp_beginning_bytes += bytes_to_read;
+    to = bytes;
+
+    if (trim_end) {
+      if ((i = vec_last_nonzero(buf + from,(int)(bytes - from))) < 0) {
+        held += bytes - from;
+        continue;
       }
-      tmp_end_bytes += bytes_to_read;
+      i += (int)from;
+      to = min(i - i % sample_size + sample_size,bytes);
     }
-    else {
-      tmp_end_bytes = 0;
+
+    if ((held > 0 && !write_silence(data,held)) || write_n_bytes(data,buf + from,(int)(to - from),NULL) != (int)(to - from)) {
+      prog_error(proginfo);
+      st_warning("error while transferring %lu bytes -- skipping.",held + to - from);
+      goto cleanup;
     }
 
-    bytes_remaining -= bytes_to_read;
+    data_bytes += held + to - from;
+    held = bytes - to;
+  }
+
+  if (!started || 0 == data_bytes) {
+    prog_error(proginfo);
+    st_warning("input file contains nothing but silence -- skipping.");
+    goto cleanup;
+  }
+
+  if (0 == skip_beginning && 0 == held) {
+    prog_error(proginfo);
+    st_warning("input file has no silence to trim from %s -- skipping.",
+      (trim_beginning && trim_end) ? "either end" :
+      ((trim_beginning) ? "the beginning" : "the end"));
+    goto cleanup;
+  }
+
+  if (PROB_ODD_SIZED_DATA(info) && has_null_pad) {
+    if (1 != read_n_bytes(info->input,nulltrim,1,NULL)) {
+      prog_error(proginfo);
+      st_warning("error while discarding NULL pad byte");
+      goto cleanup;
+    }
+  }
+
+  set_header_sizes(header,info,data_bytes);
+
+  if (!seekable) {
+    if ((info->header_size > 0) && write_n_bytes(output,header,info->header_size,NULL) != info->header_size) {
+      prog_error(proginfo);
+      st_warning("error while writing %d-byte WAVE header -- skipping.",info->header_size);
+      goto cleanup;
+    }
+
+    if (fseek(data,0,SEEK_SET) || transfer_n_bytes(data,output,data_bytes,NULL) != data_bytes) {
+      prog_error(proginfo);
+      st_warning("error while transferring %lu bytes of trimmed data -- skipping.",data_bytes);
+      goto cleanup;
+    }
+  }
+
+  /* write extra riff info */
+  if ((info->extra_riff_size > 0) && (transfer_n_bytes(info->input,output,info->extra_riff_size,proginfo) != info->extra_riff_size)) {
+    prog_error(proginfo);
+    st_warning("error while transferring %lu extra bytes -- skipping.",info->extra_riff_size);
+    goto cleanup;
+  }
+
+  if (seekable && (info->header_size > 0) &&
+      (fseek(output,0,SEEK_SET) || write_n_bytes(output,header,info->header_size,NULL) != info->header_size))
+  {
+    prog_error(proginfo);
+    st_warning("error while updating %d-byte WAVE header -- skipping.",info->header_size);
+    goto cleanup;
+  }
+
+  success = TRUE;
+
+  prog_success(proginfo);
+
+  st_debug1("trimmed %lu bytes from beginning and %lu bytes from end of file in one pass: [%s]",skip_beginning,held,info->filename);
+
+cleanup:
+  st_free(header);
+  st_free(buf);
+
+  if (data && data != output)
+    fclose(data);
+
+  if ((output) && ((CLOSE_CHILD_ERROR_OUTPUT == close_output(output,output_proc)) || !success)) {
+    success = FALSE;
+    remove_file(outfilename);
   }
 
   close_input_stream(info);
 
-  *skip_beginning = tmp_beginning_bytes;
-  *skip_end = tmp_end_bytes;
+  return success;
 }
 
 static bool trim_file(wave_info *info)
@@ -187,30 +401,35 @@ static bool trim_file(wave_info *info)
   char outfilename[FILENAME_SIZE];
   unsigned char *header = NULL,nulltrim[BUF_SIZE];
   wlong skip_beginning = 0,skip_end = 0,data_bytes = 0;
-  bool has_null_pad,success;
+  bool has_null_pad,single_pass,success;
   progress_info proginfo;
 
   success = FALSE;
 
+  single_pass = (info->input_format->decoder) ? TRUE : FALSE;
+
+  create_output_filename(info->filename,info->input_format->extension,outfilename);
+
   proginfo.initialized = FALSE;
-  proginfo.prefix = "Scanning";
-  proginfo.clause = NULL;
+  proginfo.prefix = (single_pass) ? "Trimming" : "Scanning";
+  proginfo.clause = (single_pass) ? "-->" : NULL;
   proginfo.filename1 = info->filename;
   proginfo.filedesc1 = info->m_ss;
-  proginfo.filename2 = NULL;
+  proginfo.filename2 = (single_pass) ? outfilename : NULL;
   proginfo.filedesc2 = NULL;
   proginfo.bytes_total = info->total_size;
 
   prog_update(&proginfo);
 
-  create_output_filename(info->filename,info->input_format->extension,outfilename);
-
   if (files_are_identical(info->filename,outfilename)) {
     prog_error(&proginfo);
     st_warning("output file would overwrite input file -- skipping.");
     return FALSE;
   }
 
+  if (single_pass)
+    return trim_file_single_pass(info,outfilename,&proginfo);
+
   scan_file(info,&skip_beginning,&skip_end,&proginfo);
 
   if (!trim_beginning)
@@ -277,15 +496,10 @@ static bool trim_file(wave_info *info)
     goto cleanup;
   }
 
-  put_data_size(header,info->header_size,data_bytes);
+  if (PROB_EXTRA_CHUNKS(info) && !has_null_pad)
+    info->extra_riff_size++;
 
-  if (PROB_EXTRA_CHUNKS(info)) {
-    if (!has_null_pad)
-      info->extra_riff_size++;
-    put_chunk_size(header,info->header_size+data_bytes+info->extra_riff_size-8);
-  }
-  else
-    put_chunk_size(header,info->header_size+data_bytes-8);
+  set_header_sizes(header,info,data_bytes);
 
   if ((info->header_size > 0) && write_n_bytes(output,header,info->header_size,&proginfo) != info->header_size) {
     prog_error(&proginfo);
@@ -372,16 +586,11 @@ static bool process_file(char *filename)
 
 static bool process(int argc,char **argv,int start)
 {  
-  char *filename;
   bool success;
 
-  success = TRUE;
-
   input_init(start,argc,argv);
 
-  while ((filename = input_get_filename())) {
-    success = (process_file(filename) && success);
-  }
+  success = process_input_files(process_file,NULL);
 
   return success;
 }